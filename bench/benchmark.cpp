@@ -0,0 +1,573 @@
+// benchmarks of the library's hot paths, over a range of topologies
+// results go to stdout as JSON (or CSV), so that runs can be compared by a script
+// run with --help for the options
+
+#include "../include/nnet.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace
+{
+
+	struct topology
+	{
+		std::string name;
+		std::vector<int> nodeCounts;
+		// skipped by --quick
+		bool large;
+	};
+
+	// one measurement, "op" is what a time is given per: one sample, or one call
+	// flop and byte counts are per op, and -1 where they don't apply
+	// bytes are the least memory traffic the op needs (parameters, nudges, inputs and outputs it must read or write),
+	// so bytes/s shows how close it runs to memory bandwidth
+	struct result
+	{
+		std::string benchmark;
+		std::string topology;
+		std::string op;
+		double nsPerOp;
+		double flops;
+		double bytes;
+		long long iterations;
+	};
+
+	struct options
+	{
+		bool csv = false;
+		bool quick = false;
+		double minTime = 0.25;
+		std::string filter;
+		nnet::storageType storage = nnet::storageType::float32;
+		double prune = 0;
+	};
+
+
+	const int batchSize = 64;
+
+
+	std::vector<topology> topologies ()
+	{
+
+		std::vector<int> deep = {64};
+		for (int i = 0; i < 16; ++i) deep.push_back(64);
+		deep.push_back(8);
+
+		return {
+			{"tiny", {2, 4, 1}, false},
+			{"small", {8, 16, 16, 4}, false},
+			{"medium", {64, 128, 128, 10}, false},
+			{"mnist", {784, 256, 128, 10}, false},
+			{"deep", deep, false},
+			{"wide", {256, 2048, 256}, false},
+			{"huge", {1024, 4096, 4096, 1024}, true}
+		};
+
+	}
+
+
+	std::string topologyString (const std::vector<int> &nodeCounts)
+	{
+
+		std::string s;
+
+		for (size_t i = 0; i < nodeCounts.size(); ++i)
+		{
+			if (i > 0) s += "-";
+			s += std::to_string(nodeCounts[i]);
+		}
+
+		return s;
+
+	}
+
+
+	const char* simdName (nnet::simdLevel level)
+	{
+		switch (level)
+		{
+			case nnet::simdLevel::scalar: return "scalar";
+			case nnet::simdLevel::sse2: return "sse2";
+			case nnet::simdLevel::avx2: return "avx2";
+			case nnet::simdLevel::avx512: return "avx512";
+		}
+
+		return "unknown";
+	}
+
+	const char* storageName (nnet::storageType type)
+	{
+		switch (type)
+		{
+			case nnet::storageType::float32: return "float32";
+			case nnet::storageType::float16: return "float16";
+			case nnet::storageType::bfloat16: return "bfloat16";
+			case nnet::storageType::sparse: return "sparse";
+		}
+
+		return "unknown";
+	}
+
+
+	// call run(n), which does n ops, with more and more ops until it takes at least minTime
+	// the ns per op of that last call is returned, and the op count goes to iterations
+	double measure (const std::function<void (long long)> &run, double minTime, long long &iterations)
+	{
+
+		typedef std::chrono::steady_clock clock;
+
+		// warm up caches, lazily allocated buffers and the kernel table
+		run(1);
+
+		for (long long n = 1; ; n *= 2)
+		{
+			const clock::time_point start = clock::now();
+			run(n);
+			const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+			// aim straight for minTime once a run is long enough to time well
+			if (seconds >= minTime || n >= (1LL << 40))
+			{
+				iterations = n;
+				return seconds * 1e9 / n;
+			}
+
+			if (seconds > minTime / 16)
+			{
+				n = std::max(n, (long long) (n * minTime / seconds) / 2);
+			}
+		}
+
+	}
+
+
+	class runner
+	{
+
+		public:
+			runner (const options &opts)
+			: m_opts {opts}
+			{}
+
+			// measure one benchmark, unless the filter excludes it
+			void add (const std::string &benchmark, const topology &t, const std::string &op, double flops, double bytes, const std::function<void (long long)> &run)
+			{
+
+				const std::string id = benchmark + "/" + t.name;
+
+				if (!m_opts.filter.empty() && id.find(m_opts.filter) == std::string::npos) return;
+
+				result r {benchmark, t.name, op, 0, flops, bytes, 0};
+				r.nsPerOp = measure(run, m_opts.minTime, r.iterations);
+
+				m_results.push_back(r);
+
+				std::fprintf(stderr, "%-24s %-8s %12.1f ns/%s\n", benchmark.c_str(), t.name.c_str(), r.nsPerOp, op.c_str());
+
+			}
+
+			void print (const std::vector<topology> &list) const
+			{
+				if (m_opts.csv) printCsv();
+				else printJson(list);
+			}
+
+
+		private:
+			options m_opts;
+			std::vector<result> m_results;
+
+
+			static double perSecond (double amount, double nsPerOp)
+			{
+				return amount < 0 ? -1 : amount / nsPerOp * 1e9;
+			}
+
+			static void printNumber (double value)
+			{
+				if (value < 0) std::printf("null");
+				else std::printf("%.6g", value);
+			}
+
+			void printJson (const std::vector<topology> &list) const
+			{
+
+				std::printf("{\n");
+				std::printf("\t\"simd\": \"%s\",\n", simdName(nnet::getSimdLevel()));
+				std::printf("\t\"storage\": \"%s\",\n", storageName(m_opts.storage));
+				std::printf("\t\"prune\": %g,\n", m_opts.prune);
+				std::printf("\t\"min_time\": %g,\n", m_opts.minTime);
+
+				std::printf("\t\"topologies\": {");
+
+				for (size_t i = 0; i < list.size(); ++i)
+				{
+					std::printf("%s\"%s\": \"%s\"", i > 0 ? ", " : "", list[i].name.c_str(), topologyString(list[i].nodeCounts).c_str());
+				}
+
+				std::printf("},\n");
+
+				std::printf("\t\"results\": [\n");
+
+				for (size_t i = 0; i < m_results.size(); ++i)
+				{
+					const result &r = m_results[i];
+
+					std::printf("\t\t{\"benchmark\": \"%s\", \"topology\": \"%s\", \"op\": \"%s\", \"iterations\": %lld, \"ns_per_op\": ",
+						r.benchmark.c_str(), r.topology.c_str(), r.op.c_str(), r.iterations);
+					printNumber(r.nsPerOp);
+
+					std::printf(", \"gflops\": ");
+					printNumber(perSecond(r.flops, r.nsPerOp) / (r.flops < 0 ? 1 : 1e9));
+
+					std::printf(", \"bytes_per_s\": ");
+					printNumber(perSecond(r.bytes, r.nsPerOp));
+
+					std::printf("}%s\n", i + 1 < m_results.size() ? "," : "");
+				}
+
+				std::printf("\t]\n}\n");
+
+			}
+
+			void printCsv () const
+			{
+
+				std::printf("benchmark,topology,op,iterations,ns_per_op,gflops,bytes_per_s\n");
+
+				for (const result &r: m_results)
+				{
+					std::printf("%s,%s,%s,%lld,%.6g,", r.benchmark.c_str(), r.topology.c_str(), r.op.c_str(), r.iterations, r.nsPerOp);
+
+					if (r.flops >= 0) std::printf("%.6g", perSecond(r.flops, r.nsPerOp) / 1e9);
+					std::printf(",");
+
+					if (r.bytes >= 0) std::printf("%.6g", perSecond(r.bytes, r.nsPerOp));
+					std::printf("\n");
+				}
+
+			}
+
+	};
+
+
+	void benchmarkTopology (runner &bench, const topology &t, const options &opts)
+	{
+
+		std::unique_ptr<nnet::neural> n1 {new nnet::neural(t.nodeCounts)};
+		n1->randomize();
+		n1->prune(opts.prune);
+		n1->setStorageType(opts.storage);
+
+		const int inputCount = t.nodeCounts.front();
+		const int outputCount = t.nodeCounts.back();
+
+		// weights, biases, and what they take up in memory
+		double weights = 0;
+		double biases = 0;
+
+		for (size_t i = 1; i < t.nodeCounts.size(); ++i)
+		{
+			weights += (double) t.nodeCounts[i] * t.nodeCounts[i - 1];
+			biases += t.nodeCounts[i];
+		}
+
+		// only the weights left after pruning do any work with sparse storage
+		if (opts.storage == nnet::storageType::sparse) weights *= 1 - opts.prune;
+
+		// a sparse weight comes with its column index
+		const double weightSize = opts.storage == nnet::storageType::float32 ? 4 : opts.storage == nnet::storageType::sparse ? 8 : 2;
+		const double paramBytes = weights * weightSize + biases * 4;
+		// nudges are always float
+		const double nudgeBytes = (weights + biases) * 4;
+		const double ioBytes = (inputCount + outputCount) * 4.0;
+
+
+		// a batch of random samples, the single-sample benchmarks cycle through its rows
+		nnet::rng generator(12345);
+
+		std::vector<float> inputs((size_t) batchSize * inputCount);
+		std::vector<float> ideals((size_t) batchSize * outputCount);
+		std::vector<float> outputs((size_t) batchSize * outputCount);
+
+		generator.fillUniform(inputs.data(), inputs.size(), -1, 1);
+		generator.fillUniform(ideals.data(), ideals.size(), -0.9f, 0.9f);
+
+		// so small that the parameters barely change while training
+		const float learningRate = 1e-6f;
+
+
+		bench.add("calculate", t, "sample", 2 * weights, paramBytes + ioBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				n1->setInput(inputs.data() + (i % batchSize) * inputCount, inputCount);
+				n1->calculate();
+			}
+		});
+
+		// one input in 32 nonzero, as with one-hot features, so the first layer only reads those inputs' weights
+		{
+			const int nonzeroCount = std::max(1, inputCount / 32);
+
+			std::vector<int> indexes((size_t) batchSize * nonzeroCount);
+			std::vector<float> values(indexes.size());
+
+			for (int &index: indexes)
+			{
+				index = generator.nextBelow(inputCount);
+			}
+
+			generator.fillUniform(values.data(), values.size(), -1, 1);
+
+			bench.add("calculateSparseInput", t, "sample", -1, -1, [&, nonzeroCount] (long long n)
+			{
+				for (long long i = 0; i < n; ++i)
+				{
+					const size_t row = (i % batchSize) * nonzeroCount;
+
+					n1->setInputSparse(indexes.data() + row, values.data() + row, nonzeroCount);
+					n1->calculate();
+				}
+			});
+		}
+
+		bench.add("calculateBatch", t, "sample", 2 * weights, paramBytes / batchSize + ioBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; i += batchSize)
+			{
+				n1->calculateBatch(inputs.data(), std::min<long long>(batchSize, n - i), outputs.data());
+			}
+		});
+
+		// two inputs changed between evaluations, as between moves in a game search
+		// the first layer costs 2 flops per node per change, and the rest of the network is calculated in full
+		{
+			const double firstWeights = (double) t.nodeCounts[0] * t.nodeCounts[1];
+			const double restWeights = weights - firstWeights;
+			const double restBytes = (paramBytes - firstWeights * weightSize) + 2 * t.nodeCounts[1] * 4.0;
+
+			bench.add("calculateIncremental", t, "sample", 2 * 2 * t.nodeCounts[1] + 2 * restWeights, restBytes, [&] (long long n)
+			{
+				nnet::incrementalEvaluator eval(*n1);
+				eval.setInput(inputs.data());
+
+				for (long long i = 0; i < n; ++i)
+				{
+					const float* row = inputs.data() + (i % batchSize) * inputCount;
+
+					eval.push();
+					eval.setValue(i % inputCount, row[0]);
+					eval.setValue((i * 7 + 3) % inputCount, row[1 % inputCount]);
+					eval.calculate(outputs.data());
+					eval.pop();
+				}
+			});
+		}
+
+		// forward, then backward into the accumulated nudges, which are applied once per batch
+		// the backward pass propagates each delta back (2 flops per weight) and nudges each weight (2 more)
+		bench.add("backprop", t, "sample", 6 * weights, paramBytes + 2 * nudgeBytes + ioBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				const size_t row = i % batchSize;
+
+				n1->setInput(inputs.data() + row * inputCount, inputCount);
+				n1->calculate();
+				n1->backprop(true, learningRate, ideals.data() + row * outputCount, outputCount);
+
+				if (row == batchSize - 1) n1->backpropApply();
+			}
+
+			n1->backpropClear();
+		});
+
+		// reads and writes every parameter, and reads and clears every nudge
+		bench.add("backpropApply", t, "call", 2 * (weights + biases), 2 * paramBytes + 2 * nudgeBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				n1->trainDataCount = 1;
+				n1->backpropApply();
+			}
+		});
+
+		bench.add("backpropBatch", t, "sample", 6 * weights, (2 * paramBytes + 2 * nudgeBytes) / batchSize + ioBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; i += batchSize)
+			{
+				n1->trainBatch(inputs.data(), ideals.data(), std::min<long long>(batchSize, n - i), learningRate);
+			}
+		});
+
+		bench.add("makeCopy", t, "call", -1, 2 * paramBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				std::unique_ptr<nnet::neural> copy {n1->makeCopy()};
+			}
+		});
+
+		// the weights are shared rather than copied, so there's no byte count that means much
+		bench.add("split", t, "call", -1, -1, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				std::unique_ptr<nnet::neural> copy {n1->split()};
+			}
+		});
+
+		// a random value, a multiply and an add per parameter
+		bench.add("tweak", t, "call", 3 * (weights + biases), 2 * paramBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				n1->tweak(1e-6f);
+			}
+		});
+
+
+		const std::string filename = (std::filesystem::temp_directory_path() / ("nnet_benchmark_" + t.name + ".nnet")).string();
+
+		if (!n1->saveToFile(filename))
+		{
+			std::fprintf(stderr, "could not write %s, skipping the file benchmarks\n", filename.c_str());
+			return;
+		}
+
+		const double fileBytes = std::filesystem::file_size(filename);
+
+		bench.add("saveToFile", t, "call", -1, fileBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				n1->saveToFile(filename);
+			}
+		});
+
+		bench.add("loadFromFile", t, "call", -1, fileBytes, [&] (long long n)
+		{
+			for (long long i = 0; i < n; ++i)
+			{
+				std::unique_ptr<nnet::neural> loaded {nnet::neural::loadFromFile(filename)};
+			}
+		});
+
+		std::filesystem::remove(filename);
+
+	}
+
+
+	void printUsage (const char* program)
+	{
+		std::fprintf(stderr,
+			"usage: %s [options]\n"
+			"  --format=json|csv     output format, json by default\n"
+			"  --min-time=SECONDS    least time spent on each measurement, 0.25 by default\n"
+			"  --quick               skip the large topologies, with a shorter min-time\n"
+			"  --filter=TEXT         only run benchmarks whose \"benchmark/topology\" name contains TEXT\n"
+			"  --storage=TYPE        weight storage: float32 (default), float16, bfloat16 or sparse\n"
+			"  --prune=FRACTION      prune this fraction of each layer's weights first, see neural::prune()\n"
+			"  --simd=LEVEL          force scalar, sse2, avx2 or avx512 instead of the widest supported\n"
+			"results go to stdout, progress to stderr\n",
+			program);
+	}
+
+}
+
+
+
+int main (int argc, char** argv)
+{
+
+	options opts;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const size_t eq = arg.find('=');
+		const std::string key = arg.substr(0, eq);
+		const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+		if (key == "--format" && (value == "json" || value == "csv"))
+		{
+			opts.csv = value == "csv";
+		}
+		else if (key == "--min-time" && !value.empty())
+		{
+			opts.minTime = std::stod(value);
+		}
+		else if (key == "--quick")
+		{
+			opts.quick = true;
+			opts.minTime = 0.05;
+		}
+		else if (key == "--filter")
+		{
+			opts.filter = value;
+		}
+		else if (key == "--storage" && (value == "float32" || value == "float16" || value == "bfloat16" || value == "sparse"))
+		{
+			opts.storage = value == "float32" ? nnet::storageType::float32
+				: value == "float16" ? nnet::storageType::float16
+				: value == "bfloat16" ? nnet::storageType::bfloat16
+				: nnet::storageType::sparse;
+		}
+		else if (key == "--prune" && !value.empty())
+		{
+			opts.prune = std::stod(value);
+		}
+		else if (key == "--simd" && (value == "scalar" || value == "sse2" || value == "avx2" || value == "avx512"))
+		{
+			const nnet::simdLevel level = value == "scalar" ? nnet::simdLevel::scalar
+				: value == "sse2" ? nnet::simdLevel::sse2
+				: value == "avx2" ? nnet::simdLevel::avx2
+				: nnet::simdLevel::avx512;
+
+			if (!nnet::isSimdLevelSupported(level))
+			{
+				std::fprintf(stderr, "this CPU does not support %s\n", value.c_str());
+				return 1;
+			}
+
+			nnet::setSimdLevel(level);
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+
+	nnet::seedRandom(1);
+
+	std::vector<topology> list;
+
+	for (const topology &t: topologies())
+	{
+		if (!opts.quick || !t.large) list.push_back(t);
+	}
+
+	runner bench(opts);
+
+	for (const topology &t: list)
+	{
+		benchmarkTopology(bench, t, opts);
+	}
+
+	bench.print(list);
+
+	return 0;
+
+}
@@ -4,22 +4,123 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <cstdint>
 
 #include "nnet_error.hpp"
+#include "nnet_random.hpp"
+#include "nnet_profile.hpp"
 
 
 namespace nnet
 {
 
-	// wrapper for the builtin rand() function
+	// uniform in [0, 1), from the calling thread's generator (see threadRng())
 	float randFloat ();
 
 	// get endianness of current system
 	bool isLittleEndian ();
 
+	// allocate a zeroed float buffer, aligned to a 64-byte cache line
+	std::shared_ptr<float> allocFloats (size_t count);
+
+	// the same, for half-precision weights
+	std::shared_ptr<uint16_t> allocHalves (size_t count);
+
+
+	// how layer weights are stored, in memory and in saved files
+	// the half-precision types halve the memory and bandwidth taken by the weights, while all of the math is still done in float
+	// biases and backprop nudges are always float
+	enum class storageType : uint8_t
+	{
+		float32,
+		float16, // IEEE binary16
+		bfloat16, // top half of a float32, same range but fewer mantissa bits
+		sparse // only the nonzero weights, as float32 in compressed sparse rows, see neural::prune()
+	};
+
+
+	// how backpropApply() turns the accumulated nudges into weight and bias updates
+	enum class optimizerType : uint8_t
+	{
+		sgd, // plain gradient descent, the default
+		momentum,
+		rmsprop,
+		adam
+	};
+
+	struct optimizerSettings
+	{
+		optimizerType type = optimizerType::sgd;
+
+		// momentum: fraction of the last update carried into the next one
+		float momentum = 0.9f;
+
+		// rmsprop: decay of the running mean of squared updates
+		float rmsDecay = 0.9f;
+
+		// adam: decay of the running mean and of the running mean of squares
+		float beta1 = 0.9f;
+		float beta2 = 0.999f;
+
+		// rmsprop and adam normalize each update by its running size, which cancels out the learning rate passed to backprop
+		// so for those two, this sets how far each parameter moves per step instead
+		float stepSize = 0.001f;
+		float epsilon = 1e-8f;
+	};
+
+
+
+	// instruction sets that the inner loops (dot products, activation, weight updates) can be run with
+	// the widest one supported by the CPU is selected automatically the first time it's needed
+	enum class simdLevel
+	{
+		scalar,
+		sse2,
+		avx2, // also requires FMA and F16C
+		avx512 // F, BW and VL
+	};
+
+	// the widest level this machine supports
+	simdLevel detectSimdLevel ();
+	bool isSimdLevelSupported (simdLevel level);
+
+	simdLevel getSimdLevel ();
+	// force a specific level, e.g. to test the scalar fallback. throws usageError if the CPU doesn't support it
+	// this is not thread-safe, so don't call it while networks are being used on other threads
+	void setSimdLevel (simdLevel level);
+
 
 
 	struct layer;
+	class neural;
+
+	// where the nonzero weights of a layer with sparse storage are, in compressed sparse rows
+	// row i's weights are at rowStarts[i] up to rowStarts[i + 1], in the columns (previous layer nodes) given by columns
+	struct sparsePattern
+	{
+		std::vector<size_t> rowStarts;
+		std::vector<int> columns;
+	};
+
+	// scratch space for the forward calculation, so that one network can be evaluated from many threads at once
+	// use one context per thread. the buffers grow as needed and are reused between calls
+	class inferenceContext
+	{
+
+		public:
+			inferenceContext () = default;
+			// pre-size the buffers for batches of up to maxBatch samples on this network
+			inferenceContext (const neural &network, size_t maxBatch = 1);
+
+			// intermediate layer values, ping-ponged between layers
+			std::vector<float> buffers[2];
+
+			// quantized layer values, for quantizedNetwork
+			std::vector<int8_t> quantizedBuffer;
+
+	};
+
+
 
 	class neural
 	{
@@ -27,10 +128,17 @@ namespace nnet
 		public:
 			neural (int middleLayerCount, int inputNodeCount, int middleNodeCount, int outputNodeCount);
 
+			// one node count per layer, from the input layer to the output layer, e.g. std::vector<int> {784, 512, 128, 32, 10}
+			// spell out the std::vector, since a braced list of four ints on its own, as in neural n {1, 3, 5, 2}, means the constructor above
+			neural (std::vector<int> nodeCounts);
+
 			// every neural object automatically creates its own unique UID
 			// call this function to retrieve it
 			std::string getUID ();
 
+			// the node count of every layer, from the input layer to the output layer
+			std::vector<int> getNodeCounts () const;
+
 
 
 			// use verbose makeCopy method to copy a neural network
@@ -38,8 +146,10 @@ namespace nnet
 			neural* makeCopy ();
 
 			// functions to save and load to/from a file
+			// the file is written under a temporary name and then renamed over filename, so a failed save leaves any old file as it was
 			bool saveToFile (std::string filename);
-			// this returns a pointer to an object allocated with the "new" keyword
+			// this returns a pointer to an object allocated with the "new" keyword, or nullptr if the file can't be read or is truncated
+			// the network gets its own copy of the parameters, so the file can be changed or overwritten while it's loaded
 			static neural* loadFromFile (std::string filename);
 
 
@@ -52,20 +162,69 @@ namespace nnet
 
 			// forward calculation. make sure all inputs are set as desired before calling this
 			void calculate ();
+
+			// forward calculation over a whole batch of samples at once
+			// inputs holds count rows of input values, and outputs receives count rows of output values (both row-major)
+			// this does not touch the values held by the layers
+			void calculateBatch (const float* inputs, size_t count, float* outputs);
+
+			// thread-safe versions of the forward calculation
+			// these only read the weights and biases, and keep every intermediate value in ctx instead of in the layers
+			// so any number of threads can share one network, as long as each one uses its own context
+			// and nothing is modifying the network (training, tweak(), etc.) at the same time
+			void calculate (inferenceContext &ctx, const float* input, float* output) const;
+			void calculateBatch (inferenceContext &ctx, const float* inputs, size_t count, float* outputs) const;
 			// set all weights and biases to random values
 			void randomize ();
 			// tweak all weights/biases by random values, with a maximum magnitude parameter
 			void tweak (float magnitude);
+			// the same with a caller-owned generator, for reproducible results or one generator per thread
+			// the versions above use threadRng()
+			void randomize (rng &generator);
+			void tweak (float magnitude, rng &generator);
+
+			// convert every layer's weights to another storage type (float32 by default)
+			// training still works on half-precision weights, each update is rounded when it is stored
+			// converting to sparse keeps the weights that are nonzero at the time, and training only ever updates those,
+			// so calculate() and backprop() take time in proportion to them rather than to the full weight count
+			// converting to or from sparse clears any accumulated nudges and the optimizer state
+			// files are always saved with dense weights, so a sparse network is saved as float32
+			void setStorageType (storageType type);
+			storageType getStorageType () const;
+
+			// magnitude pruning: set the given fraction (0 to 1) of each layer's weights, those closest to zero, to zero
+			// biases are left alone
+			// with sparse storage the pruned weights are dropped, and stay zero from then on
+			// with the other storage types they are only zeroed, and training will move them again
+			void prune (float fraction);
+
+			// choose how nudges are applied, this resets the optimizer state (momentum and running averages) of every layer
+			// sgd, momentum: the learning rate passed to backprop sets the step size
+			// rmsprop, adam: settings.stepSize sets the step size
+			// the optimizer runs in backpropApply(), so backprop() without accumulate goes through it for anything but sgd
+			void setOptimizer (const optimizerSettings &settings);
+			optimizerSettings getOptimizer () const;
 
 
 			// backprop, given an ideal output
 			// set "accumulate" to true to average over a minibatch, then call backpropApply()
-			void backprop (bool accumulate, float learningRate, std::vector<float> ideal);
+			void backprop (bool accumulate, float learningRate, const std::vector<float> &ideal);
+			// the same with the ideal output in a caller-owned buffer, count must be at least the output node count
+			void backprop (bool accumulate, float learningRate, const float* ideal, size_t count);
 			void backpropApply ();
 
-			// merge backprop accumulation from another neural object
+			// minibatch backprop over a whole batch of samples at once, computed layer by layer as matrix products
+			// inputs and ideals hold count rows of input and ideal output values (both row-major)
+			// the nudges are accumulated exactly like count calls to backprop() with accumulate set to true
+			void backpropBatch (const float* inputs, const float* ideals, size_t count, float learningRate);
+			// same as backpropBatch(), then backpropApply()
+			void trainBatch (const float* inputs, const float* ideals, size_t count, float learningRate);
+
+			// merge backprop accumulation from another neural object, with the same topology
+			// the nudges of "other" are added to this one's, and "other" is left unchanged
 			void backpropMergeFrom (neural& other);
-			// same as makeCopy, but point to same underlying weight data
+			// same as makeCopy, but point to same underlying weights and biases
+			// each copy has its own values, nudges and optimizer state, so it can train on its own thread, see hogwildTrainer
 			neural* split ();
 
 			// clear the backprop accumulation data without applying it
@@ -75,7 +234,8 @@ namespace nnet
 			int trainDataCount = 0;
 
 			// get current cost value
-			float cost (std::vector<float> ideal);
+			float cost (const std::vector<float> &ideal);
+			float cost (const float* ideal, size_t count);
 
 
 
@@ -84,6 +244,24 @@ namespace nnet
 
 			// set values of input nodes
 			void setInput (const std::vector<float> &input);
+			// count must be at least the input node count
+			void setInput (const float* input, size_t count);
+			// set input node indexes[i] to values[i], and every other input node to 0, for one-hot or multi-hot inputs
+			// when most of the inputs are 0, the first layer's calculate() and backprop() only visit the others
+			void setInputSparse (const int* indexes, const float* values, size_t count);
+
+			// copy the output values into a caller-owned buffer, count must be at least the output node count
+			// run this AFTER calculate()
+			void getOutput (float* output, size_t count) const;
+
+
+			// per-layer timings and counts, one entry per layer (entry 0, the input layer, stays empty)
+			// these are only collected when the library is built with NNET_PROFILE defined, see nnet_profile.hpp
+			// copies made with makeCopy() or split() start from zero, parallelTrainer adds its replicas' counts back into the network
+			std::vector<layerProfile> getProfile () const;
+			void resetProfile ();
+			// the same counts as a JSON document
+			std::string getProfileJson () const;
 
 
 			// either of these selectOutput() functions should be run AFTER calculate()
@@ -91,6 +269,7 @@ namespace nnet
 			// this function uses the output values as probability weights to select one of the nodes
 			// because the nodes can have negative values, this function adds 1.1 to each of the weights so that the range will be 0.1 to 2.1
 			int selectOutput ();
+			int selectOutput (rng &generator);
 
 			// this function simply returns the index of the greatst-valued output node
 			// no randomness involved
@@ -104,16 +283,20 @@ namespace nnet
 			void regenUID ();
 
 
-		// data properties
+		// context used by the calculateBatch() overload without one
 		private:
-			int m_middleLayerCount;
+			inferenceContext m_batchContext;
 
-			int m_inputNodeCount;
-			int m_middleNodeCount;
-			int m_outputNodeCount;
+
+		// data properties
+		private:
+			std::vector<int> m_nodeCounts;
 
 
 		private:
+			// with allocateParams set to false, the layers are left without weight and bias buffers, for loadFromFile() to fill in
+			neural (std::vector<int> nodeCounts, bool allocateParams);
+
 			// these are to be used only by the public makeCopy method
 			neural* makeCopy_m (bool copyWeights);
 			neural (const neural&) = default;
@@ -127,58 +310,108 @@ namespace nnet
 
 
 
+	// lightweight view of a single node inside a layer
+	// all of the storage belongs to the layer, so a node is only valid as long as its layer is alive
 	struct node
 	{
-		node (std::weak_ptr<layer> _prevLayer);
+		float &value;
+		float &bias;
 
-		// pointer to previous layer, so that this node can calculate what its value should be
-		std::weak_ptr<layer> prevLayer; 
+		// points to this node's row of the layer's weight matrix
+		// nullptr for input nodes, and when the weights aren't stored as float32
+		float* weights;
+		int weightCount;
 
-		std::shared_ptr<std::vector<float>> weights;
-		float bias = 0;
+		float cost (float ideal) const;
+	};
 
-		// see the descriptions in class neural{} for what these functions do
-		void calculate ();
-		void randomize ();
-		void tweak (float magnitude);
 
-		// the active value being held by this node
-		float value = 0;
 
+	class threadPool;
 
-		////// backprop calculation
-		// "ideal" argument is only used if "isOutputNode" is true
-		void backprop (bool accumulate, float learningRate, bool isOutputNode, float ideal = 0);
+	// data-parallel minibatch trainer
+	// each minibatch is sharded across worker threads, each running backpropBatch() on its own split() of the network
+	// the nudges are then reduced and applied with every thread owning a disjoint slice of the weights, so no locks are needed
+	class parallelTrainer
+	{
 
+		public:
+			// the network is trained in place, and must outlive the trainer
+			// threadCount of 0 uses the number of hardware threads
+			parallelTrainer (neural &network, int threadCount = 0);
+			~parallelTrainer ();
 
-		// call this after processing a minibatch, to actually apply the nudges
-		void backpropApply (int trainDataCount);
+			// one training step over a minibatch, see neural::trainBatch()
+			void trainBatch (const float* inputs, const float* ideals, size_t count, float learningRate);
 
-		// clear the backprop accumulation data without applying it
-		void backpropClear ();
+			int getThreadCount ();
 
 
-		void inline activate ();
-		float cost (float ideal);
-		// this function should ONLY be called by the output layer nodes!!!
-		float inline dCost_dValue (float ideal);
-		// derivative of activation function
-		float inline dValue_dUnactivated ();
-		// indices denote which weight to calculate for
-		float inline dUnactivated_dWeight (std::shared_ptr<layer> prevLayer, int weightInd);
-		float constexpr dUnactivated_dBias ();
-		float inline dUnactivated_dPrevValue (int prevNodeInd);
+		private:
+			neural &m_network;
 
-		// resets dCost_dValue_ of this node
-		void resetVitalCache ();
+			// replica 0 is the network itself, the rest share its weights and biases
+			std::vector<neural*> m_replicas;
+			std::vector<std::unique_ptr<neural>> m_ownedReplicas;
 
+			std::unique_ptr<threadPool> m_pool;
 
-		////// backprop cache data
-		float dCost_dValue_ = 0; // this value is affected from outside this node
+			// (re)make the replicas, when starting out or after the network's parameters have been replaced
+			void splitReplicas ();
 
-		////// backprop nudge sums (for minibatch averaging)
-		std::vector<float> weightNudgeSums;
-		float biasNudgeSum = 0;
+			// reduce the nudges of all replicas into the network, then apply them
+			void reduceAndApply ();
+
+
+			parallelTrainer (const parallelTrainer&) = delete;
+			parallelTrainer& operator= (const parallelTrainer&) = delete;
+
+	};
+
+
+	// lock-free asynchronous SGD (Hogwild!)
+	// each worker thread trains its own split() of the network one sample at a time, with backprop() not accumulating,
+	// so every update is written straight into the shared weights and biases, with no locks and no reduction step
+	// the threads race on purpose: an update can be computed from weights that another thread is halfway through changing,
+	// or occasionally overwrite another thread's update to the same weight
+	// this is benign (each float is written whole, and nothing but the parameters is shared), and when each update touches
+	// few of the weights, as with sparse inputs, the lost updates are rare enough that convergence matches
+	// single-threaded per-sample SGD at near-linear speedup; dense models see more interference,
+	// which acts like extra gradient noise, so a smaller learning rate may be needed
+	// with any optimizer but sgd, each replica runs it on its own state (momentum, running averages) over the shared weights,
+	// and every update rewrites all of them, so sgd is the one that benefits from sparse updates
+	// race detectors will (correctly) report the races
+	class hogwildTrainer
+	{
+
+		public:
+			// the network is trained in place, and must outlive the trainer
+			// threadCount of 0 uses the number of hardware threads
+			hogwildTrainer (neural &network, int threadCount = 0);
+			~hogwildTrainer ();
+
+			// train on count samples, thread t taking samples t, t + threadCount, t + 2 * threadCount, ...
+			// inputs and ideals hold count rows of input and ideal output values (both row-major)
+			void train (const float* inputs, const float* ideals, size_t count, float learningRate);
+
+			int getThreadCount ();
+
+
+		private:
+			neural &m_network;
+
+			// replica 0 is the network itself, the rest share its weights and biases
+			std::vector<neural*> m_replicas;
+			std::vector<std::unique_ptr<neural>> m_ownedReplicas;
+
+			std::unique_ptr<threadPool> m_pool;
+
+			// (re)make the replicas, when starting out or after the network's parameters have been replaced
+			void splitReplicas ();
+
+
+			hogwildTrainer (const hogwildTrainer&) = delete;
+			hogwildTrainer& operator= (const hogwildTrainer&) = delete;
 
 	};
 
@@ -186,31 +419,151 @@ namespace nnet
 
 	struct layer
 	{
-		layer (int nodeCount, std::weak_ptr<layer> prevLayer = std::weak_ptr<layer>());
+		// prevNodeCount is 0 for the input layer, which has no weights or biases
+		// if allocateParams is false, weights and biases are left empty for the caller to fill in
+		layer (int nodeCount, int prevNodeCount = 0, bool allocateParams = true);
+
+		int nodeCount;
+		int prevNodeCount;
+
+
+		////// parameters
+		// these are shared between a network and the copies made with neural::split()
 
-		std::vector<node> nodes;
+		// row-major weight matrix, with nodeCount rows and prevNodeCount columns
+		// row i holds the weights of node i, one per node in the previous layer
+		// this is empty unless storage is float32
+		std::shared_ptr<float> weights;
+		std::shared_ptr<float> biases;
 
-		// these just call the respective functions on each of the nodes in this layer
-		void calculate ();
-		void randomize ();
-		void tweak (float magnitude);
+		// the weight matrix when storage is float16 or bfloat16, same layout as weights
+		storageType storage = storageType::float32;
+		std::shared_ptr<uint16_t> halfWeights;
+
+		// the nonzero weights when storage is sparse, in the order of the pattern
+		// the pattern never changes once made, so copies of the layer share it even when they don't share the weights
+		std::shared_ptr<float> sparseWeights;
+		std::shared_ptr<const sparsePattern> pattern;
+
+
+		////// per-network state
+
+		// the active value being held by each node
+		std::vector<float> values;
+
+		// backprop cache, this value is affected from outside this layer
+		std::vector<float> dCost_dValues;
+
+		// backprop nudge sums (for minibatch averaging), same layout as weights/biases
+		// with sparse storage, the weight nudges follow sparseWeights instead, one per nonzero weight
+		// weightNudgeSums stays empty for layers made without allocateParams until they're trained, see allocateNudgeSums()
+		std::vector<float> weightNudgeSums;
+		std::vector<float> biasNudgeSums;
+
+		// optimizer state, same layout as weights/biases
+		// [0] is the momentum velocity or adam's running mean, [1] is the running mean of squares for rmsprop and adam
+		// these are only allocated when the optimizer uses them
+		optimizerSettings optimizer;
+		std::vector<float> weightState[2];
+		std::vector<float> biasState[2];
+		// number of updates applied, for adam's bias correction
+		int optimizerStep = 0;
+
+		// see nnet_profile.hpp, mutable so that the const inference functions can record into it
+		mutable profileCounters profile;
+
+		// per-sample values and dCost_dUnactivated for neural::backpropBatch(), one row per sample
+		std::vector<float> batchValues;
+		std::vector<float> batchDeltas;
+
+
+		// get a view of node i
+		node getNode (int i);
+
+		// see the descriptions in class neural{} for what these functions do
+		void calculate (const layer &prev);
+		// in holds prevNodeCount values, and out receives nodeCount values
+		void calculate (const float* in, float* out) const;
+		// in holds count rows of prevNodeCount values, out receives count rows of nodeCount values
+		void calculateBatch (const float* in, size_t count, float* out) const;
+		void randomize (rng &generator);
+		void tweak (float magnitude, rng &generator);
 
 		// use this for the output layer
-		void backprop (bool accumulate, float learningRate, std::vector<float> ideal);
+		void backprop (bool accumulate, float learningRate, layer &prev, const std::vector<float> &ideal);
+		void backprop (bool accumulate, float learningRate, layer &prev, const float* ideal, size_t count);
 		// use this for all middle layers
-		void backprop (bool accumulate, float learningRate);
+		void backprop (bool accumulate, float learningRate, layer &prev);
 
 		// call this after processing a minibatch, to actually apply the nudges
 		void backpropApply (int trainDataCount);
+		// the same thing split in two, so the weights can be applied a range at a time from several threads
+		// unlike backpropApply(), these don't count the step, so increment optimizerStep once before calling them
+		void backpropApplyWeights (int trainDataCount, size_t begin, size_t end);
+		void backpropApplyBiases (int trainDataCount);
+
+		// batched backprop, make sure batchValues holds this layer's output for the batch first
+		// use this to fill in batchDeltas for the output layer
+		void backpropBatchOutput (const float* ideals, size_t count);
+		// in holds the previous layer's values for the batch, and batchDeltas must already be filled in
+		// if prevDeltas isn't nullptr, it receives the previous layer's dCost_dUnactivated for each sample
+		void backpropBatch (const float* in, size_t count, float learningRate, float* prevDeltas);
 
 		// clear the backprop accumulation data without applying it
 		void backpropClear ();
 
+		// make sure weightNudgeSums holds one nudge per stored weight
+		// the backprop functions call this themselves, it's only needed before touching the nudges directly
+		void allocateNudgeSums ();
+
 		void resetVitalCache ();
 
+		// give this layer its own copy of the weights and biases
+		void unshareParams ();
+
+		// set the optimizer and clear its state
+		void setOptimizer (const optimizerSettings &settings);
+
+		// convert the weights to another storage type, this gives the layer its own copy of them
+		void setStorageType (storageType type);
+
+		// zero the fraction of the weights with the smallest magnitudes, see neural::prune()
+		void prune (float fraction);
+
+		// the number of weights actually stored, which is also the number of weight nudges
+		// nodeCount * prevNodeCount, unless storage is sparse
+		size_t storedWeightCount () const;
+
+		// copy count weights, starting at flat index begin, to or from float, whatever the storage type
+		void loadWeights (size_t begin, size_t count, float* dst) const;
+		void storeWeights (size_t begin, size_t count, const float* src);
+
+
+		private:
+			// shared by both backprop() overloads, once dCost_dValues is filled in
+			void backprop_m (bool accumulate, float learningRate, layer &prev);
+
+			// backpropBatch() for sparse storage
+			void backpropBatchSparse (const float* in, size_t count, float learningRate, float* prevDeltas);
+
+			// float view of count weights starting at begin
+			// this is the weights themselves for float32 storage, otherwise they are converted into scratch
+			// after changing the values, call commitWeights() with the same arguments
+			float* weightsAsFloat (size_t begin, size_t count, float* scratch) const;
+			void commitWeights (size_t begin, size_t count, const float* values);
 	};
 
 }
 
 
+#include "nnet_activation.hpp"
+#include "nnet_quantized.hpp"
+#include "nnet_incremental.hpp"
+#include "nnet_population.hpp"
+#include "nnet_server.hpp"
+#include "nnet_dataset.hpp"
+#include "nnet_distributed.hpp"
+#include "nnet_static.hpp"
+
+
 #endif
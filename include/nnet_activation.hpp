@@ -0,0 +1,102 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_ACTIVATION_HPP
+#define NNET_ACTIVATION_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+
+namespace nnet
+{
+	namespace activation
+	{
+
+		// tanh, rebuilt from exp as 1 - 2 / (exp(2|x|) + 1)
+		// the vector kernels use this same polynomial, and call this scalar version for leftover elements
+		// accurate to a few ulp of 1, which is plenty for an activation function
+		// NaN comes out as NaN rather than being clamped to 1, so a network that has diverged still shows it
+
+		const float tanhClamp = 9.0f; // tanh(9) rounds to 1 in float
+		const float expLog2e = 1.44269504088896341f;
+		const float expLn2Hi = 0.693359375f;
+		const float expLn2Lo = -2.12194440e-4f;
+		const float expP0 = 1.9875691500e-4f;
+		const float expP1 = 1.3981999507e-3f;
+		const float expP2 = 8.3334519073e-3f;
+		const float expP3 = 4.1665795894e-2f;
+		const float expP4 = 1.6666665459e-1f;
+		const float expP5 = 5.0000001201e-1f;
+		const float roundMagic = 12582912.0f;
+
+		inline float tanhApprox (float x)
+		{
+			// written without branches, so that loops over it can be vectorized
+			const float a = std::fabs(x) < tanhClamp ? std::fabs(x) : tanhClamp;
+
+			// exp(2a) = 2^n * exp(r)
+			const float y = 2 * a;
+			// round to nearest by adding and subtracting 1.5 * 2^23, which (unlike nearbyint) inlines and vectorizes everywhere
+			const float n = (y * expLog2e + roundMagic) - roundMagic;
+			const float r = y - n * expLn2Hi - n * expLn2Lo;
+
+			float p = expP0;
+			p = p * r + expP1;
+			p = p * r + expP2;
+			p = p * r + expP3;
+			p = p * r + expP4;
+			p = p * r + expP5;
+			p = p * r * r + r + 1;
+
+			const int32_t bits = ((int32_t) n + 127) << 23;
+			float scale;
+			std::memcpy(&scale, &bits, sizeof(float));
+
+			const float t = 1 - 2 / (p * scale + 1);
+
+			// the clamp turns NaN into tanhClamp, which keeps the conversion of n to int defined, so NaN is put back here
+			return std::isnan(x) ? x : std::copysign(t, x);
+		}
+
+
+		// four floats in one vector register, using the GCC/Clang vector extensions
+		// this is for header-only code, which can't use the runtime-dispatched kernels
+		typedef float vec4 __attribute__((vector_size(16)));
+		typedef int32_t vec4i __attribute__((vector_size(16)));
+
+		// tanhApprox() on four values at once, with exactly the same results
+		inline vec4 tanhApprox4 (vec4 x)
+		{
+			const vec4i signMask = {INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN};
+			const vec4i sign = (vec4i) x & signMask;
+
+			vec4 a = (vec4) ((vec4i) x & ~signMask);
+			a = a < tanhClamp ? a : tanhClamp;
+
+			const vec4 y = 2 * a;
+			const vec4 n = (y * expLog2e + roundMagic) - roundMagic;
+			const vec4 r = y - n * expLn2Hi - n * expLn2Lo;
+
+			vec4 p = r * expP0 + expP1;
+			p = p * r + expP2;
+			p = p * r + expP3;
+			p = p * r + expP4;
+			p = p * r + expP5;
+			p = p * r * r + r + 1;
+
+			const vec4 scale = (vec4) ((__builtin_convertvector(n, vec4i) + 127) << 23);
+
+			const vec4 t = 1 - 2 / (p * scale + 1);
+
+			// as in tanhApprox(), NaN was clamped for the conversion to int, and is put back here
+			return x == x ? (vec4) ((vec4i) t | sign) : x;
+		}
+
+	}
+}
+
+
+#endif
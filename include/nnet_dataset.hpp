@@ -0,0 +1,192 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_DATASET_HPP
+#define NNET_DATASET_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace nnet
+{
+
+	// a training set on disk, read through a memory mapping, so it can be far bigger than RAM
+	// every sample is inputCount input values followed by idealCount ideal output values, all float32,
+	// so sample i is at a fixed offset and any order of samples is as cheap to read as any other
+	// write one with datasetWriter, and train from it with datasetLoader
+	//
+	//   offset  size
+	//   0       4     magic "NNDS"
+	//   4       1     endianness (1 = little endian, 0 = big endian)
+	//   5       1     dtype of the values, 0 = float32
+	//   6       2     reserved, 0
+	//   8       4     version, 1
+	//   12      4     input count
+	//   16      4     ideal count
+	//   20      4     reserved, 0
+	//   24      8     sample count
+	//   padding up to 64 bytes, then the samples, in the byte order of the machine that wrote them
+	class dataset
+	{
+
+		public:
+			// returns nullptr if the file can't be read, isn't a dataset, or is shorter than its header says
+			static std::unique_ptr<dataset> open (const std::string &filename);
+			~dataset ();
+
+			size_t size () const;
+			int getInputCount () const;
+			int getIdealCount () const;
+
+			// copy one sample out, input receives getInputCount() values and ideal receives getIdealCount() values
+			// thread-safe
+			void getSample (size_t index, float* input, float* ideal) const;
+
+			// copy count samples out into rows, inputs and ideals are row-major, ready for neural::trainBatch()
+			// thread-safe
+			void gather (const size_t* indexes, size_t count, float* inputs, float* ideals) const;
+
+
+		private:
+			dataset () = default;
+
+			int m_inputCount = 0;
+			int m_idealCount = 0;
+			size_t m_size = 0;
+			// saved on a machine with the other byte order
+			bool m_reverse = false;
+
+			// the whole file when it could be mapped
+			std::shared_ptr<const char> m_data;
+
+			// otherwise, samples are read from a stream one at a time
+			std::unique_ptr<std::istream> m_stream;
+			mutable std::mutex m_streamMutex;
+
+
+			dataset (const dataset&) = delete;
+			dataset& operator= (const dataset&) = delete;
+
+	};
+
+
+	// writes a dataset file one sample at a time, so it never needs the whole set in memory
+	class datasetWriter
+	{
+
+		public:
+			// throws usageError if the file can't be created
+			datasetWriter (const std::string &filename, int inputCount, int idealCount);
+			// calls finish() if it hasn't been, ignoring any error
+			~datasetWriter ();
+
+			void add (const float* input, const float* ideal);
+
+			// fill in the sample count and close the file, returns false if anything failed to write
+			bool finish ();
+
+
+		private:
+			std::unique_ptr<std::ostream> m_file;
+			int m_inputCount;
+			int m_idealCount;
+			uint64_t m_size = 0;
+
+
+			datasetWriter (const datasetWriter&) = delete;
+			datasetWriter& operator= (const datasetWriter&) = delete;
+
+	};
+
+
+	// one minibatch, row-major like neural::trainBatch() expects
+	struct datasetBatch
+	{
+		const float* inputs = nullptr;
+		const float* ideals = nullptr;
+		size_t count = 0;
+	};
+
+	// feeds a dataset to training in minibatches, epoch after epoch
+	// a background thread reads the next batches (in a new random order each epoch, if shuffle is set)
+	// while the current one trains, so disk reads overlap with training instead of stalling it:
+	//
+	//   nnet::datasetBatch batch;
+	//   while (loader.next(batch)) network.trainBatch(batch.inputs, batch.ideals, batch.count, learningRate);
+	//
+	// the dataset must outlive the loader
+	class datasetLoader
+	{
+
+		public:
+			// prefetchCount is how many batches are read ahead, each one takes batchSize samples of memory
+			// the shuffling is seeded with seed, so a run can be reproduced
+			datasetLoader (const dataset &data, size_t batchSize, bool shuffle = true, uint64_t seed = 1, int prefetchCount = 2);
+			~datasetLoader ();
+
+			// the next batch of the current epoch, which stays valid until the next call
+			// returns false once the epoch is over, and the call after that starts the next one
+			// the last batch of an epoch has fewer samples if the dataset size isn't a multiple of batchSize
+			// rethrows anything that went wrong reading the dataset
+			bool next (datasetBatch &batch);
+
+			// the number of epochs that next() has finished
+			int getEpoch () const;
+
+			size_t getBatchesPerEpoch () const;
+
+
+		private:
+			struct slot
+			{
+				std::vector<float> inputs;
+				std::vector<float> ideals;
+				size_t count = 0;
+				// an empty slot marking the end of an epoch
+				bool endOfEpoch = false;
+			};
+
+			const dataset &m_data;
+			size_t m_batchSize;
+			bool m_shuffle;
+			rng m_rng;
+
+			// only touched by the background thread
+			std::vector<size_t> m_order;
+
+			// a ring of prefetchCount + 1 slots, the extra one being the batch that next() last returned
+			// slots from m_released up to m_produced are ready, the rest are free for the background thread
+			std::vector<slot> m_slots;
+			uint64_t m_produced = 0;
+			uint64_t m_released = 0;
+			bool m_holding = false;
+			bool m_stopping = false;
+			std::exception_ptr m_error;
+
+			int m_epoch = 0;
+
+			mutable std::mutex m_mutex;
+			std::condition_variable m_condition;
+			std::thread m_thread;
+
+			void producerLoop ();
+
+
+			datasetLoader (const datasetLoader&) = delete;
+			datasetLoader& operator= (const datasetLoader&) = delete;
+
+	};
+
+}
+
+
+#endif
@@ -0,0 +1,127 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_DISTRIBUTED_HPP
+#define NNET_DISTRIBUTED_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace nnet
+{
+
+	struct distributedSettings
+	{
+		// this process's place in the ring, from 0 to worldSize - 1
+		int rank = 0;
+		int worldSize = 1;
+
+		// the host each rank runs on, indexed by rank
+		// leave this empty when every rank runs on this machine, which keeps all traffic on the loopback interface
+		std::vector<std::string> hosts;
+
+		// rank r listens on TCP port basePort + r
+		int basePort = 29500;
+
+		// how long to wait for the neighbouring ranks to start up and connect
+		std::chrono::milliseconds connectTimeout {30000};
+
+		// compare the replicas' parameter checksums every this many trainBatch() calls, 0 to never check
+		int checksumInterval = 100;
+	};
+
+
+	// data-parallel training across processes, one replica of the network per process (rank)
+	// ranks are connected in a ring, each one sending to the next and receiving from the previous,
+	// and the nudges of a minibatch are summed with a ring all-reduce: a reduce-scatter then an all-gather,
+	// each moving every value around the ring once, so each rank sends about twice the size of the parameters
+	// per step however many ranks there are
+	// every rank applies the same summed nudges, so the replicas stay identical bit for bit,
+	// which the periodic checksums (see checksumInterval) make sure of
+	// the wire format is the host's byte order, so every rank needs the same endianness
+	class distributedTrainer
+	{
+
+		public:
+			// connect to the neighbouring ranks, then replace the network's parameters with rank 0's, so every replica starts the same
+			// every rank has to be constructed with the same topology, storage type and optimizer
+			// the storage type and sparsity pattern are fixed from then on, trainBatch() throws usageError if
+			// setStorageType() or prune() has changed them, since the ranks would no longer agree on what they are summing
+			// blocks until the whole ring is connected, throws connectionError if that takes longer than connectTimeout
+			// the network is trained in place, and must outlive the trainer
+			distributedTrainer (neural &network, const distributedSettings &settings);
+			~distributedTrainer ();
+
+			int getRank () const;
+			int getWorldSize () const;
+
+			// one training step over a minibatch spread across the ranks
+			// each rank backprops its own share (count samples, which may differ between ranks, or be 0),
+			// then the nudges of every rank are summed and applied as one minibatch
+			// every rank must call this the same number of times, and throws connectionError if another rank drops out
+			void trainBatch (const float* inputs, const float* ideals, size_t count, float learningRate);
+
+			// replace values with their sum across every rank
+			// like all of the calls below, every rank must make the same call, with the same count
+			void allReduce (float* values, size_t count);
+
+			// return once every rank has got here
+			void barrier ();
+
+			// compare the replicas' checksums, throws internalError on every rank if any of them has drifted
+			void verifySync ();
+
+			// a hash of this replica's weights and biases
+			uint64_t getChecksum () const;
+
+
+		private:
+			neural &m_network;
+			distributedSettings m_settings;
+
+			// sockets to the next and previous ranks in the ring
+			int m_next = -1;
+			int m_prev = -1;
+
+			// every layer's nudges, then the sample count, flattened for the all-reduce
+			std::vector<float> m_buffer;
+			std::vector<float> m_received;
+
+			// each layer's storage type and sparsity pattern when m_buffer was sized, which the other ranks agreed to
+			std::vector<storageType> m_storage;
+			std::vector<std::shared_ptr<const sparsePattern>> m_patterns;
+
+			uint64_t m_stepCount = 0;
+
+			void connectRing ();
+			void broadcastParams ();
+
+			// throws usageError if the network's layout no longer matches m_storage and m_patterns
+			void checkLayout () const;
+
+			// send sendSize bytes to the next rank while receiving recvSize bytes from the previous one
+			// both directions are driven together, so a ring of ranks all sending at once can't deadlock
+			void exchange (const void* send, size_t sendSize, void* recv, size_t recvSize);
+
+
+			distributedTrainer (const distributedTrainer&) = delete;
+			distributedTrainer& operator= (const distributedTrainer&) = delete;
+
+	};
+
+
+	// fork worldSize processes on this machine and run job(rank) in each, for a distributedTrainer with hosts left empty
+	// waits for them all, and returns how many failed (threw, exited early, or crashed)
+	// call this before starting any threads, since only the calling thread carries over into the processes
+	int launchLocal (int worldSize, const std::function<void (int rank)> &job);
+
+}
+
+
+#endif
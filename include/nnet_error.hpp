@@ -36,6 +36,12 @@ namespace nnet
 		incompatibleError (const std::string &what_arg) : error(what_arg) {}
 	};
 
+	// to be thrown when another process can't be reached, or drops out partway through (e.g. in distributed training)
+	struct connectionError : error
+	{
+		connectionError (const std::string &what_arg) : error(what_arg) {}
+	};
+
 }
 
 
@@ -0,0 +1,101 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_INCREMENTAL_HPP
+#define NNET_INCREMENTAL_HPP
+
+#include <cstddef>
+#include <vector>
+
+
+namespace nnet
+{
+
+	// incremental evaluation for inputs that change a few values at a time, as between neighbouring positions in a game search
+	// keeps the first layer's sums (before activation) and, when an input changes, adds the change times that input's
+	// weights instead of redoing the whole first layer, so an update is O(first layer nodes) rather than O(inputs * first layer nodes)
+	// the first layer's weights are copied here transposed, so each input's weights are contiguous
+	// push() and pop() save and restore the state, for making and unmaking moves:
+	//
+	//   eval.push();
+	//   eval.setValue(from, 0);
+	//   eval.setValue(to, 1);
+	//   eval.calculate(output);
+	//   eval.pop();
+	//
+	// every other layer runs in full on each calculate(), as in neural::calculate()
+	class incrementalEvaluator
+	{
+
+		public:
+			// starts with every input at 0
+			// the network must outlive the evaluator, and refresh() must be called after its first layer changes
+			incrementalEvaluator (const neural &network);
+
+			// copy the first layer's weights and biases again, and recompute the sums from the current input
+			void refresh ();
+
+			// set every input (getInputCount() values), and compute the sums from scratch
+			// floating point rounding builds up over many setValue() calls, which this clears
+			void setInput (const float* input);
+
+			// change one input, updating the sums in O(first layer nodes)
+			void setValue (int index, float value);
+
+			float getValue (int index) const;
+			const float* getInput () const;
+
+			// save the current state, to go back to with pop()
+			void push ();
+			// undo every setValue() since the matching push(), restoring the sums exactly
+			// throws usageError if nothing has been pushed
+			void pop ();
+			// the number of push() calls without a matching pop()
+			size_t getDepth () const;
+
+			// run the rest of the network from the sums, output receives getOutputCount() values
+			void calculate (float* output);
+			// the index of the greatest output, like neural::selectOutputFixed()
+			int selectOutputFixed ();
+
+			int getInputCount () const;
+			int getOutputCount () const;
+
+
+		private:
+			const neural &m_network;
+
+			int m_inputCount;
+			int m_nodeCount;
+
+			// the first layer's weights, one row of m_nodeCount per input
+			std::vector<float> m_columns;
+			std::vector<float> m_biases;
+
+			std::vector<float> m_input;
+
+			// the sums at each push() depth, m_nodeCount values each, with the current ones last
+			std::vector<float> m_sums;
+
+			// the previous values of inputs changed since each push(), and where each push() starts in m_undo
+			struct change
+			{
+				int index;
+				float value;
+			};
+
+			std::vector<change> m_undo;
+			std::vector<size_t> m_marks;
+
+			inferenceContext m_context;
+			std::vector<float> m_output;
+
+			float* currentSums ();
+
+	};
+
+}
+
+
+#endif
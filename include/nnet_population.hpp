@@ -0,0 +1,144 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_POPULATION_HPP
+#define NNET_POPULATION_HPP
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <functional>
+
+
+namespace nnet
+{
+
+	class threadPool;
+
+	// a population of genomes (parameter sets) for neuroevolution, all with the same topology
+	// the parameters live in one arena with room for two generations, so breeding never allocates,
+	// and genomes are copy-on-write: copies and elites share their parameters until one of them is mutated
+	// evaluation and mutation run across a thread pool, each block of genomes drawing from its own generator,
+	// so with the same seed, a run gives the same results whatever the thread count
+	class population
+	{
+
+		public:
+			// size genomes, all sharing a float32 copy of the network's parameters
+			// threadCount of 0 uses the number of hardware threads
+			population (const neural &network, size_t size, int threadCount = 0);
+			~population ();
+
+			size_t size () const;
+			std::vector<int> getNodeCounts () const;
+
+			// the number of distinct parameter sets, which is less than size() while genomes are shared
+			size_t getUniqueCount () const;
+
+			// restart the population's random numbers, the constructor seeds them from threadRng()
+			void seed (uint64_t seed);
+
+
+			// give every genome its own random parameters, see neural::randomize()
+			void randomize ();
+
+			// genome dst becomes a copy of src, they share parameters until one of them is changed
+			void copyGenome (size_t dst, size_t src);
+
+			// tweak every parameter of a genome by a random value, see neural::tweak()
+			void mutate (size_t genome, float magnitude);
+
+			// genome dst takes each node (its weights and bias) from either a or b, with equal probability
+			// dst may be a or b
+			void crossover (size_t dst, size_t a, size_t b);
+
+
+			// forward calculation of one genome, thread-safe as long as each thread uses its own context
+			void calculate (size_t genome, inferenceContext &ctx, const float* input, float* output) const;
+
+			// every genome in parallel, inputs holds one row per genome and outputs receives one row per genome
+			void calculateAll (const float* inputs, float* outputs);
+
+			// call fitness(genome, ctx) for every genome in parallel, and keep the results
+			// fitness is called from several threads at once, each with its own context to pass to calculate()
+			void evaluate (const std::function<float (size_t genome, inferenceContext &ctx)> &fitness);
+
+			float getFitness (size_t genome) const;
+			void setFitness (size_t genome, float fitness);
+
+			// genome indexes, from the highest fitness to the lowest
+			std::vector<size_t> rank () const;
+
+			// replace every genome with the next generation, bred from the current fitness values
+			// the eliteCount fittest genomes survive unchanged, without copying their parameters
+			// every other genome is bred from two tournament winners (the fittest of tournamentSize random genomes),
+			// by crossover with probability crossoverRate or else as a copy of the first, and then mutated
+			// fitness values are reset to 0
+			void nextGeneration (size_t eliteCount, int tournamentSize, float crossoverRate, float mutationMagnitude);
+
+
+			// copy a genome out to a runtime network, allocated with the "new" keyword
+			neural* toNeural (size_t genome) const;
+
+			// replace a genome with the parameters of a network with the same topology
+			void setGenome (size_t genome, const neural &network);
+
+
+		private:
+			std::vector<int> m_nodeCounts;
+
+			// offsets of each layer's weights and biases within a genome, entry 0 (the input layer) is unused
+			std::vector<size_t> m_weightOffsets;
+			std::vector<size_t> m_biasOffsets;
+
+			// floats per genome, and the same padded to a whole number of cache lines
+			size_t m_paramCount;
+			size_t m_stride;
+
+			// every parameter set, with a reference count each
+			std::shared_ptr<float> m_arena;
+			std::vector<int> m_refCounts;
+			std::vector<size_t> m_freeSlots;
+
+			// the slot holding each genome's parameters
+			std::vector<size_t> m_genomes;
+			std::vector<float> m_fitness;
+
+			std::unique_ptr<threadPool> m_pool;
+			std::vector<inferenceContext> m_contexts;
+
+			// selection and crossover draw from m_rng, mutation from one generator per block of genomes
+			rng m_rng;
+			std::vector<rng> m_blockRngs;
+
+
+			float* slotData (size_t slot);
+			const float* slotData (size_t slot) const;
+
+			size_t acquireSlot ();
+			void releaseSlot (size_t slot);
+
+			// give a genome a slot that nothing else uses, copying its parameters if it was shared
+			float* unshare (size_t genome);
+
+			// run job(genome, ctx) for every genome, spread across the thread pool
+			void forEachGenome (const std::function<void (size_t genome, inferenceContext &ctx)> &job);
+
+			// give each listed genome its own slot, then run job(params, generator) for each of them in parallel
+			// the list is split into fixed blocks with a generator each, so the results don't depend on the thread count
+			void forEachUnshared (const std::vector<size_t> &genomes, const std::function<void (float* params, rng &generator)> &job);
+
+			size_t tournament (int tournamentSize);
+			void checkIndex (size_t genome) const;
+
+
+			population (const population&) = delete;
+			population& operator= (const population&) = delete;
+
+	};
+
+}
+
+
+#endif
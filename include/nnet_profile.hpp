@@ -0,0 +1,81 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_PROFILE_HPP
+#define NNET_PROFILE_HPP
+
+#include <atomic>
+#include <cstdint>
+
+
+namespace nnet
+{
+
+	// per-layer performance counters, for finding the layer or phase that a run spends its time in
+	// they are only collected when the library is built with NNET_PROFILE defined, otherwise every count stays at 0
+	// the counters exist either way, so the layout of every class is the same with or without the flag
+
+	// true if this build of the library collects the counters
+	bool isProfilingEnabled ();
+
+	enum class profilePhase : uint8_t
+	{
+		forward, // calculate(), calculateBatch(), and the forward half of backpropBatch()
+		backward, // backprop() and the backward half of backpropBatch(), accumulating nudges
+		apply // backpropApply() and parallelTrainer's reduce and apply
+	};
+
+	const int profilePhaseCount = 3;
+
+
+	// totals for one layer and phase
+	// flops and bytes are estimates from the layer's shape: 2 flops per weight per sample for the forward pass,
+	// and bytes counting the parameters, nudges, inputs and outputs that must be read or written at least once
+	// nanoseconds are summed over threads, so a phase that runs in parallel can add up to more than the wall time
+	struct phaseProfile
+	{
+		uint64_t calls = 0;
+		uint64_t samples = 0;
+		uint64_t nanoseconds = 0;
+		uint64_t flops = 0;
+		uint64_t bytes = 0;
+	};
+
+	struct layerProfile
+	{
+		phaseProfile phases[profilePhaseCount];
+
+		const phaseProfile& operator[] (profilePhase phase) const
+		{
+			return phases[(int) phase];
+		}
+	};
+
+
+	// the live counters inside each layer
+	// these are atomic, so that threads sharing a network through inferenceContext can all record into it
+	// a copy starts from zero, since it's a different layer
+	struct profileCounters
+	{
+		profileCounters ();
+		profileCounters (const profileCounters&);
+		profileCounters& operator= (const profileCounters&);
+
+		void add (profilePhase phase, uint64_t calls, uint64_t samples, uint64_t nanoseconds, uint64_t flops, uint64_t bytes);
+
+		// add other's counts to these, and reset other
+		void takeFrom (profileCounters &other);
+
+		layerProfile get () const;
+		void reset ();
+
+		private:
+			static const int fieldCount = 5;
+			std::atomic<uint64_t> m_values[profilePhaseCount][fieldCount];
+	};
+
+}
+
+
+#endif
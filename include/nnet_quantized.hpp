@@ -0,0 +1,78 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_QUANTIZED_HPP
+#define NNET_QUANTIZED_HPP
+
+#include <cstdint>
+#include <vector>
+
+
+namespace nnet
+{
+
+	// how closely a quantizedNetwork follows the network it was built from, over a set of samples
+	struct quantizationReport
+	{
+		size_t sampleCount = 0;
+
+		// absolute differences between the float and int8 output values
+		float maxAbsError = 0;
+		float meanAbsError = 0;
+
+		// fraction of samples where both pick the same output with selectOutputFixed()
+		float argmaxAgreement = 0;
+	};
+
+
+
+	// int8 copy of a trained network, for inference only
+	// weights are stored as int8 with one scale per node (row), and each layer runs int8 x int8 -> int32 dot products,
+	// then rescales to float, adds the bias and applies tanh
+	// the hidden layer values are tanh outputs, so they always quantize with a fixed scale of 1/127
+	// only the network inputs need a calibrated scale, which is taken from the largest input magnitude in a sample set
+	class quantizedNetwork
+	{
+
+		public:
+			// calibrationInputs holds count rows of typical input values
+			quantizedNetwork (const neural &network, const float* calibrationInputs, size_t count);
+
+			// forward calculation, thread-safe as long as each thread uses its own context
+			// input has one value per input node, and output receives one value per output node
+			void calculate (inferenceContext &ctx, const float* input, float* output) const;
+
+			// run inputs (count rows) through both this and the original network, and compare the outputs
+			quantizationReport compare (const neural &network, const float* inputs, size_t count) const;
+
+			int getInputCount () const;
+			int getOutputCount () const;
+
+
+		private:
+			struct quantizedLayer
+			{
+				int nodeCount;
+				int prevNodeCount;
+
+				// row-major, like layer::weights
+				std::vector<int8_t> weights;
+				// weight scale of each row, already multiplied by the scale of the layer's input
+				std::vector<float> scales;
+				std::vector<float> biases;
+			};
+
+			std::vector<quantizedLayer> m_layers;
+
+			int m_inputCount;
+
+			// network inputs are divided by this before rounding to int8
+			float m_inputScale;
+
+	};
+
+}
+
+
+#endif
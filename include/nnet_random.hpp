@@ -0,0 +1,75 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_RANDOM_HPP
+#define NNET_RANDOM_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+
+namespace nnet
+{
+
+	// a small, fast random number generator with no shared state, so every thread or network can have its own
+	// single values come from xoshiro256**, and the bulk functions from eight xoshiro128+ streams run side by side,
+	// which the compiler turns into vector code
+	// the same seed always gives the same sequence, on every platform
+	class rng
+	{
+
+		public:
+			explicit rng (uint64_t seed = 1);
+
+			// restart the sequence from a seed, every generator seeded the same way produces the same values
+			void seed (uint64_t seed);
+
+			// 64 random bits
+			uint64_t next ();
+
+			// uniform in [0, 1)
+			float nextFloat ();
+
+			// uniform in [0, bound), bound must be above 0
+			uint32_t nextBelow (uint32_t bound);
+
+			// fill out with count values, uniform in [low, high)
+			void fillUniform (float* out, size_t count, float low, float high);
+
+			// add a value uniform in [-magnitude, magnitude) to each of count values, like neural::tweak()
+			void addUniform (float* out, size_t count, float magnitude);
+
+			// a new generator with its own stream, seeded from this one's
+			// use this to give each thread of a parallel job its own generator, reproducibly
+			rng split ();
+
+
+		private:
+			uint64_t m_state[4];
+
+			// the bulk streams, one row per word of state and one column per stream
+			static const int laneCount = 8;
+			uint32_t m_lanes[4][laneCount];
+
+			// values generated by the last bulk step that haven't been used yet
+			float m_block[laneCount];
+			int m_blockUsed = laneCount;
+
+			void refillBlock ();
+
+	};
+
+
+	// the calling thread's own generator, used by randFloat(), neural::randomize(), neural::tweak(), etc.
+	// each thread's generator is seeded from the global seed and the order in which the threads first use it
+	rng& threadRng ();
+
+	// set the global seed, and reseed the calling thread's generator with it
+	// threads that have already used their generator keep their current sequence
+	void seedRandom (uint64_t seed);
+
+}
+
+
+#endif
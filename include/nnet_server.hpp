@@ -0,0 +1,208 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_SERVER_HPP
+#define NNET_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+
+
+namespace nnet
+{
+
+	struct serverSettings
+	{
+		// the most requests run in one batched forward pass
+		size_t maxBatchSize = 64;
+
+		// how long the oldest waiting request may wait for others to fill its batch
+		// a full batch runs straight away, so this only adds latency when the server is lightly loaded
+		std::chrono::microseconds maxDelay {1000};
+
+		// threads running batches, each with its own inferenceContext
+		int workerCount = 1;
+
+		// called on a worker thread with each error there's no request to hand back to, i.e. an exception thrown by a completion callback, or a failed socket request
+		// leave it empty to ignore them, and don't let it throw, since that ends the process
+		std::function<void (std::exception_ptr error)> errorHandler;
+	};
+
+
+	// a dynamic-batching inference server around one network
+	// requests from any number of threads (or from Unix socket clients, see listen()) are queued,
+	// coalesced into batches of up to maxBatchSize, and run with a single calculateBatch() each,
+	// which is far faster per request than one calculate() at a time
+	// the network is only read, so it must outlive the server and must not be trained while the server runs
+	class server
+	{
+
+		public:
+			server (const neural &network, const serverSettings &settings = serverSettings());
+			// stops listening, and finishes every request already queued
+			~server ();
+
+			int getInputCount () const;
+			int getOutputCount () const;
+
+
+			// queue one request, and call done() exactly once from a worker thread when it's finished
+			// error is null once output has been filled in, or holds the exception if the batch failed, in which case output is left as it was
+			// input (getInputCount() values) and output (getOutputCount() values) must stay valid until then
+			// done() should return quickly, since the worker can't start on another batch until it does
+			// if done() throws, the exception goes to serverSettings::errorHandler and the other requests carry on
+			void submit (const float* input, float* output, std::function<void (std::exception_ptr error)> done);
+
+			// the same, blocking until the output is ready, and rethrowing the error if the batch failed
+			void calculate (const float* input, float* output);
+
+			// the index of the greatest output, like neural::selectOutputFixed()
+			int selectOutputFixed (const float* input);
+
+
+			// asynchronous versions for callers that mustn't block, e.g. on an event loop
+			// these own their input and output, so there's nothing for the caller to keep alive
+			// throw usageError if input has fewer than getInputCount() values
+
+			// the future becomes ready with the getOutputCount() output values, or with the error if the batch failed
+			std::future<std::vector<float>> calculateAsync (std::vector<float> input);
+
+			// done(output, error) is called exactly once from a worker thread, like in submit()
+			// output holds the getOutputCount() values if error is null, and is empty if the batch failed
+			void calculateAsync (std::vector<float> input, std::function<void (std::vector<float> output, std::exception_ptr error)> done);
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+			// "co_await s.calculateAwaitable(input, output)" suspends the coroutine until output is ready
+			// input and output follow the same rules as in submit(), and the coroutine resumes on a worker thread,
+			// so it should hand itself back to its own executor before doing any real work
+			// if the batch failed, the co_await rethrows the error
+			struct calculateAwaiter
+			{
+				server &s;
+				const float* input;
+				float* output;
+				std::exception_ptr error;
+
+				bool await_ready () const noexcept
+				{
+					return false;
+				}
+
+				void await_suspend (std::coroutine_handle<> handle)
+				{
+					// the awaiter lives in the coroutine frame, so it's still there when the request completes
+					s.submit(input, output, [this, handle] (std::exception_ptr e)
+					{
+						error = e;
+						handle.resume();
+					});
+				}
+
+				void await_resume () const
+				{
+					if (error) std::rethrow_exception(error);
+				}
+			};
+
+			calculateAwaiter calculateAwaitable (const float* input, float* output)
+			{
+				return {*this, input, output, nullptr};
+			}
+#endif
+
+
+			// also accept requests on a Unix domain socket at path, which must not exist yet
+			// the protocol is binary, in the host's byte order:
+			// on connecting, the server sends two uint32 values, the input count and the output count,
+			// then each request is input count float32 values, answered with output count float32 values
+			// each connection has one request in flight at a time, so clients wanting more open more connections
+			// throws usageError if the socket can't be created, or if the server is already listening
+			void listen (const std::string &path);
+
+			// close the socket and every connection, and remove the socket file
+			void stopListening ();
+
+
+			// the number of requests and batches run so far, their ratio is the average batch size
+			uint64_t getRequestCount () const;
+			uint64_t getBatchCount () const;
+
+
+		private:
+			struct request
+			{
+				const float* input;
+				float* output;
+				// error is null unless the batch failed, in which case output wasn't filled in
+				std::function<void (std::exception_ptr error)> done;
+				std::chrono::steady_clock::time_point arrival;
+			};
+
+			const neural &m_network;
+			serverSettings m_settings;
+
+			int m_inputCount;
+			int m_outputCount;
+
+			mutable std::mutex m_mutex;
+			std::condition_variable m_queueCondition;
+			std::deque<request> m_queue;
+			bool m_stopping = false;
+
+			uint64_t m_requestCount = 0;
+			uint64_t m_batchCount = 0;
+
+			std::vector<std::thread> m_workers;
+
+			// the socket side, guarded by m_socketMutex
+			struct connection
+			{
+				int socket;
+				bool finished = false;
+				std::thread thread;
+			};
+
+			std::mutex m_socketMutex;
+			int m_listenSocket = -1;
+			std::string m_socketPath;
+			std::atomic<bool> m_listening {false};
+			std::thread m_acceptThread;
+			// a list, so that each connectionLoop() can keep a reference to its entry
+			std::list<connection> m_connections;
+
+
+			// pass an error to serverSettings::errorHandler, if there is one
+			void reportError (std::exception_ptr error) noexcept;
+
+			void workerLoop ();
+			void acceptLoop ();
+			void connectionLoop (connection &c);
+			// join and close the connections that have ended, call with m_socketMutex held
+			void reapConnections ();
+
+
+			server (const server&) = delete;
+			server& operator= (const server&) = delete;
+
+	};
+
+}
+
+
+#endif
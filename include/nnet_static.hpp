@@ -0,0 +1,265 @@
+// don't manually include this file!
+// it is automatically included with nnet.hpp
+
+
+#ifndef NNET_STATIC_HPP
+#define NNET_STATIC_HPP
+
+#include <array>
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+
+
+namespace nnet
+{
+
+	namespace staticDetail
+	{
+		// node counts are padded up to whole vectors, the padding weights and biases are always zero
+		constexpr int paddedCount (int nodeCount)
+		{
+			return (nodeCount + 3) / 4 * 4;
+		}
+
+		// parameters before layer i (each layer's weights, then its biases), or all of them for i = L
+		template <size_t L>
+		constexpr size_t paramOffset (const std::array<int, L> &nodeCounts, size_t i)
+		{
+			size_t offset = 0;
+
+			for (size_t l = 1; l < i; ++l)
+			{
+				offset += (size_t) paddedCount(nodeCounts[l]) * (nodeCounts[l - 1] + 1);
+			}
+
+			return offset;
+		}
+	}
+
+
+	// a network whose topology is fixed at compile time, for small networks evaluated in a hot loop
+	// staticNeural<8, 16, 16, 4> has 8 inputs, two hidden layers of 16 nodes, and 4 outputs
+	// every parameter lives inside the object, so calculate() never touches the heap,
+	// and every loop bound is a constant, so the compiler can unroll and vectorize all of it
+	// it is inference only: train a runtime neural, then convert it with the constructor below
+	template <int... NodeCounts>
+	class staticNeural
+	{
+
+		static_assert(sizeof...(NodeCounts) >= 2, "a staticNeural needs at least an input and an output layer");
+		static_assert(((NodeCounts > 0) && ...), "every layer needs at least one node");
+
+		public:
+			static constexpr size_t layerCount = sizeof...(NodeCounts);
+			static constexpr std::array<int, layerCount> nodeCounts = {NodeCounts...};
+
+			static constexpr int inputCount = nodeCounts.front();
+			static constexpr int outputCount = nodeCounts.back();
+
+
+			// all parameters zero
+			staticNeural () = default;
+
+			// copy the parameters of a runtime network with the same topology
+			// throws usageError if the topologies don't match
+			explicit staticNeural (const neural &network)
+			{
+
+				if (network.layers.size() != layerCount)
+				{
+					throw nnet::usageError("network layer count does not match this staticNeural");
+				}
+
+				for (size_t i = 0; i < layerCount; ++i)
+				{
+					if (network.layers.at(i)->nodeCount != nodeCounts[i])
+					{
+						throw nnet::usageError("network layer sizes do not match this staticNeural");
+					}
+				}
+
+				std::array<float, maxPaddedCount> row;
+
+				for (size_t i = 1; i < layerCount; ++i)
+				{
+					const layer &l = *network.layers.at(i);
+					const int stride = staticDetail::paddedCount(l.nodeCount);
+
+					float* w = m_params.data() + weightOffset(i);
+					float* b = m_params.data() + biasOffset(i);
+
+					// rows of the runtime layer become columns here
+					for (int j = 0; j < l.nodeCount; ++j)
+					{
+						l.loadWeights((size_t) j * l.prevNodeCount, l.prevNodeCount, row.data());
+
+						for (int k = 0; k < l.prevNodeCount; ++k)
+						{
+							w[(size_t) k * stride + j] = row[k];
+						}
+					}
+
+					std::copy(l.biases.get(), l.biases.get() + l.nodeCount, b);
+				}
+
+			}
+
+
+			// make a runtime network with the same parameters, allocated with the "new" keyword
+			neural* toNeural () const
+			{
+
+				neural* n1 = new neural(std::vector<int>(nodeCounts.begin(), nodeCounts.end()));
+
+				std::array<float, maxPaddedCount> row;
+
+				for (size_t i = 1; i < layerCount; ++i)
+				{
+					layer &l = *n1->layers.at(i);
+					const int stride = staticDetail::paddedCount(l.nodeCount);
+
+					const float* w = m_params.data() + weightOffset(i);
+					const float* b = m_params.data() + biasOffset(i);
+
+					for (int j = 0; j < l.nodeCount; ++j)
+					{
+						for (int k = 0; k < l.prevNodeCount; ++k)
+						{
+							row[k] = w[(size_t) k * stride + j];
+						}
+
+						l.storeWeights((size_t) j * l.prevNodeCount, l.prevNodeCount, row.data());
+					}
+
+					std::copy(b, b + l.nodeCount, l.biases.get());
+				}
+
+				return n1;
+
+			}
+
+
+			// these go through a runtime network, so they use the same file format as neural
+			bool saveToFile (std::string filename) const
+			{
+				std::unique_ptr<neural> n1 {toNeural()};
+				return n1->saveToFile(filename);
+			}
+
+			// returns nullptr if the file can't be read, throws usageError if its topology doesn't match
+			static std::unique_ptr<staticNeural> loadFromFile (std::string filename)
+			{
+
+				std::unique_ptr<neural> n1 {neural::loadFromFile(filename)};
+
+				if (!n1) return nullptr;
+
+				return std::unique_ptr<staticNeural>(new staticNeural(*n1));
+
+			}
+
+
+			// forward calculation
+			// input has inputCount values, and output receives outputCount values
+			// this is const and keeps its intermediate values on the stack, so it's safe to call from any number of threads
+			void calculate (const float* input, float* output) const
+			{
+
+				alignas(16) std::array<float, maxPaddedCount> buffers[2];
+
+				calculate_m(input, buffers, std::make_index_sequence<layerCount - 1>());
+
+				// the last layer wrote to buffer (L - 1) % 2
+				std::copy(buffers[(layerCount - 1) % 2].data(), buffers[(layerCount - 1) % 2].data() + outputCount, output);
+
+			}
+
+			std::array<float, outputCount> calculate (const std::array<float, inputCount> &input) const
+			{
+				std::array<float, outputCount> output;
+				calculate(input.data(), output.data());
+				return output;
+			}
+
+
+		private:
+			static constexpr int maxPaddedCount = staticDetail::paddedCount(std::max({NodeCounts...}));
+
+			// each layer's weights, then its biases
+			// the weights are stored column-major (one column per node, one row per node of the previous layer),
+			// so the inner loop runs across nodes, four at a time, without needing to reorder any sums
+			// every row is padded to a whole number of vectors
+			static constexpr size_t weightOffset (size_t i)
+			{
+				return staticDetail::paramOffset(nodeCounts, i);
+			}
+
+			static constexpr size_t biasOffset (size_t i)
+			{
+				return weightOffset(i) + (size_t) staticDetail::paddedCount(nodeCounts[i]) * nodeCounts[i - 1];
+			}
+
+			alignas(64) std::array<float, staticDetail::paramOffset(nodeCounts, layerCount)> m_params {};
+
+
+			// layer I + 1 reads from the input or the buffer the last layer wrote, and writes to the other buffer
+			template <size_t... I>
+			void calculate_m (const float* input, std::array<float, maxPaddedCount> (&buffers)[2], std::index_sequence<I...>) const
+			{
+				(calculateLayer<I + 1>(I == 0 ? input : buffers[I % 2].data(), buffers[(I + 1) % 2].data()), ...);
+			}
+
+			template <size_t I>
+			void calculateLayer (const float* in, float* out) const
+			{
+
+				using activation::vec4;
+
+				constexpr int vectors = staticDetail::paddedCount(nodeCounts[I]) / 4;
+				constexpr int p = nodeCounts[I - 1];
+
+				const float* w = m_params.data() + weightOffset(I);
+				const float* b = m_params.data() + biasOffset(I);
+
+				// the loops over vectors are unrolled, so that the sums stay in registers
+				vec4 sums[vectors];
+
+#pragma GCC unroll 16
+				for (int j = 0; j < vectors; ++j)
+				{
+					std::memcpy(&sums[j], b + 4 * j, sizeof(vec4));
+				}
+
+				for (int k = 0; k < p; ++k)
+				{
+					const float x = in[k];
+					const float* column = w + (size_t) k * vectors * 4;
+
+#pragma GCC unroll 16
+					for (int j = 0; j < vectors; ++j)
+					{
+						vec4 c;
+						std::memcpy(&c, column + 4 * j, sizeof(vec4));
+
+						sums[j] += c * x;
+					}
+				}
+
+#pragma GCC unroll 16
+				for (int j = 0; j < vectors; ++j)
+				{
+					const vec4 v = activation::tanhApprox4(sums[j]);
+					std::memcpy(out + 4 * j, &v, sizeof(vec4));
+				}
+
+			}
+
+	};
+
+}
+
+
+#endif
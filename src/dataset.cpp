@@ -0,0 +1,444 @@
+#include "../include/nnet.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+static const char datasetMagic[4] = {'N', 'N', 'D', 'S'};
+static const uint32_t datasetVersion = 1;
+static const size_t datasetHeaderSize = 64;
+
+
+// reverse the bytes of each of count floats, for files saved with the other byte order
+static void swapValues (float* values, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t x;
+		std::memcpy(&x, values + i, 4);
+		x = __builtin_bswap32(x);
+		std::memcpy(values + i, &x, 4);
+	}
+}
+
+template <typename T>
+static T readHeaderValue (const char* ptr, bool reverse)
+{
+
+	T x;
+	std::memcpy(&x, ptr, sizeof(T));
+
+	if (reverse)
+	{
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &x, sizeof(T));
+		std::reverse(bytes, bytes + sizeof(T));
+		std::memcpy(&x, bytes, sizeof(T));
+	}
+
+	return x;
+
+}
+
+
+
+////// dataset
+
+std::unique_ptr<nnet::dataset> nnet::dataset::open (const std::string &filename)
+{
+
+	std::unique_ptr<dataset> data {new dataset()};
+
+	char header[datasetHeaderSize];
+	size_t fileSize = 0;
+
+#if defined(__unix__) || defined(__APPLE__)
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0) return nullptr;
+
+	struct stat info;
+
+	if (fstat(fd, &info) == 0 && (size_t) info.st_size >= datasetHeaderSize)
+	{
+		const size_t size = info.st_size;
+
+		// read-only and shared, so pages come straight from the page cache, and go back to it under memory pressure
+		void* ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (ptr != MAP_FAILED)
+		{
+			data->m_data = std::shared_ptr<const char>((const char*) ptr, [size] (const char* p) { munmap((void*) p, size); });
+			fileSize = size;
+
+			std::memcpy(header, ptr, datasetHeaderSize);
+		}
+	}
+
+	close(fd);
+
+#endif
+
+	// if mapping fails, read samples from a stream instead
+	if (!data->m_data)
+	{
+		std::unique_ptr<std::ifstream> f1 {new std::ifstream(filename, std::ios::binary | std::ios::ate)};
+
+		if (!*f1) return nullptr;
+
+		fileSize = f1->tellg();
+		f1->seekg(0);
+
+		if (fileSize < datasetHeaderSize || !f1->read(header, datasetHeaderSize)) return nullptr;
+
+		data->m_stream = std::move(f1);
+	}
+
+
+	if (std::memcmp(header, datasetMagic, 4) != 0) return nullptr;
+
+	data->m_reverse = (header[4] == 1) != isLittleEndian();
+
+	const bool reverse = data->m_reverse;
+
+	if (header[5] != 0 || readHeaderValue<uint32_t>(header + 8, reverse) != datasetVersion) return nullptr;
+
+	const uint32_t inputCount = readHeaderValue<uint32_t>(header + 12, reverse);
+	const uint32_t idealCount = readHeaderValue<uint32_t>(header + 16, reverse);
+	const uint64_t size = readHeaderValue<uint64_t>(header + 24, reverse);
+
+	if (inputCount == 0 || idealCount == 0 || inputCount > INT32_MAX || idealCount > INT32_MAX) return nullptr;
+
+	// a truncated file is rejected here rather than crashing on a read past the end of the mapping
+	const uint64_t sampleBytes = ((uint64_t) inputCount + idealCount) * sizeof(float);
+
+	if (size > (fileSize - datasetHeaderSize) / sampleBytes) return nullptr;
+
+	data->m_inputCount = inputCount;
+	data->m_idealCount = idealCount;
+	data->m_size = size;
+
+	return data;
+
+}
+
+nnet::dataset::~dataset () = default;
+
+
+size_t nnet::dataset::size () const
+{
+	return m_size;
+}
+
+int nnet::dataset::getInputCount () const
+{
+	return m_inputCount;
+}
+
+int nnet::dataset::getIdealCount () const
+{
+	return m_idealCount;
+}
+
+
+void nnet::dataset::getSample (size_t index, float* input, float* ideal) const
+{
+
+	if (index >= m_size)
+	{
+		throw nnet::usageError("sample index out of range");
+	}
+
+	const size_t sampleBytes = ((size_t) m_inputCount + m_idealCount) * sizeof(float);
+	const size_t offset = datasetHeaderSize + index * sampleBytes;
+
+	if (m_data)
+	{
+		const char* sample = m_data.get() + offset;
+
+		std::memcpy(input, sample, m_inputCount * sizeof(float));
+		std::memcpy(ideal, sample + m_inputCount * sizeof(float), m_idealCount * sizeof(float));
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(m_streamMutex);
+
+		m_stream->seekg(offset);
+		m_stream->read((char*) input, m_inputCount * sizeof(float));
+		m_stream->read((char*) ideal, m_idealCount * sizeof(float));
+
+		if (!*m_stream)
+		{
+			throw nnet::internalError("could not read a dataset sample, thrown from nnet::dataset::getSample()");
+		}
+	}
+
+	if (m_reverse)
+	{
+		swapValues(input, m_inputCount);
+		swapValues(ideal, m_idealCount);
+	}
+
+}
+
+
+void nnet::dataset::gather (const size_t* indexes, size_t count, float* inputs, float* ideals) const
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		getSample(indexes[i], inputs + i * m_inputCount, ideals + i * m_idealCount);
+	}
+}
+
+
+
+////// datasetWriter
+
+nnet::datasetWriter::datasetWriter (const std::string &filename, int inputCount, int idealCount)
+: m_file {new std::ofstream(filename, std::ios::binary)},
+	m_inputCount {inputCount},
+	m_idealCount {idealCount}
+{
+
+	if (inputCount < 1 || idealCount < 1)
+	{
+		throw nnet::usageError("a dataset needs at least one input and one ideal value per sample");
+	}
+
+	if (!*m_file)
+	{
+		throw nnet::usageError("could not create dataset file \"" + filename + "\"");
+	}
+
+	// the sample count is filled in by finish()
+	char header[datasetHeaderSize] = {};
+
+	std::memcpy(header, datasetMagic, 4);
+	header[4] = isLittleEndian() ? 1 : 0;
+
+	const uint32_t counts[3] = {datasetVersion, (uint32_t) inputCount, (uint32_t) idealCount};
+	std::memcpy(header + 8, counts, sizeof(counts));
+
+	m_file->write(header, datasetHeaderSize);
+
+}
+
+nnet::datasetWriter::~datasetWriter ()
+{
+	if (m_file) finish();
+}
+
+
+void nnet::datasetWriter::add (const float* input, const float* ideal)
+{
+
+	if (!m_file)
+	{
+		throw nnet::usageError("this datasetWriter has already been finished");
+	}
+
+	m_file->write((const char*) input, m_inputCount * sizeof(float));
+	m_file->write((const char*) ideal, m_idealCount * sizeof(float));
+
+	++m_size;
+
+}
+
+
+bool nnet::datasetWriter::finish ()
+{
+
+	if (!m_file) return false;
+
+	m_file->seekp(24);
+	m_file->write((const char*) &m_size, sizeof(m_size));
+	m_file->flush();
+
+	const bool ok = (bool) *m_file;
+
+	m_file.reset();
+
+	return ok;
+
+}
+
+
+
+////// datasetLoader
+
+nnet::datasetLoader::datasetLoader (const dataset &data, size_t batchSize, bool shuffle, uint64_t seed, int prefetchCount)
+: m_data {data},
+	m_batchSize {batchSize},
+	m_shuffle {shuffle},
+	m_rng {seed}
+{
+
+	if (batchSize == 0)
+	{
+		throw nnet::usageError("a batch needs at least one sample");
+	}
+
+	if (prefetchCount < 1)
+	{
+		throw nnet::usageError("a datasetLoader needs to read at least one batch ahead");
+	}
+
+	m_order.resize(data.size());
+
+	for (size_t i = 0; i < m_order.size(); ++i)
+	{
+		m_order[i] = i;
+	}
+
+	m_slots.resize(prefetchCount + 1);
+
+	for (slot &s: m_slots)
+	{
+		s.inputs.resize(batchSize * data.getInputCount());
+		s.ideals.resize(batchSize * data.getIdealCount());
+	}
+
+	m_thread = std::thread(&datasetLoader::producerLoop, this);
+
+}
+
+nnet::datasetLoader::~datasetLoader ()
+{
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+
+	m_condition.notify_all();
+	m_thread.join();
+
+}
+
+
+int nnet::datasetLoader::getEpoch () const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_epoch;
+}
+
+size_t nnet::datasetLoader::getBatchesPerEpoch () const
+{
+	return (m_data.size() + m_batchSize - 1) / m_batchSize;
+}
+
+
+bool nnet::datasetLoader::next (datasetBatch &batch)
+{
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// the batch handed out last time is done with, so its slot can be refilled
+	if (m_holding)
+	{
+		++m_released;
+		m_holding = false;
+
+		m_condition.notify_all();
+	}
+
+	m_condition.wait(lock, [this] { return m_produced > m_released || m_error; });
+
+	if (m_produced == m_released)
+	{
+		std::rethrow_exception(m_error);
+	}
+
+	const slot &s = m_slots[m_released % m_slots.size()];
+
+	if (s.endOfEpoch)
+	{
+		++m_released;
+		++m_epoch;
+
+		m_condition.notify_all();
+
+		return false;
+	}
+
+	batch.inputs = s.inputs.data();
+	batch.ideals = s.ideals.data();
+	batch.count = s.count;
+
+	m_holding = true;
+
+	return true;
+
+}
+
+
+void nnet::datasetLoader::producerLoop ()
+{
+
+	try
+	{
+		while (true)
+		{
+			if (m_shuffle)
+			{
+				// Fisher-Yates
+				for (size_t i = m_order.size(); i > 1; --i)
+				{
+					const size_t j = i <= UINT32_MAX ? m_rng.nextBelow(i) : m_rng.next() % i;
+					std::swap(m_order[i - 1], m_order[j]);
+				}
+			}
+
+			const size_t batchCount = getBatchesPerEpoch();
+
+			// every batch, then the end of epoch marker
+			for (size_t b = 0; b <= batchCount; ++b)
+			{
+				const size_t begin = b * m_batchSize;
+				const size_t count = b < batchCount ? std::min(m_batchSize, m_order.size() - begin) : 0;
+
+				slot* s;
+
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+
+					m_condition.wait(lock, [this] { return m_stopping || m_produced - m_released < m_slots.size(); });
+
+					if (m_stopping) return;
+
+					s = &m_slots[m_produced % m_slots.size()];
+				}
+
+				// the slot is free, so it can be filled without the lock, this is where the disk reads happen
+				s->count = count;
+				s->endOfEpoch = count == 0;
+
+				m_data.gather(m_order.data() + begin, count, s->inputs.data(), s->ideals.data());
+
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					++m_produced;
+				}
+
+				m_condition.notify_all();
+			}
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_error = std::current_exception();
+
+		m_condition.notify_all();
+	}
+
+}
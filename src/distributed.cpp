@@ -0,0 +1,800 @@
+#include "../include/nnet.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+
+	// FNV-1a
+	const uint64_t hashSeed = 0xcbf29ce484222325;
+
+	uint64_t hashBytes (uint64_t h, const void* data, size_t size)
+	{
+
+		const unsigned char* p = (const unsigned char*) data;
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			h ^= p[i];
+			h *= 0x100000001b3;
+		}
+
+		return h;
+
+	}
+
+	// everything the ranks have to agree on before their nudges can be summed
+	uint64_t topologyHash (const nnet::neural &network)
+	{
+
+		uint64_t h = hashSeed;
+
+		for (const std::shared_ptr<nnet::layer> &l: network.layers)
+		{
+			const int counts[2] = {l->nodeCount, l->prevNodeCount};
+
+			h = hashBytes(h, counts, sizeof(counts));
+			h = hashBytes(h, &l->storage, sizeof(l->storage));
+
+			// sparse layers also have to keep the same weights, since the nudges are summed one per stored weight
+			const uint64_t stored = l->prevNodeCount > 0 ? l->storedWeightCount() : 0;
+			h = hashBytes(h, &stored, sizeof(stored));
+
+			if (l->storage == nnet::storageType::sparse)
+			{
+				h = hashBytes(h, l->pattern->rowStarts.data(), l->pattern->rowStarts.size() * sizeof(size_t));
+				h = hashBytes(h, l->pattern->columns.data(), l->pattern->columns.size() * sizeof(int));
+			}
+
+			h = hashBytes(h, &l->optimizer.type, sizeof(l->optimizer.type));
+		}
+
+		return h;
+
+	}
+
+	// the number of weights and biases, with every weight counted whether or not it's stored
+	size_t paramCount (const nnet::neural &network)
+	{
+
+		size_t count = 0;
+
+		for (int i = 1; i < network.layers.size(); ++i)
+		{
+			const nnet::layer &l = *network.layers.at(i);
+			count += (size_t) l.nodeCount * l.prevNodeCount + l.nodeCount;
+		}
+
+		return count;
+
+	}
+
+	// the number of weight and bias nudges, which for sparse layers is only one per stored weight
+	size_t nudgeCount (const nnet::neural &network)
+	{
+
+		size_t count = 0;
+
+		for (int i = 1; i < network.layers.size(); ++i)
+		{
+			const nnet::layer &l = *network.layers.at(i);
+			count += l.storedWeightCount() + l.biasNudgeSums.size();
+		}
+
+		return count;
+
+	}
+
+	// sent by each rank to the next one once connected
+	struct hello
+	{
+		char magic[4];
+		int32_t rank;
+		int32_t worldSize;
+		int32_t reserved;
+		uint64_t topology;
+	};
+
+	const char helloMagic[4] = {'N', 'N', 'R', 'G'};
+
+}
+
+
+
+#if defined(__unix__) || defined(__APPLE__)
+
+namespace
+{
+
+#ifdef MSG_NOSIGNAL
+	// a rank that dies mid-step shouldn't take the others down with SIGPIPE
+	const int sendFlags = MSG_NOSIGNAL;
+#else
+	const int sendFlags = 0;
+#endif
+
+	bool readAll (int socket, void* data, size_t size)
+	{
+
+		char* p = (char*) data;
+
+		while (size > 0)
+		{
+			const ssize_t n = recv(socket, p, size, 0);
+
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+
+			p += n;
+			size -= n;
+		}
+
+		return true;
+
+	}
+
+	bool writeAll (int socket, const void* data, size_t size)
+	{
+
+		const char* p = (const char*) data;
+
+		while (size > 0)
+		{
+			const ssize_t n = send(socket, p, size, sendFlags);
+
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+
+			p += n;
+			size -= n;
+		}
+
+		return true;
+
+	}
+
+	void setSocketOptions (int s)
+	{
+
+		// nudges go out in large writes, and the small control messages shouldn't wait on Nagle's algorithm
+		const int on = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+#ifdef SO_NOSIGPIPE
+		setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+	}
+
+	// one attempt at connecting to host:port, -1 if nothing is listening there yet
+	int dial (const std::string &host, int port)
+	{
+
+		addrinfo hints {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* addresses;
+
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return -1;
+
+		int result = -1;
+
+		for (addrinfo* a = addresses; a && result < 0; a = a->ai_next)
+		{
+			const int s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+
+			if (s < 0) continue;
+
+			if (connect(s, a->ai_addr, a->ai_addrlen) == 0)
+			{
+				result = s;
+			}
+			else
+			{
+				close(s);
+			}
+		}
+
+		freeaddrinfo(addresses);
+
+		return result;
+
+	}
+
+}
+
+
+nnet::distributedTrainer::distributedTrainer (neural &network, const distributedSettings &settings)
+: m_network {network},
+	m_settings {settings}
+{
+
+	if (settings.worldSize < 1 || settings.rank < 0 || settings.rank >= settings.worldSize)
+	{
+		throw nnet::usageError("rank " + std::to_string(settings.rank) + " is outside a world of size " + std::to_string(settings.worldSize));
+	}
+
+	if (!settings.hosts.empty() && settings.hosts.size() != (size_t) settings.worldSize)
+	{
+		throw nnet::usageError("distributedSettings::hosts needs one host per rank, or none at all");
+	}
+
+	// the extra value is the sample count
+	m_buffer.resize(nudgeCount(network) + 1);
+
+	for (const auto &l : network.layers)
+	{
+		m_storage.push_back(l->storage);
+		m_patterns.push_back(l->pattern);
+	}
+
+	if (settings.worldSize == 1) return;
+
+	try
+	{
+		connectRing();
+		broadcastParams();
+	}
+	catch (...)
+	{
+		if (m_next >= 0) close(m_next);
+		if (m_prev >= 0) close(m_prev);
+
+		throw;
+	}
+
+}
+
+nnet::distributedTrainer::~distributedTrainer ()
+{
+
+	if (m_next >= 0) close(m_next);
+	if (m_prev >= 0) close(m_prev);
+
+}
+
+
+void nnet::distributedTrainer::connectRing ()
+{
+
+	const int rank = m_settings.rank;
+	const int worldSize = m_settings.worldSize;
+	const int nextRank = (rank + 1) % worldSize;
+	const int prevRank = (rank + worldSize - 1) % worldSize;
+
+	const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + m_settings.connectTimeout;
+
+
+	// listen first, so that the previous rank's connect() succeeds as soon as it's made, even before accept()
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listener < 0)
+	{
+		throw nnet::connectionError(std::string("could not create a socket: ") + std::strerror(errno));
+	}
+
+	const int on = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	sockaddr_in address {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(m_settings.basePort + rank);
+	address.sin_addr.s_addr = htonl(m_settings.hosts.empty() ? INADDR_LOOPBACK : INADDR_ANY);
+
+	if (bind(listener, (const sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 1) != 0)
+	{
+		const std::string reason = std::strerror(errno);
+		close(listener);
+
+		throw nnet::connectionError("rank " + std::to_string(rank) + " could not listen on port " + std::to_string(m_settings.basePort + rank) + ": " + reason);
+	}
+
+
+	// the next rank may not have started yet, so keep trying until the deadline
+	const std::string nextHost = m_settings.hosts.empty() ? "127.0.0.1" : m_settings.hosts.at(nextRank);
+	const int nextPort = m_settings.basePort + nextRank;
+
+	while ((m_next = dial(nextHost, nextPort)) < 0)
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			close(listener);
+			throw nnet::connectionError("could not connect to rank " + std::to_string(nextRank) + " at " + nextHost + ":" + std::to_string(nextPort));
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+
+	pollfd waiting {listener, POLLIN, 0};
+
+	while (m_prev < 0)
+	{
+		const long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+		if (remaining <= 0)
+		{
+			close(listener);
+			throw nnet::connectionError("rank " + std::to_string(prevRank) + " never connected to rank " + std::to_string(rank));
+		}
+
+		if (poll(&waiting, 1, (int) std::min<long long>(remaining, 1000)) > 0 && (waiting.revents & POLLIN))
+		{
+			m_prev = accept(listener, nullptr, nullptr);
+		}
+	}
+
+	close(listener);
+
+	setSocketOptions(m_next);
+	setSocketOptions(m_prev);
+
+
+	// make sure the previous rank is who it should be, and is training the same kind of network
+	hello mine {};
+	std::memcpy(mine.magic, helloMagic, 4);
+	mine.rank = rank;
+	mine.worldSize = worldSize;
+	mine.topology = topologyHash(m_network);
+
+	hello theirs;
+
+	if (!writeAll(m_next, &mine, sizeof(mine)) || !readAll(m_prev, &theirs, sizeof(theirs)))
+	{
+		throw nnet::connectionError("lost the connection to a neighbouring rank while connecting the ring");
+	}
+
+	if (std::memcmp(theirs.magic, helloMagic, 4) != 0 || theirs.rank != prevRank || theirs.worldSize != worldSize)
+	{
+		throw nnet::usageError("rank " + std::to_string(rank) + " expected rank " + std::to_string(prevRank) + " of " + std::to_string(worldSize) + " to connect, check every rank's distributedSettings");
+	}
+
+	if (theirs.topology != mine.topology)
+	{
+		throw nnet::usageError("rank " + std::to_string(prevRank) + " has a different topology, storage type, sparsity pattern or optimizer than rank " + std::to_string(rank));
+	}
+
+	// from here on, exchange() drives both directions at once
+	fcntl(m_next, F_SETFL, fcntl(m_next, F_GETFL) | O_NONBLOCK);
+	fcntl(m_prev, F_SETFL, fcntl(m_prev, F_GETFL) | O_NONBLOCK);
+
+}
+
+
+void nnet::distributedTrainer::exchange (const void* send, size_t sendSize, void* recv, size_t recvSize)
+{
+
+	const char* out = (const char*) send;
+	char* in = (char*) recv;
+
+	size_t sent = 0;
+	size_t received = 0;
+
+	while (sent < sendSize || received < recvSize)
+	{
+		pollfd fds[2] = {
+			{m_next, (short) (sent < sendSize ? POLLOUT : 0), 0},
+			{m_prev, (short) (received < recvSize ? POLLIN : 0), 0}
+		};
+
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+
+			throw nnet::connectionError(std::string("poll() failed: ") + std::strerror(errno));
+		}
+
+		if (sent < sendSize && fds[0].revents)
+		{
+			const ssize_t n = ::send(m_next, out + sent, sendSize - sent, sendFlags);
+
+			if (n > 0)
+			{
+				sent += n;
+			}
+			else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			{
+				throw nnet::connectionError("lost the connection to rank " + std::to_string((m_settings.rank + 1) % m_settings.worldSize));
+			}
+		}
+
+		if (received < recvSize && fds[1].revents)
+		{
+			const ssize_t n = ::recv(m_prev, in + received, recvSize - received, 0);
+
+			if (n > 0)
+			{
+				received += n;
+			}
+			else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			{
+				throw nnet::connectionError("lost the connection to rank " + std::to_string((m_settings.rank + m_settings.worldSize - 1) % m_settings.worldSize));
+			}
+		}
+	}
+
+}
+
+
+int nnet::launchLocal (int worldSize, const std::function<void (int rank)> &job)
+{
+
+	if (worldSize < 1)
+	{
+		throw nnet::usageError("launchLocal() needs at least one rank");
+	}
+
+	// otherwise anything still buffered would be written out once by every process
+	std::fflush(nullptr);
+
+	std::vector<pid_t> children;
+
+	for (int rank = 0; rank < worldSize; ++rank)
+	{
+		const pid_t pid = fork();
+
+		// the ranks already started will time out waiting for this one
+		if (pid < 0) break;
+
+		if (pid == 0)
+		{
+			int status = 0;
+
+			try
+			{
+				job(rank);
+			}
+			catch (const std::exception &e)
+			{
+				std::fprintf(stderr, "rank %d: %s\n", rank, e.what());
+				status = 1;
+			}
+			catch (...)
+			{
+				status = 1;
+			}
+
+			// skip the parent's exit handlers and static destructors, they aren't this process's to run
+			std::fflush(nullptr);
+			_exit(status);
+		}
+
+		children.push_back(pid);
+	}
+
+	int failures = worldSize - children.size();
+
+	for (pid_t pid: children)
+	{
+		int status;
+
+		while (waitpid(pid, &status, 0) < 0)
+		{
+			if (errno != EINTR)
+			{
+				status = -1;
+				break;
+			}
+		}
+
+		if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ++failures;
+	}
+
+	return failures;
+
+}
+
+#else
+
+nnet::distributedTrainer::distributedTrainer (neural &network, const distributedSettings &settings)
+: m_network {network},
+	m_settings {settings}
+{
+
+	if (settings.worldSize != 1 || settings.rank != 0)
+	{
+		throw nnet::usageError("distributed training is not supported on this platform");
+	}
+
+	m_buffer.resize(nudgeCount(network) + 1);
+
+	for (const auto &l : network.layers)
+	{
+		m_storage.push_back(l->storage);
+		m_patterns.push_back(l->pattern);
+	}
+
+}
+
+nnet::distributedTrainer::~distributedTrainer ()
+{
+}
+
+void nnet::distributedTrainer::connectRing ()
+{
+}
+
+void nnet::distributedTrainer::exchange (const void* send, size_t sendSize, void* recv, size_t recvSize)
+{
+}
+
+int nnet::launchLocal (int worldSize, const std::function<void (int rank)> &job)
+{
+	throw nnet::usageError("launchLocal() is not supported on this platform");
+}
+
+#endif
+
+
+
+int nnet::distributedTrainer::getRank () const
+{
+	return m_settings.rank;
+}
+
+int nnet::distributedTrainer::getWorldSize () const
+{
+	return m_settings.worldSize;
+}
+
+
+// a chain from rank 0 around the ring, each rank forwarding what it received to the next
+void nnet::distributedTrainer::broadcastParams ()
+{
+
+	const int rank = m_settings.rank;
+
+	std::vector<float> params(paramCount(m_network));
+	const size_t bytes = params.size() * sizeof(float);
+
+	if (rank == 0)
+	{
+		float* p = params.data();
+
+		for (int i = 1; i < m_network.layers.size(); ++i)
+		{
+			const layer &l = *m_network.layers.at(i);
+			const size_t weightCount = (size_t) l.nodeCount * l.prevNodeCount;
+
+			l.loadWeights(0, weightCount, p);
+			std::memcpy(p + weightCount, l.biases.get(), l.nodeCount * sizeof(float));
+
+			p += weightCount + l.nodeCount;
+		}
+	}
+	else
+	{
+		exchange(nullptr, 0, params.data(), bytes);
+	}
+
+	if (rank < m_settings.worldSize - 1)
+	{
+		exchange(params.data(), bytes, nullptr, 0);
+	}
+
+	if (rank != 0)
+	{
+		const float* p = params.data();
+
+		for (int i = 1; i < m_network.layers.size(); ++i)
+		{
+			layer &l = *m_network.layers.at(i);
+			const size_t weightCount = (size_t) l.nodeCount * l.prevNodeCount;
+
+			l.storeWeights(0, weightCount, p);
+			std::memcpy(l.biases.get(), p + weightCount, l.nodeCount * sizeof(float));
+
+			p += weightCount + l.nodeCount;
+		}
+	}
+
+}
+
+
+void nnet::distributedTrainer::allReduce (float* values, size_t count)
+{
+
+	const int worldSize = m_settings.worldSize;
+	const int rank = m_settings.rank;
+
+	if (worldSize == 1) return;
+
+	const kernels::table &k = kernels::get();
+
+	// the values are split into worldSize chunks, which travel around the ring in turn
+	auto chunkBegin = [&] (int chunk) { return count * chunk / worldSize; };
+	auto chunkSize = [&] (int chunk) { return chunkBegin(chunk + 1) - chunkBegin(chunk); };
+
+	m_received.resize(count / worldSize + 1);
+
+	// reduce-scatter: each step, pass a chunk on to the next rank and add the one from the previous rank into ours
+	// after worldSize - 1 steps, this rank holds the complete sum of chunk rank + 1
+	for (int step = 0; step < worldSize - 1; ++step)
+	{
+		const int sendChunk = (rank - step + worldSize) % worldSize;
+		const int recvChunk = (rank - step - 1 + worldSize) % worldSize;
+
+		exchange(values + chunkBegin(sendChunk), chunkSize(sendChunk) * sizeof(float), m_received.data(), chunkSize(recvChunk) * sizeof(float));
+
+		k.axpy(values + chunkBegin(recvChunk), 1, m_received.data(), chunkSize(recvChunk));
+	}
+
+	// all-gather: pass the complete sums around, overwriting the partial ones
+	// every rank ends up with the same bits for every value, whichever rank summed it
+	for (int step = 0; step < worldSize - 1; ++step)
+	{
+		const int sendChunk = (rank + 1 - step + worldSize) % worldSize;
+		const int recvChunk = (rank - step + worldSize) % worldSize;
+
+		exchange(values + chunkBegin(sendChunk), chunkSize(sendChunk) * sizeof(float), values + chunkBegin(recvChunk), chunkSize(recvChunk) * sizeof(float));
+	}
+
+}
+
+
+void nnet::distributedTrainer::barrier ()
+{
+
+	// the sum can't be complete anywhere until every rank has added to it
+	float x = 0;
+	allReduce(&x, 1);
+
+}
+
+
+void nnet::distributedTrainer::checkLayout () const
+{
+
+	bool same = m_network.layers.size() == m_storage.size();
+
+	for (int i = 1; same && i < m_network.layers.size(); ++i)
+	{
+		const layer &l = *m_network.layers.at(i);
+
+		same = l.storage == m_storage.at(i) && l.pattern == m_patterns.at(i);
+	}
+
+	if (!same || nudgeCount(m_network) + 1 != m_buffer.size())
+	{
+		throw nnet::usageError("the network's storage type or sparsity pattern has changed since its distributedTrainer was made, make a new trainer on every rank");
+	}
+
+}
+
+
+void nnet::distributedTrainer::trainBatch (const float* inputs, const float* ideals, size_t count, float learningRate)
+{
+
+	if (m_settings.worldSize > 1)
+	{
+		checkLayout();
+	}
+
+	m_network.backpropBatch(inputs, ideals, count, learningRate);
+
+	if (m_settings.worldSize > 1)
+	{
+		float* p = m_buffer.data();
+
+		for (int i = 1; i < m_network.layers.size(); ++i)
+		{
+			layer &l = *m_network.layers.at(i);
+
+			l.allocateNudgeSums();
+
+			std::memcpy(p, l.weightNudgeSums.data(), l.weightNudgeSums.size() * sizeof(float));
+			p += l.weightNudgeSums.size();
+
+			std::memcpy(p, l.biasNudgeSums.data(), l.biasNudgeSums.size() * sizeof(float));
+			p += l.biasNudgeSums.size();
+		}
+
+		// exact up to 2^24 samples per step
+		*p = m_network.trainDataCount;
+
+		allReduce(m_buffer.data(), m_buffer.size());
+
+		p = m_buffer.data();
+
+		for (int i = 1; i < m_network.layers.size(); ++i)
+		{
+			layer &l = *m_network.layers.at(i);
+
+			std::memcpy(l.weightNudgeSums.data(), p, l.weightNudgeSums.size() * sizeof(float));
+			p += l.weightNudgeSums.size();
+
+			std::memcpy(l.biasNudgeSums.data(), p, l.biasNudgeSums.size() * sizeof(float));
+			p += l.biasNudgeSums.size();
+		}
+
+		m_network.trainDataCount = (int) *p;
+	}
+
+	// the nudges are all zero if no rank had any samples
+	if (m_network.trainDataCount > 0)
+	{
+		m_network.backpropApply();
+	}
+
+	++m_stepCount;
+
+	if (m_settings.checksumInterval > 0 && m_stepCount % m_settings.checksumInterval == 0)
+	{
+		verifySync();
+	}
+
+}
+
+
+void nnet::distributedTrainer::verifySync ()
+{
+
+	if (m_settings.worldSize == 1) return;
+
+	// each rank compares with the previous one, which around the whole ring compares them all
+	const uint64_t mine = getChecksum();
+	uint64_t theirs;
+
+	exchange(&mine, sizeof(mine), &theirs, sizeof(theirs));
+
+	// then every rank learns whether any comparison failed, so they all throw together instead of some hanging
+	float mismatches = theirs != mine;
+	allReduce(&mismatches, 1);
+
+	if (mismatches > 0)
+	{
+		throw nnet::internalError("the replicas' parameters have drifted apart, thrown from nnet::distributedTrainer::verifySync()");
+	}
+
+}
+
+
+uint64_t nnet::distributedTrainer::getChecksum () const
+{
+
+	uint64_t h = hashSeed;
+
+	for (int i = 1; i < m_network.layers.size(); ++i)
+	{
+		const layer &l = *m_network.layers.at(i);
+		const size_t weightCount = (size_t) l.nodeCount * l.prevNodeCount;
+
+		if (l.storage == storageType::float32)
+		{
+			h = hashBytes(h, l.weights.get(), weightCount * sizeof(float));
+		}
+		else if (l.storage == storageType::sparse)
+		{
+			h = hashBytes(h, l.pattern->rowStarts.data(), l.pattern->rowStarts.size() * sizeof(size_t));
+			h = hashBytes(h, l.pattern->columns.data(), l.pattern->columns.size() * sizeof(int));
+			h = hashBytes(h, l.sparseWeights.get(), l.pattern->columns.size() * sizeof(float));
+		}
+		else
+		{
+			h = hashBytes(h, l.halfWeights.get(), weightCount * sizeof(uint16_t));
+		}
+
+		h = hashBytes(h, l.biases.get(), l.nodeCount * sizeof(float));
+	}
+
+	return h;
+
+}
@@ -1,9 +1,23 @@
 #include "../include/nnet.hpp"
 
 #include <fstream>
+#include <cstdio>
 #include <cstdint>
 #include <cmath>
 #include <cstring>
+#include <array>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 void compatCheck ()
@@ -14,201 +28,624 @@ void compatCheck ()
 	}
 }
 
-// serialize a number into chars, then push it to vec at the BACK
+// read a number from the bytes at ptr, reversing them if needed
 template <typename T>
-void serializePush (std::vector<char> &vec, T x, bool reverse)
+T deserialize (const char* ptr, bool reverse)
 {
-	char* ptr = (char*) &x;
 
-	if (reverse)
+	char bytes[sizeof(T)];
+
+	for (int i = 0; i < sizeof(T); ++i)
 	{
-		for (int i = sizeof(T) - 1; i >= 0; --i)
-		{
-			vec.push_back(ptr[i]);
-		}
+		bytes[i] = reverse ? ptr[sizeof(T) - 1 - i] : ptr[i];
 	}
-	else
+
+	T x;
+	std::memcpy(&x, bytes, sizeof(T));
+
+	return x;
+
+}
+
+
+// the whole contents of a file, held either as a memory mapping or as one read into memory
+// this only lives as long as loading does, the network gets its own copy of everything
+struct fileData
+{
+	std::shared_ptr<char> data;
+	size_t size = 0;
+};
+
+static bool readWholeFile (const std::string &filename, fileData &out)
+{
+
+#if defined(__unix__) || defined(__APPLE__)
+
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0) return false;
+
+	struct stat info;
+
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	const size_t size = info.st_size;
+
+	if (size > 0)
 	{
-		for (int i = 0; i < sizeof(T); ++i)
+		// read only, since it's only copied out of
+		void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (ptr != MAP_FAILED)
 		{
-			vec.push_back(ptr[i]);
+			close(fd);
+
+			out.data = std::shared_ptr<char>((char*) ptr, [size] (char* p) { munmap(p, size); });
+			out.size = size;
+
+			return true;
 		}
 	}
+
+	close(fd);
+
+	// if mapping fails, fall through and read it normally
+
+#endif
+
+	std::ifstream f1(filename, std::ios::binary | std::ios::ate);
+
+	if (!f1) return false;
+
+	out.size = f1.tellg();
+	f1.seekg(0);
+
+	out.data = std::shared_ptr<char>(new char[out.size + 1], std::default_delete<char[]>());
+
+	f1.read(out.data.get(), out.size);
+
+	return (bool) f1;
+
 }
 
 
-// deserialize first few bytes of char vec into a number, then pop those chars from the FRONT of the vec
-template <typename T>
-T deserializePop (std::vector<char> &vec, bool reverse)
+// get a buffer of count floats, read from ptr
+// the network never points into the file itself, since the file could be truncated or rewritten (even by saveToFile()) while it's loaded
+static std::shared_ptr<float> loadFloats (const char* ptr, size_t count, bool reverse)
 {
 
-	if (reverse)
+	std::shared_ptr<float> dst = nnet::allocFloats(count);
+	float* d = dst.get();
+
+	if (!reverse)
 	{
-		// reverse the bytes in-place
-		for (int i = 0; i < sizeof(T) / 2; ++i)
-		{
-			char temp = vec.at(i);
-			vec.at(i) = vec.at(sizeof(T) - 1 - i);
-			vec.at(sizeof(T) - 1 - i) = temp;
-		}
+		std::memcpy(d, ptr, count * sizeof(float));
+		return dst;
 	}
 
-	T x;
-	std::memcpy(&x, vec.data(), sizeof(T));
+	for (size_t i = 0; i < count; ++i)
+	{
+		d[i] = deserialize<float>(ptr + i * sizeof(float), reverse);
+	}
 
-	vec.erase(vec.begin(), vec.begin() + sizeof(T));
+	return dst;
 
-	return x;
+}
+
+// the same, for half-precision weights
+static std::shared_ptr<uint16_t> loadHalves (const char* ptr, size_t count, bool reverse)
+{
+
+	std::shared_ptr<uint16_t> dst = nnet::allocHalves(count);
+	uint16_t* d = dst.get();
+
+	if (!reverse)
+	{
+		std::memcpy(d, ptr, count * sizeof(uint16_t));
+		return dst;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		d[i] = deserialize<uint16_t>(ptr + i * sizeof(uint16_t), reverse);
+	}
+
+	return dst;
 
 }
 
 
 
-bool nnet::neural::saveToFile (std::string filename)
+////// file layout
+//
+// v1 (read only): four uint32 counts (middle layer count, input, middle and output node counts),
+// then every layer's weights, then every layer's biases, all little-endian with no padding
+//
+// v2: a header, then each layer's weights and biases in their own 64-byte aligned sections
+// everything is written in the byte order of the machine that saved it, and the header records which one that was
+//
+//   offset  size
+//   0       4     magic "NNET"
+//   4       1     endianness (1 = little endian, 0 = big endian)
+//   5       1     dtype of the weights (see fileDtype), biases are always float32
+//   6       1     activation (see fileActivation)
+//   7       1     reserved, 0
+//   8       4     version, 2
+//   12      4     layer count L, including the input layer
+//   16      4L    node count of each layer
+//   ..      8(L-1) CRC-32C of each layer's weight section and bias section, in that order
+//   ..      4     CRC-32C of all of the header bytes before this one
+//   padding up to a multiple of 64, then the sections, each padded up to a multiple of 64
+
+static const char fileMagic[4] = {'N', 'N', 'E', 'T'};
+static const uint32_t fileVersion = 2;
+static const size_t fileAlignment = 64;
+
+enum fileDtype : uint8_t
 {
+	dtypeFloat32 = 0,
+	dtypeFloat16 = 1,
+	dtypeBfloat16 = 2
+};
 
-	compatCheck();
+enum fileActivation : uint8_t
+{
+	activationTanh = 0
+};
+
+
+static size_t alignUp (size_t x)
+{
+	return (x + fileAlignment - 1) / fileAlignment * fileAlignment;
+}
 
-	bool isBigEndian = !isLittleEndian();
+static size_t headerSize (size_t layerCount)
+{
+	return alignUp(16 + 4 * layerCount + 8 * (layerCount - 1) + 4);
+}
 
+static size_t weightSize (nnet::storageType type)
+{
+	return type == nnet::storageType::float32 ? sizeof(float) : sizeof(uint16_t);
+}
 
-	std::ofstream f1(filename, std::ios::binary);
 
-	if (!f1) return false;
+static std::array<uint32_t, 256> makeCrcTable ()
+{
 
+	std::array<uint32_t, 256> table;
 
-	std::vector<char> buf;
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t c = i;
 
+		for (int j = 0; j < 8; ++j)
+		{
+			c = (c & 1) ? 0x82F63B78 ^ (c >> 1) : c >> 1;
+		}
 
-	serializePush<uint32_t>(buf, m_middleLayerCount, isBigEndian);
-	serializePush<uint32_t>(buf, m_inputNodeCount, isBigEndian);
-	serializePush<uint32_t>(buf, m_middleNodeCount, isBigEndian);
-	serializePush<uint32_t>(buf, m_outputNodeCount, isBigEndian);
+		table[i] = c;
+	}
 
-	f1.write(buf.data(), buf.size());
+	return table;
 
+}
 
-	// weights
-	for (int i = 1; i < layers.size(); ++i)
+static uint32_t crc32cTable (uint32_t crc, const char* data, size_t size)
+{
+
+	static const std::array<uint32_t, 256> table = makeCrcTable();
+
+	for (size_t i = 0; i < size; ++i)
 	{
-		std::shared_ptr<layer> l = layers.at(i);
+		crc = table[(crc ^ (uint8_t) data[i]) & 0xFF] ^ (crc >> 8);
+	}
 
-		buf = std::vector<char>();
+	return crc;
 
-		for (int j = 0; j < l->nodes.size(); ++j)
-		{
+}
 
-			node &n = l->nodes.at(j);
+#if defined(__x86_64__)
 
-			for (int k = 0; k < n.weights->size(); ++k)
-			{
-				float weight = n.weights->at(k);
+// SSE4.2 has an instruction for exactly this polynomial, which is what makes checking big files cheap
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware (uint32_t crc, const char* data, size_t size)
+{
 
-				serializePush<float>(buf, weight, isBigEndian);
-			}
-		}
+	uint64_t c = crc;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		c = _mm_crc32_u64(c, word);
+	}
+
+	return crc32cTable((uint32_t) c, data + i, size - i);
+
+}
+
+#endif
+
+// CRC-32C (Castagnoli), to catch truncated or corrupted files
+static uint32_t crc32c (const char* data, size_t size)
+{
+
+	uint32_t crc = 0xFFFFFFFF;
 
-		f1.write(buf.data(), buf.size());
+#if defined(__x86_64__)
+	static const bool hasHardware = __builtin_cpu_supports("sse4.2");
 
+	if (hasHardware)
+	{
+		crc = crc32cHardware(crc, data, size);
+	}
+	else
+#endif
+	{
+		crc = crc32cTable(crc, data, size);
 	}
 
+	return crc ^ 0xFFFFFFFF;
 
+}
 
-	// biases
-	buf = std::vector<char>();
 
-	for (int i = 1; i < layers.size(); ++i)
+// where everything is in a loaded file, whichever version it is
+struct fileLayout
+{
+	std::vector<int> nodeCounts;
+
+	// indexed by layer, entry 0 (the input layer) is unused
+	std::vector<size_t> weightOffsets;
+	std::vector<size_t> biasOffsets;
+
+	// true if the file's byte order is the opposite of this machine's
+	bool reverse = false;
+
+	nnet::storageType storage = nnet::storageType::float32;
+};
+
+
+// a valid checksum doesn't mean a trustworthy file, so no node count is allowed to wrap the section sizes computed from it
+// with two of these, even 4 * count * count fits in a size_t
+static bool validNodeCount (uint32_t count)
+{
+	return count >= 1 && count <= (uint32_t) std::numeric_limits<int32_t>::max();
+}
+
+
+static bool parseV1 (const fileData &file, fileLayout &layout)
+{
+
+	if (file.size < 4 * 4) return false;
+
+	const char* ptr = file.data.get();
+
+	// v1 files are always little-endian
+	layout.reverse = !nnet::isLittleEndian();
+
+	const uint32_t middleLayerCount = deserialize<uint32_t>(ptr + 0, layout.reverse);
+	const uint32_t inputNodeCount = deserialize<uint32_t>(ptr + 4, layout.reverse);
+	const uint32_t middleNodeCount = deserialize<uint32_t>(ptr + 8, layout.reverse);
+	const uint32_t outputNodeCount = deserialize<uint32_t>(ptr + 12, layout.reverse);
+
+	if (!validNodeCount(inputNodeCount) || !validNodeCount(outputNodeCount)) return false;
+	if (middleLayerCount > 0 && !validNodeCount(middleNodeCount)) return false;
+
+	// every middle layer has at least its biases in the file, which bounds the count before anything is allocated for it
+	if (middleLayerCount > (file.size - 4 * 4) / 4) return false;
+
+	layout.nodeCounts.push_back(inputNodeCount);
+	for (uint32_t i = 0; i < middleLayerCount; ++i) layout.nodeCounts.push_back(middleNodeCount);
+	layout.nodeCounts.push_back(outputNodeCount);
+
+
+	// all of the weights, then all of the biases
+	const size_t layerCount = layout.nodeCounts.size();
+
+	layout.weightOffsets.assign(layerCount, 0);
+	layout.biasOffsets.assign(layerCount, 0);
+
+	// offset <= file.size throughout, so comparing each section against what's left can't overflow
+	size_t offset = 4 * 4;
+
+	for (size_t i = 1; i < layerCount; ++i)
 	{
-		std::shared_ptr<layer> l = layers.at(i);
+		const size_t weightBytes = 4 * (size_t) layout.nodeCounts[i] * (size_t) layout.nodeCounts[i - 1];
 
-		for (int j = 0; j < l->nodes.size(); ++j)
-		{
-			float bias = l->nodes.at(j).bias;
+		if (weightBytes > file.size - offset) return false;
 
-			serializePush<float>(buf, bias, isBigEndian);
-		}
+		layout.weightOffsets[i] = offset;
+		offset += weightBytes;
 	}
 
-	f1.write(buf.data(), buf.size());
+	for (size_t i = 1; i < layerCount; ++i)
+	{
+		const size_t biasBytes = 4 * (size_t) layout.nodeCounts[i];
 
-	f1.close();
+		if (biasBytes > file.size - offset) return false;
+
+		layout.biasOffsets[i] = offset;
+		offset += biasBytes;
+	}
 
 	return true;
 
 }
 
 
-nnet::neural* nnet::neural::loadFromFile(std::string filename)
+static bool parseV2 (const fileData &file, fileLayout &layout)
 {
 
-	compatCheck();
+	const char* ptr = file.data.get();
 
-	bool isBigEndian = !isLittleEndian();
+	if (file.size < 16) return false;
 
+	// only the byte order and the layer count are needed to find and check the header checksum
+	// nothing else in the header is looked at until it has passed, so a corrupt header reads as corrupt, not as an unsupported file
+	if (ptr[4] != 0 && ptr[4] != 1) return false;
 
-	std::ifstream f1(filename, std::ios::binary);
+	const bool fileIsLittleEndian = ptr[4] == 1;
+	layout.reverse = fileIsLittleEndian != nnet::isLittleEndian();
 
-	if (!f1) return nullptr;
+	const size_t layerCount = deserialize<uint32_t>(ptr + 12, layout.reverse);
 
-	std::vector<char> buf(4 * 4);
+	if (layerCount < 2 || layerCount > file.size || headerSize(layerCount) > file.size) return false;
 
-	f1.read(buf.data(), 4 * 4);
 
+	const char* countPtr = ptr + 16;
+	const char* checksumPtr = countPtr + 4 * layerCount;
+	const char* headerChecksumPtr = checksumPtr + 8 * (layerCount - 1);
 
-	int middleLayerCount = deserializePop<uint32_t>(buf, isBigEndian);
-	int inputNodeCount = deserializePop<uint32_t>(buf, isBigEndian);
-	int middleNodeCount = deserializePop<uint32_t>(buf, isBigEndian);
-	int outputNodeCount = deserializePop<uint32_t>(buf, isBigEndian);
+	if (crc32c(ptr, headerChecksumPtr - ptr) != deserialize<uint32_t>(headerChecksumPtr, layout.reverse)) return false;
 
-	neural* n1 = new neural(middleLayerCount, inputNodeCount, middleNodeCount, outputNodeCount);
 
+	switch ((uint8_t) ptr[5])
+	{
+		case dtypeFloat32: layout.storage = nnet::storageType::float32; break;
+		case dtypeFloat16: layout.storage = nnet::storageType::float16; break;
+		case dtypeBfloat16: layout.storage = nnet::storageType::bfloat16; break;
 
-	// weights
-	for (int i = 1; i < n1->layers.size(); ++i)
+		default:
+			throw nnet::incompatibleError("Cannot load file; unsupported data type or activation function.");
+	}
+
+	if ((uint8_t) ptr[6] != activationTanh)
 	{
-		std::shared_ptr<layer> l = n1->layers.at(i);
-		std::shared_ptr<layer> prevLayer = n1->layers.at(i - 1);
+		throw nnet::incompatibleError("Cannot load file; unsupported data type or activation function.");
+	}
+
+	if (deserialize<uint32_t>(ptr + 8, layout.reverse) != fileVersion)
+	{
+		throw nnet::incompatibleError("Cannot load file; unsupported file version.");
+	}
 
-		buf = std::vector<char>(4 * l->nodes.size() * prevLayer->nodes.size());
+	for (size_t i = 0; i < layerCount; ++i)
+	{
+		const uint32_t count = deserialize<uint32_t>(countPtr + 4 * i, layout.reverse);
 
-		f1.read(buf.data(), buf.size());
+		if (!validNodeCount(count)) return false;
 
-		for (int j = 0; j < l->nodes.size(); ++j)
-		{
-			node &n = l->nodes.at(j);
+		layout.nodeCounts.push_back((int) count);
+	}
+
+
+	layout.weightOffsets.assign(layerCount, 0);
+	layout.biasOffsets.assign(layerCount, 0);
+
+	size_t offset = headerSize(layerCount);
+
+	for (size_t i = 1; i < layerCount; ++i)
+	{
+		const size_t weightCount = (size_t) layout.nodeCounts[i] * (size_t) layout.nodeCounts[i - 1];
+		const size_t weightBytes = weightSize(layout.storage) * weightCount;
+		const size_t biasBytes = 4 * (size_t) layout.nodeCounts[i];
+
+		if (weightBytes / weightSize(layout.storage) != weightCount) return false;
+
+		// offset <= file.size holds going in and weightBytes <= file.size after the first check, so none of this can wrap
+		if (weightBytes > file.size - offset || alignUp(weightBytes) > file.size - offset) return false;
+
+		layout.weightOffsets[i] = offset;
+		offset += alignUp(weightBytes);
+
+		if (alignUp(biasBytes) > file.size - offset) return false;
+
+		layout.biasOffsets[i] = offset;
+		offset += alignUp(biasBytes);
+
+		const uint32_t weightChecksum = deserialize<uint32_t>(checksumPtr + 8 * (i - 1), layout.reverse);
+		const uint32_t biasChecksum = deserialize<uint32_t>(checksumPtr + 8 * (i - 1) + 4, layout.reverse);
 
-			for (int k = 0; k < n.weights->size(); ++k)
-			{
-				n.weights->at(k) = deserializePop<float>(buf, isBigEndian);
-			}
+		if (crc32c(ptr + layout.weightOffsets[i], weightBytes) != weightChecksum) return false;
+		if (crc32c(ptr + layout.biasOffsets[i], biasBytes) != biasChecksum) return false;
+	}
+
+	return true;
+
+}
+
+
+
+// serialize a number in native byte order, then push it to vec at the BACK
+template <typename T>
+void serializePush (std::vector<char> &vec, T x)
+{
+	const char* ptr = (const char*) &x;
+	vec.insert(vec.end(), ptr, ptr + sizeof(T));
+}
+
+
+bool nnet::neural::saveToFile (std::string filename)
+{
+
+	compatCheck();
+
+
+	// everything is checked before any file is touched
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		if (layers.at(i)->storage != getStorageType())
+		{
+			throw nnet::usageError("Cannot save file; every layer must have the same storage type.");
 		}
 	}
 
+	// the weights are written in whatever storage type they are held in, except sparse, which is written as float32
+	const storageType storage = getStorageType() == storageType::sparse ? storageType::float32 : getStorageType();
 
 
-	// biases
-	buf = std::vector<char>(4 * (middleLayerCount * middleNodeCount + outputNodeCount));
+	// every section is written straight from memory, then padded
+	std::vector<const char*> sections;
+	std::vector<size_t> sectionSizes;
 
-	f1.read(buf.data(), buf.size());
+	// sparse weights are expanded here first, there's one buffer per layer so that the section pointers stay valid
+	std::vector<std::vector<float>> expanded(layers.size());
 
-	for (int i = 1; i < n1->layers.size(); ++i)
+	for (int i = 1; i < layers.size(); ++i)
 	{
-		std::shared_ptr<layer> l = n1->layers.at(i);
+		std::shared_ptr<layer> l = layers.at(i);
 
-		for (int j = 0; j < l->nodes.size(); ++j)
+		if (l->storage == storageType::sparse)
 		{
-			node &n = l->nodes.at(j);
+			expanded[i].resize((size_t) l->nodeCount * l->prevNodeCount);
+			l->loadWeights(0, expanded[i].size(), expanded[i].data());
 
-			n.bias = deserializePop<float>(buf, isBigEndian);
+			sections.push_back((const char*) expanded[i].data());
+		}
+		else if (storage == storageType::float32)
+		{
+			sections.push_back((const char*) l->weights.get());
 		}
+		else
+		{
+			sections.push_back((const char*) l->halfWeights.get());
+		}
+
+		sectionSizes.push_back(weightSize(storage) * l->nodeCount * l->prevNodeCount);
+
+		sections.push_back((const char*) l->biases.get());
+		sectionSizes.push_back(4 * (size_t) l->nodeCount);
 	}
 
 
+	// header
+	std::vector<char> buf(fileMagic, fileMagic + 4);
+
+	buf.push_back(isLittleEndian() ? 1 : 0);
+	switch (storage)
+	{
+		case storageType::float32: buf.push_back(dtypeFloat32); break;
+		case storageType::float16: buf.push_back(dtypeFloat16); break;
+		case storageType::bfloat16: buf.push_back(dtypeBfloat16); break;
+		case storageType::sparse: break;
+	}
+
+	buf.push_back(activationTanh);
+	buf.push_back(0);
+
+	serializePush<uint32_t>(buf, fileVersion);
+	serializePush<uint32_t>(buf, layers.size());
+
+	for (std::shared_ptr<layer> l: layers)
+	{
+		serializePush<uint32_t>(buf, l->nodeCount);
+	}
+
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		serializePush<uint32_t>(buf, crc32c(sections[i], sectionSizes[i]));
+	}
+
+	serializePush<uint32_t>(buf, crc32c(buf.data(), buf.size()));
+
+	buf.resize(headerSize(layers.size()), 0);
+
+
+	// filename may be open elsewhere, or this network may even have been loaded from it, so it's only replaced once the new file is complete
+	const std::string tempFilename = filename + ".tmp";
+
+	std::ofstream f1(tempFilename, std::ios::binary);
+
+	if (!f1) return false;
+
+	f1.write(buf.data(), buf.size());
+
+
+	// sections
+	const char padding[fileAlignment] = {};
+
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		f1.write(sections[i], sectionSizes[i]);
+		f1.write(padding, alignUp(sectionSizes[i]) - sectionSizes[i]);
+	}
+
 
 	f1.close();
 
-	return n1;
+	if (!f1 || std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+	{
+		std::remove(tempFilename.c_str());
+		return false;
+	}
+
+	return true;
 
 }
 
 
+nnet::neural* nnet::neural::loadFromFile(std::string filename)
+{
+
+	compatCheck();
+
+
+	fileData file;
+
+	if (!readWholeFile(filename, file)) return nullptr;
+
+
+	// v1 files have no magic, but they would need over a billion middle layers to start with "NNET"
+	fileLayout layout;
+
+	bool isV2 = file.size >= 4 && std::memcmp(file.data.get(), fileMagic, 4) == 0;
+
+	if (!(isV2 ? parseV2(file, layout) : parseV1(file, layout))) return nullptr;
+
+
+	// the layers are built without parameter buffers, which are then filled in from the file data
+	neural* n1 = new neural(layout.nodeCounts, false);
+
+	for (int i = 1; i < n1->layers.size(); ++i)
+	{
+		std::shared_ptr<layer> l = n1->layers.at(i);
+
+		const char* ptr = file.data.get();
+
+		const size_t weightCount = (size_t) l->nodeCount * l->prevNodeCount;
+
+		l->storage = layout.storage;
+
+		if (layout.storage == storageType::float32)
+		{
+			l->weights = loadFloats(ptr + layout.weightOffsets[i], weightCount, layout.reverse);
+		}
+		else
+		{
+			l->halfWeights = loadHalves(ptr + layout.weightOffsets[i], weightCount, layout.reverse);
+		}
+
+		l->biases = loadFloats(ptr + layout.biasOffsets[i], l->nodeCount, layout.reverse);
+	}
+
+
+	return n1;
+
+}
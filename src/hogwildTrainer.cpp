@@ -0,0 +1,73 @@
+#include "../include/nnet.hpp"
+#include "threadPool.hpp"
+#include "replica.hpp"
+
+#include <algorithm>
+
+
+nnet::hogwildTrainer::hogwildTrainer (neural &network, int threadCount)
+: m_network {network},
+	m_pool {new threadPool(threadCount)}
+{
+	splitReplicas();
+}
+
+
+void nnet::hogwildTrainer::splitReplicas ()
+{
+
+	m_ownedReplicas.clear();
+	m_replicas.assign(1, &m_network);
+
+	for (int i = 1; i < m_pool->getThreadCount(); ++i)
+	{
+		m_ownedReplicas.emplace_back(m_network.split());
+		m_replicas.push_back(m_ownedReplicas.back().get());
+	}
+
+}
+
+// defined here, where threadPool is a complete type
+nnet::hogwildTrainer::~hogwildTrainer () = default;
+
+
+int nnet::hogwildTrainer::getThreadCount ()
+{
+	return m_pool->getThreadCount();
+}
+
+
+void nnet::hogwildTrainer::train (const float* inputs, const float* ideals, size_t count, float learningRate)
+{
+
+	if (count == 0) return;
+
+	// a replica left training the network's old parameters would have its updates silently dropped
+	for (size_t r = 1; r < m_replicas.size(); ++r)
+	{
+		if (!replicaMatches(m_network, *m_replicas[r]))
+		{
+			splitReplicas();
+			break;
+		}
+	}
+
+	const size_t inputCount = m_network.inputLayer->nodeCount;
+	const size_t outputCount = m_network.outputLayer->nodeCount;
+
+	const int threadCount = (int) std::min<size_t>(m_replicas.size(), count);
+
+	// no barrier between samples, each thread writes its updates into the shared parameters as soon as it has them
+	m_pool->parallelFor(threadCount, [&] (int t)
+	{
+		neural &replica = *m_replicas.at(t);
+
+		for (size_t i = t; i < count; i += threadCount)
+		{
+			replica.setInput(inputs + i * inputCount, inputCount);
+			replica.calculate();
+			replica.backprop(false, learningRate, ideals + i * outputCount, outputCount);
+		}
+	});
+
+}
@@ -0,0 +1,220 @@
+#include "../include/nnet.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+nnet::incrementalEvaluator::incrementalEvaluator (const neural &network)
+: m_network {network},
+	m_inputCount {network.inputLayer->nodeCount},
+	m_nodeCount {network.layers.at(1)->nodeCount},
+	m_input (m_inputCount, 0),
+	m_context {network}
+{
+	refresh();
+}
+
+
+void nnet::incrementalEvaluator::refresh ()
+{
+
+	const layer &first = *m_network.layers.at(1);
+
+	m_columns.resize((size_t) m_inputCount * m_nodeCount);
+	m_biases.assign(first.biases.get(), first.biases.get() + m_nodeCount);
+
+	// one row at a time, converted from whatever the storage type is, then scattered into the columns
+	std::vector<float> row(m_inputCount);
+
+	for (int i = 0; i < m_nodeCount; ++i)
+	{
+		first.loadWeights((size_t) i * m_inputCount, m_inputCount, row.data());
+
+		for (int j = 0; j < m_inputCount; ++j)
+		{
+			m_columns[(size_t) j * m_nodeCount + i] = row[j];
+		}
+	}
+
+	// the saved states were built from the old weights, so they can't be gone back to
+	m_undo.clear();
+	m_marks.clear();
+
+	std::vector<float> input = m_input;
+	setInput(input.data());
+
+}
+
+
+float* nnet::incrementalEvaluator::currentSums ()
+{
+	return m_sums.data() + m_marks.size() * m_nodeCount;
+}
+
+
+void nnet::incrementalEvaluator::setInput (const float* input)
+{
+
+	const kernels::table &k = kernels::get();
+
+	// the saved states stay valid, since undoing a setInput() is just undoing a setValue() for each input that changed
+	for (int j = 0; j < m_inputCount; ++j)
+	{
+		if (!m_marks.empty() && input[j] != m_input[j]) m_undo.push_back({j, m_input[j]});
+
+		m_input[j] = input[j];
+	}
+
+	m_sums.resize((m_marks.size() + 1) * m_nodeCount);
+
+	float* sums = currentSums();
+	std::memcpy(sums, m_biases.data(), m_nodeCount * sizeof(float));
+
+	// inputs of 0 add nothing, which skips most of them for sparse (e.g. one-hot) inputs
+	for (int j = 0; j < m_inputCount; ++j)
+	{
+		if (m_input[j] != 0) k.axpy(sums, m_input[j], m_columns.data() + (size_t) j * m_nodeCount, m_nodeCount);
+	}
+
+}
+
+
+void nnet::incrementalEvaluator::setValue (int index, float value)
+{
+
+	if (index < 0 || index >= m_inputCount)
+	{
+		throw nnet::usageError("input index " + std::to_string(index) + " is out of range, the network has " + std::to_string(m_inputCount) + " inputs");
+	}
+
+	const float old = m_input[index];
+
+	if (value == old) return;
+
+	if (!m_marks.empty()) m_undo.push_back({index, old});
+
+	m_input[index] = value;
+
+	kernels::get().axpy(currentSums(), value - old, m_columns.data() + (size_t) index * m_nodeCount, m_nodeCount);
+
+}
+
+
+float nnet::incrementalEvaluator::getValue (int index) const
+{
+	return m_input.at(index);
+}
+
+const float* nnet::incrementalEvaluator::getInput () const
+{
+	return m_input.data();
+}
+
+
+void nnet::incrementalEvaluator::push ()
+{
+
+	m_marks.push_back(m_undo.size());
+
+	// the new state starts as a copy of the old one, which stays untouched for pop() to go back to
+	m_sums.resize((m_marks.size() + 1) * m_nodeCount);
+
+	float* sums = currentSums();
+	std::memcpy(sums, sums - m_nodeCount, m_nodeCount * sizeof(float));
+
+}
+
+
+void nnet::incrementalEvaluator::pop ()
+{
+
+	if (m_marks.empty())
+	{
+		throw nnet::usageError("pop() without a matching push()");
+	}
+
+	const size_t mark = m_marks.back();
+
+	// newest first, so an input changed more than once ends up at its value from before the first change
+	for (size_t i = m_undo.size(); i > mark; --i)
+	{
+		m_input[m_undo[i - 1].index] = m_undo[i - 1].value;
+	}
+
+	m_undo.resize(mark);
+	m_marks.pop_back();
+
+}
+
+
+size_t nnet::incrementalEvaluator::getDepth () const
+{
+	return m_marks.size();
+}
+
+
+void nnet::incrementalEvaluator::calculate (float* output)
+{
+
+	const kernels::table &k = kernels::get();
+
+	const size_t layerCount = m_network.layers.size();
+
+	// the first layer's values go straight to the output if it's the only layer
+	float* first = output;
+
+	if (layerCount > 2)
+	{
+		std::vector<float> &buf = m_context.buffers[1];
+		if (buf.size() < (size_t) m_nodeCount) buf.resize(m_nodeCount);
+		first = buf.data();
+	}
+
+	std::memcpy(first, currentSums(), m_nodeCount * sizeof(float));
+	k.activate(first, m_nodeCount);
+
+	// then as in neural::calculate()
+	const float* in = first;
+
+	for (size_t i = 2; i < layerCount; ++i)
+	{
+		const layer &l = *m_network.layers.at(i);
+
+		float* out = output;
+
+		if (i != layerCount - 1)
+		{
+			std::vector<float> &buf = m_context.buffers[i % 2];
+			if (buf.size() < (size_t) l.nodeCount) buf.resize(l.nodeCount);
+			out = buf.data();
+		}
+
+		l.calculate(in, out);
+
+		in = out;
+	}
+
+}
+
+
+int nnet::incrementalEvaluator::selectOutputFixed ()
+{
+
+	m_output.resize(getOutputCount());
+	calculate(m_output.data());
+
+	return std::max_element(m_output.begin(), m_output.end()) - m_output.begin();
+
+}
+
+
+int nnet::incrementalEvaluator::getInputCount () const
+{
+	return m_inputCount;
+}
+
+int nnet::incrementalEvaluator::getOutputCount () const
+{
+	return m_network.outputLayer->nodeCount;
+}
@@ -0,0 +1,350 @@
+#include "kernels.hpp"
+
+
+////// scalar implementations, used when no vector instruction set is available
+
+static float dotScalar (const float* a, const float* b, size_t n)
+{
+	float sum = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		sum += a[i] * b[i];
+	}
+
+	return sum;
+}
+
+static void dot4Scalar (const float* a, const float* b0, const float* b1, const float* b2, const float* b3, size_t n, float* out)
+{
+	float sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		sum0 += a[i] * b0[i];
+		sum1 += a[i] * b1[i];
+		sum2 += a[i] * b2[i];
+		sum3 += a[i] * b3[i];
+	}
+
+	out[0] = sum0;
+	out[1] = sum1;
+	out[2] = sum2;
+	out[3] = sum3;
+}
+
+static void axpyScalar (float* y, float a, const float* x, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		y[i] += a * x[i];
+	}
+}
+
+static void axpy4Scalar (float* y, const float* a, const float* x0, const float* x1, const float* x2, const float* x3, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		y[i] += a[0] * x0[i] + a[1] * x1[i] + a[2] * x2[i] + a[3] * x3[i];
+	}
+}
+
+static float dotGatherScalar (const float* a, const int* indexes, const float* b, size_t n)
+{
+	float sum = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		sum += a[i] * b[indexes[i]];
+	}
+
+	return sum;
+}
+
+static void axpyGatherScalar (float* y, float a, const int* indexes, const float* x, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		y[i] += a * x[indexes[i]];
+	}
+}
+
+static void axpyScatterScalar (float* y, const int* indexes, float a, const float* x, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		y[indexes[i]] += a * x[i];
+	}
+}
+
+static void activateScalar (float* x, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		x[i] = nnet::kernels::tanhApprox(x[i]);
+	}
+}
+
+static void mulActivationDerivativeScalar (float* d, const float* values, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		d[i] *= nnet::kernels::activationDerivative(values[i]);
+	}
+}
+
+static void applyNudgesScalar (float* w, float* nudges, float scale, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		w[i] += nudges[i] * scale;
+		nudges[i] = 0;
+	}
+}
+
+
+static void applyMomentumScalar (float* w, float* velocity, float* nudges, float scale, float momentum, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		nnet::kernels::momentumStep(w[i], velocity[i], nudges[i], scale, momentum);
+	}
+}
+
+static void applyRMSPropScalar (float* w, float* meanSquare, float* nudges, float scale, float decay, float stepSize, float epsilon, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		nnet::kernels::rmspropStep(w[i], meanSquare[i], nudges[i], scale, decay, stepSize, epsilon);
+	}
+}
+
+static void applyAdamScalar (float* w, float* mean, float* meanSquare, float* nudges, float scale, float beta1, float beta2, float stepSize, float epsilon, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		nnet::kernels::adamStep(w[i], mean[i], meanSquare[i], nudges[i], scale, beta1, beta2, stepSize, epsilon);
+	}
+}
+
+
+static int32_t dotInt8Scalar (const int8_t* a, const int8_t* b, size_t n)
+{
+	int32_t sum = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		sum += (int32_t) a[i] * b[i];
+	}
+
+	return sum;
+}
+
+static float dotF16Scalar (const uint16_t* a, const float* b, size_t n)
+{
+	float sum = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		sum += nnet::kernels::halfToFloat(a[i]) * b[i];
+	}
+
+	return sum;
+}
+
+static float dotBF16Scalar (const uint16_t* a, const float* b, size_t n)
+{
+	float sum = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		sum += nnet::kernels::bfloat16ToFloat(a[i]) * b[i];
+	}
+
+	return sum;
+}
+
+static void f16ToFloatScalar (const uint16_t* src, float* dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::halfToFloat(src[i]);
+	}
+}
+
+static void floatToF16Scalar (const float* src, uint16_t* dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::floatToHalf(src[i]);
+	}
+}
+
+static void bf16ToFloatScalar (const uint16_t* src, float* dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::bfloat16ToFloat(src[i]);
+	}
+}
+
+static void floatToBF16Scalar (const float* src, uint16_t* dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::floatToBfloat16(src[i]);
+	}
+}
+
+
+void nnet::kernels::fillScalar (table &t)
+{
+	t.dot = dotScalar;
+	t.dot4 = dot4Scalar;
+	t.axpy = axpyScalar;
+	t.axpy4 = axpy4Scalar;
+	t.dotGather = dotGatherScalar;
+	t.axpyGather = axpyGatherScalar;
+	t.axpyScatter = axpyScatterScalar;
+	t.activate = activateScalar;
+	t.mulActivationDerivative = mulActivationDerivativeScalar;
+	t.applyNudges = applyNudgesScalar;
+	t.applyMomentum = applyMomentumScalar;
+	t.applyRMSProp = applyRMSPropScalar;
+	t.applyAdam = applyAdamScalar;
+	t.dotInt8 = dotInt8Scalar;
+	t.dotF16 = dotF16Scalar;
+	t.dotBF16 = dotBF16Scalar;
+	t.f16ToFloat = f16ToFloatScalar;
+	t.floatToF16 = floatToF16Scalar;
+	t.bf16ToFloat = bf16ToFloatScalar;
+	t.floatToBF16 = floatToBF16Scalar;
+}
+
+
+
+////// runtime dispatch
+
+static bool cpuSupports (nnet::simdLevel level)
+{
+
+#if defined(__x86_64__) || defined(__i386__)
+
+	__builtin_cpu_init();
+
+	switch (level)
+	{
+		case nnet::simdLevel::scalar:
+			return true;
+
+		case nnet::simdLevel::sse2:
+			return __builtin_cpu_supports("sse2");
+
+		// F16C is used for the float16 conversions, every AVX2 CPU has it
+		case nnet::simdLevel::avx2:
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+
+		// the avx512 table is built on top of the avx2 one
+		case nnet::simdLevel::avx512:
+			return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl") && cpuSupports(nnet::simdLevel::avx2);
+	}
+
+	return false;
+
+#else
+
+	return level == nnet::simdLevel::scalar;
+
+#endif
+
+}
+
+// fill in t for level, returns false if this build doesn't have that implementation
+// each level starts from the table of the level below it, so it only has to provide the kernels it actually speeds up
+static bool fillTable (nnet::kernels::table &t, nnet::simdLevel level)
+{
+
+	switch (level)
+	{
+		case nnet::simdLevel::scalar:
+			nnet::kernels::fillScalar(t);
+			return true;
+
+		case nnet::simdLevel::sse2:
+			return fillTable(t, nnet::simdLevel::scalar) && nnet::kernels::fillSSE2(t);
+
+		case nnet::simdLevel::avx2:
+			return fillTable(t, nnet::simdLevel::sse2) && nnet::kernels::fillAVX2(t);
+
+		case nnet::simdLevel::avx512:
+			return fillTable(t, nnet::simdLevel::avx2) && nnet::kernels::fillAVX512(t);
+	}
+
+	return false;
+
+}
+
+
+static nnet::simdLevel currentLevel;
+static nnet::kernels::table currentTable;
+
+// selects the widest available level the first time the kernels are used
+static bool initDispatch ()
+{
+	currentLevel = nnet::detectSimdLevel();
+	fillTable(currentTable, currentLevel);
+	return true;
+}
+
+const nnet::kernels::table& nnet::kernels::get ()
+{
+	static bool initialized = initDispatch();
+	(void) initialized;
+
+	return currentTable;
+}
+
+
+bool nnet::isSimdLevelSupported (simdLevel level)
+{
+	kernels::table t;
+	return cpuSupports(level) && fillTable(t, level);
+}
+
+nnet::simdLevel nnet::detectSimdLevel ()
+{
+
+	const simdLevel levels[] = {simdLevel::avx512, simdLevel::avx2, simdLevel::sse2};
+
+	for (simdLevel level: levels)
+	{
+		if (isSimdLevelSupported(level)) return level;
+	}
+
+	return simdLevel::scalar;
+
+}
+
+nnet::simdLevel nnet::getSimdLevel ()
+{
+	kernels::get();
+	return currentLevel;
+}
+
+void nnet::setSimdLevel (simdLevel level)
+{
+
+	// make sure the automatic selection has already happened, so it can't override this one later
+	kernels::get();
+
+	kernels::table t;
+
+	if (!cpuSupports(level) || !fillTable(t, level))
+	{
+		throw nnet::usageError("requested SIMD level is not supported on this machine");
+	}
+
+	currentTable = t;
+	currentLevel = level;
+
+}
@@ -0,0 +1,226 @@
+// internal header, not part of the public interface
+// these are the inner loops of the library, with one implementation per instruction set
+
+
+#ifndef NNET_KERNELS_HPP
+#define NNET_KERNELS_HPP
+
+#include "../include/nnet.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+
+namespace nnet
+{
+	namespace kernels
+	{
+
+		struct table
+		{
+			// returns the sum of a[i] * b[i]
+			float (*dot) (const float* a, const float* b, size_t n);
+
+			// out[s] = sum of a[i] * b_s[i] for the four vectors b0..b3, reusing each load of a
+			void (*dot4) (const float* a, const float* b0, const float* b1, const float* b2, const float* b3, size_t n, float* out);
+
+			// y[i] += a * x[i]
+			void (*axpy) (float* y, float a, const float* x, size_t n);
+
+			// y[i] += a0 * x0[i] + a1 * x1[i] + a2 * x2[i] + a3 * x3[i]
+			void (*axpy4) (float* y, const float* a, const float* x0, const float* x1, const float* x2, const float* x3, size_t n);
+
+			// the same with one side indexed, for sparse weights and sparse inputs
+			// returns the sum of a[i] * b[indexes[i]]
+			float (*dotGather) (const float* a, const int* indexes, const float* b, size_t n);
+			// y[i] += a * x[indexes[i]]
+			void (*axpyGather) (float* y, float a, const int* indexes, const float* x, size_t n);
+			// y[indexes[i]] += a * x[i], the indexes must all be different
+			void (*axpyScatter) (float* y, const int* indexes, float a, const float* x, size_t n);
+
+			// x[i] = tanh(x[i])
+			void (*activate) (float* x, size_t n);
+
+			// d[i] *= derivative of the activation function, given the activated values
+			void (*mulActivationDerivative) (float* d, const float* values, size_t n);
+
+			// w[i] += nudges[i] * scale, then nudges[i] = 0
+			void (*applyNudges) (float* w, float* nudges, float scale, size_t n);
+
+			// the same for the other optimizers, updating their per-parameter state in the same pass
+			// see momentumStep(), rmspropStep() and adamStep() below for what each one does to a single parameter
+			void (*applyMomentum) (float* w, float* velocity, float* nudges, float scale, float momentum, size_t n);
+			void (*applyRMSProp) (float* w, float* meanSquare, float* nudges, float scale, float decay, float stepSize, float epsilon, size_t n);
+			void (*applyAdam) (float* w, float* mean, float* meanSquare, float* nudges, float scale, float beta1, float beta2, float stepSize, float epsilon, size_t n);
+
+			// returns the sum of a[i] * b[i] for int8 vectors, for quantizedNetwork
+			// values must be in [-127, 127]
+			int32_t (*dotInt8) (const int8_t* a, const int8_t* b, size_t n);
+
+			// dot products with a converted to float on the fly, for half-precision weight storage
+			float (*dotF16) (const uint16_t* a, const float* b, size_t n);
+			float (*dotBF16) (const uint16_t* a, const float* b, size_t n);
+
+			// conversions between float and the half-precision storage types, rounding to nearest even
+			void (*f16ToFloat) (const uint16_t* src, float* dst, size_t n);
+			void (*floatToF16) (const float* src, uint16_t* dst, size_t n);
+			void (*bf16ToFloat) (const uint16_t* src, float* dst, size_t n);
+			void (*floatToBF16) (const float* src, uint16_t* dst, size_t n);
+		};
+
+		// the table for the currently selected simdLevel
+		const table& get ();
+
+
+		// the implementation for each instruction set fills in the table, on top of the one for the level below
+		// these return false if the library was built for a platform without that instruction set
+		void fillScalar (table &t);
+		bool fillSSE2 (table &t);
+		bool fillAVX2 (table &t);
+		bool fillAVX512 (table &t);
+
+
+
+		// the scalar tanh lives in nnet_activation.hpp, so that header-only code can share it
+		using activation::tanhApprox;
+		using activation::tanhClamp;
+		using activation::expLog2e;
+		using activation::expLn2Hi;
+		using activation::expLn2Lo;
+		using activation::expP0;
+		using activation::expP1;
+		using activation::expP2;
+		using activation::expP3;
+		using activation::expP4;
+		using activation::expP5;
+
+		// single-parameter optimizer updates
+		// the vector implementations call these for leftover elements
+		// the nudge is -learningRate * gradient (summed over a batch, hence the scale), so every update adds to w
+
+		inline void momentumStep (float &w, float &velocity, float &nudge, float scale, float momentum)
+		{
+			velocity = momentum * velocity + nudge * scale;
+			w += velocity;
+			nudge = 0;
+		}
+
+		// dividing by the root mean square cancels out the learning rate, so the step size is set separately
+		inline void rmspropStep (float &w, float &meanSquare, float &nudge, float scale, float decay, float stepSize, float epsilon)
+		{
+			const float u = nudge * scale;
+			meanSquare = decay * meanSquare + (1 - decay) * u * u;
+			w += stepSize * u / (std::sqrt(meanSquare) + epsilon);
+			nudge = 0;
+		}
+
+		// stepSize already includes the bias correction for this step
+		inline void adamStep (float &w, float &mean, float &meanSquare, float &nudge, float scale, float beta1, float beta2, float stepSize, float epsilon)
+		{
+			const float u = nudge * scale;
+			mean = beta1 * mean + (1 - beta1) * u;
+			meanSquare = beta2 * meanSquare + (1 - beta2) * u * u;
+			w += stepSize * mean / (std::sqrt(meanSquare) + epsilon);
+			nudge = 0;
+		}
+
+
+		// tanh'(x) = 1 - tanh(x)^2, so the derivative can be taken straight from the activated value
+		inline float activationDerivative (float value)
+		{
+			return 1 - value * value;
+		}
+
+
+
+		// scalar conversions for the half-precision storage types
+		// the vector implementations call these for leftover elements
+
+		inline uint32_t floatBits (float f)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &f, sizeof(float));
+			return bits;
+		}
+
+		inline float bitsFloat (uint32_t bits)
+		{
+			float f;
+			std::memcpy(&f, &bits, sizeof(float));
+			return f;
+		}
+
+		// IEEE binary16, including subnormals, infinities and NaN
+		inline float halfToFloat (uint16_t h)
+		{
+			const uint32_t shiftedExp = 0x7C00u << 13;
+
+			uint32_t bits = (h & 0x7FFFu) << 13;
+			const uint32_t exp = bits & shiftedExp;
+
+			bits += (127 - 15) << 23;
+
+			if (exp == shiftedExp)
+			{
+				// infinity or NaN
+				bits += (128 - 16) << 23;
+			}
+			else if (exp == 0)
+			{
+				// zero or subnormal, renormalize with a float subtraction
+				bits += 1 << 23;
+				bits = floatBits(bitsFloat(bits) - bitsFloat(113u << 23));
+			}
+
+			return bitsFloat(bits | (uint32_t) (h & 0x8000u) << 16);
+		}
+
+		inline uint16_t floatToHalf (float f)
+		{
+			uint32_t bits = floatBits(f);
+
+			const uint32_t sign = bits & 0x80000000u;
+			bits ^= sign;
+
+			uint16_t h;
+
+			if (bits >= (127u + 16) << 23)
+			{
+				// too big for a half, or infinity or NaN
+				h = bits > 255u << 23 ? 0x7E00 : 0x7C00;
+			}
+			else if (bits < 113u << 23)
+			{
+				// subnormal or zero, let float addition do the rounding
+				const uint32_t magic = ((127 - 15) + (23 - 10) + 1) << 23;
+				h = floatBits(bitsFloat(bits) + bitsFloat(magic)) - magic;
+			}
+			else
+			{
+				const uint32_t mantissaOdd = (bits >> 13) & 1;
+				bits += ((uint32_t) (15 - 127) << 23) + 0xFFF + mantissaOdd;
+				h = bits >> 13;
+			}
+
+			return h | sign >> 16;
+		}
+
+		// bfloat16 is just the top half of a float
+		inline float bfloat16ToFloat (uint16_t h)
+		{
+			return bitsFloat((uint32_t) h << 16);
+		}
+
+		inline uint16_t floatToBfloat16 (float f)
+		{
+			const uint32_t bits = floatBits(f);
+			return (bits + 0x7FFF + ((bits >> 16) & 1)) >> 16;
+		}
+
+	}
+}
+
+
+#endif
@@ -0,0 +1,546 @@
+#include "kernels.hpp"
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define NNET_TARGET __attribute__((target("avx2,fma,f16c")))
+
+
+NNET_TARGET static inline float hsum (__m256 v)
+{
+	__m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuf = _mm_movehdup_ps(lo);
+	__m128 sums = _mm_add_ps(lo, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+
+NNET_TARGET static float dotAVX2 (const float* a, const float* b, size_t n)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32)
+	{
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+		acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+		acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+	}
+
+	for (; i + 8 <= n; i += 8)
+	{
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+	}
+
+	float sum = hsum(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+
+	for (; i < n; ++i)
+	{
+		sum += a[i] * b[i];
+	}
+
+	return sum;
+}
+
+NNET_TARGET static void dot4AVX2 (const float* a, const float* b0, const float* b1, const float* b2, const float* b3, size_t n, float* out)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256 va = _mm256_loadu_ps(a + i);
+		acc0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b0 + i), acc0);
+		acc1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b1 + i), acc1);
+		acc2 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b2 + i), acc2);
+		acc3 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b3 + i), acc3);
+	}
+
+	float sum0 = hsum(acc0), sum1 = hsum(acc1), sum2 = hsum(acc2), sum3 = hsum(acc3);
+
+	for (; i < n; ++i)
+	{
+		sum0 += a[i] * b0[i];
+		sum1 += a[i] * b1[i];
+		sum2 += a[i] * b2[i];
+		sum3 += a[i] * b3[i];
+	}
+
+	out[0] = sum0;
+	out[1] = sum1;
+	out[2] = sum2;
+	out[3] = sum3;
+}
+
+NNET_TARGET static void axpyAVX2 (float* y, float a, const float* x, size_t n)
+{
+	const __m256 va = _mm256_set1_ps(a);
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+	}
+
+	for (; i < n; ++i)
+	{
+		y[i] += a * x[i];
+	}
+}
+
+// there's no scatter before AVX-512, so axpyScatter stays scalar at this level
+NNET_TARGET static float dotGatherAVX2 (const float* a, const int* indexes, const float* b, size_t n)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m256 b0 = _mm256_i32gather_ps(b, _mm256_loadu_si256((const __m256i*) (indexes + i)), 4);
+		const __m256 b1 = _mm256_i32gather_ps(b, _mm256_loadu_si256((const __m256i*) (indexes + i + 8)), 4);
+
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), b0, acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), b1, acc1);
+	}
+
+	float sum = hsum(_mm256_add_ps(acc0, acc1));
+
+	for (; i < n; ++i)
+	{
+		sum += a[i] * b[indexes[i]];
+	}
+
+	return sum;
+}
+
+NNET_TARGET static void axpyGatherAVX2 (float* y, float a, const int* indexes, const float* x, size_t n)
+{
+	const __m256 va = _mm256_set1_ps(a);
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256 xi = _mm256_i32gather_ps(x, _mm256_loadu_si256((const __m256i*) (indexes + i)), 4);
+
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, xi, _mm256_loadu_ps(y + i)));
+	}
+
+	for (; i < n; ++i)
+	{
+		y[i] += a * x[indexes[i]];
+	}
+}
+
+NNET_TARGET static void axpy4AVX2 (float* y, const float* a, const float* x0, const float* x1, const float* x2, const float* x3, size_t n)
+{
+	const __m256 a0 = _mm256_set1_ps(a[0]);
+	const __m256 a1 = _mm256_set1_ps(a[1]);
+	const __m256 a2 = _mm256_set1_ps(a[2]);
+	const __m256 a3 = _mm256_set1_ps(a[3]);
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 sum = _mm256_fmadd_ps(a0, _mm256_loadu_ps(x0 + i), _mm256_loadu_ps(y + i));
+		sum = _mm256_fmadd_ps(a1, _mm256_loadu_ps(x1 + i), sum);
+		sum = _mm256_fmadd_ps(a2, _mm256_loadu_ps(x2 + i), sum);
+		sum = _mm256_fmadd_ps(a3, _mm256_loadu_ps(x3 + i), sum);
+		_mm256_storeu_ps(y + i, sum);
+	}
+
+	for (; i < n; ++i)
+	{
+		y[i] += a[0] * x0[i] + a[1] * x1[i] + a[2] * x2[i] + a[3] * x3[i];
+	}
+}
+
+
+// see nnet::kernels::tanhApprox() for the scalar version of this
+NNET_TARGET static inline __m256 tanhAVX2 (__m256 x)
+{
+	using namespace nnet::kernels;
+
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+	const __m256 sign = _mm256_and_ps(x, signMask);
+	// min returns its second operand if either is NaN, so NaN carries on through and comes out as NaN
+	const __m256 a = _mm256_min_ps(_mm256_set1_ps(tanhClamp), _mm256_andnot_ps(signMask, x));
+
+	const __m256 y = _mm256_add_ps(a, a);
+	const __m256 n = _mm256_round_ps(_mm256_mul_ps(y, _mm256_set1_ps(expLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	const __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(expLn2Lo), _mm256_fnmadd_ps(n, _mm256_set1_ps(expLn2Hi), y));
+
+	__m256 p = _mm256_set1_ps(expP0);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP1));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP2));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP3));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP4));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expP5));
+	p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, _mm256_set1_ps(1)));
+
+	const __m256i ni = _mm256_cvtps_epi32(n);
+	const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(ni, _mm256_set1_epi32(127)), 23));
+
+	const __m256 one = _mm256_set1_ps(1);
+	const __m256 t = _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2), _mm256_fmadd_ps(p, scale, one)));
+
+	return _mm256_or_ps(t, sign);
+}
+
+NNET_TARGET static void activateAVX2 (float* x, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_ps(x + i, tanhAVX2(_mm256_loadu_ps(x + i)));
+	}
+
+	for (; i < n; ++i)
+	{
+		x[i] = nnet::kernels::tanhApprox(x[i]);
+	}
+}
+
+NNET_TARGET static void mulActivationDerivativeAVX2 (float* d, const float* values, size_t n)
+{
+	const __m256 one = _mm256_set1_ps(1);
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256 v = _mm256_loadu_ps(values + i);
+		_mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_loadu_ps(d + i), _mm256_fnmadd_ps(v, v, one)));
+	}
+
+	for (; i < n; ++i)
+	{
+		d[i] *= nnet::kernels::activationDerivative(values[i]);
+	}
+}
+
+NNET_TARGET static void applyNudgesAVX2 (float* w, float* nudges, float scale, size_t n)
+{
+	const __m256 vs = _mm256_set1_ps(scale);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_ps(w + i, _mm256_fmadd_ps(_mm256_loadu_ps(nudges + i), vs, _mm256_loadu_ps(w + i)));
+		_mm256_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		w[i] += nudges[i] * scale;
+		nudges[i] = 0;
+	}
+}
+
+NNET_TARGET static void applyMomentumAVX2 (float* w, float* velocity, float* nudges, float scale, float momentum, size_t n)
+{
+	const __m256 vs = _mm256_set1_ps(scale);
+	const __m256 vm = _mm256_set1_ps(momentum);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256 v = _mm256_fmadd_ps(vm, _mm256_loadu_ps(velocity + i), _mm256_mul_ps(_mm256_loadu_ps(nudges + i), vs));
+
+		_mm256_storeu_ps(velocity + i, v);
+		_mm256_storeu_ps(w + i, _mm256_add_ps(_mm256_loadu_ps(w + i), v));
+		_mm256_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		nnet::kernels::momentumStep(w[i], velocity[i], nudges[i], scale, momentum);
+	}
+}
+
+NNET_TARGET static void applyRMSPropAVX2 (float* w, float* meanSquare, float* nudges, float scale, float decay, float stepSize, float epsilon, size_t n)
+{
+	const __m256 vs = _mm256_set1_ps(scale);
+	const __m256 vd = _mm256_set1_ps(decay);
+	const __m256 vd1 = _mm256_set1_ps(1 - decay);
+	const __m256 vstep = _mm256_set1_ps(stepSize);
+	const __m256 veps = _mm256_set1_ps(epsilon);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256 u = _mm256_mul_ps(_mm256_loadu_ps(nudges + i), vs);
+		const __m256 ms = _mm256_fmadd_ps(vd, _mm256_loadu_ps(meanSquare + i), _mm256_mul_ps(_mm256_mul_ps(vd1, u), u));
+		const __m256 step = _mm256_div_ps(_mm256_mul_ps(vstep, u), _mm256_add_ps(_mm256_sqrt_ps(ms), veps));
+
+		_mm256_storeu_ps(meanSquare + i, ms);
+		_mm256_storeu_ps(w + i, _mm256_add_ps(_mm256_loadu_ps(w + i), step));
+		_mm256_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		nnet::kernels::rmspropStep(w[i], meanSquare[i], nudges[i], scale, decay, stepSize, epsilon);
+	}
+}
+
+NNET_TARGET static void applyAdamAVX2 (float* w, float* mean, float* meanSquare, float* nudges, float scale, float beta1, float beta2, float stepSize, float epsilon, size_t n)
+{
+	const __m256 vs = _mm256_set1_ps(scale);
+	const __m256 vb1 = _mm256_set1_ps(beta1);
+	const __m256 vb11 = _mm256_set1_ps(1 - beta1);
+	const __m256 vb2 = _mm256_set1_ps(beta2);
+	const __m256 vb21 = _mm256_set1_ps(1 - beta2);
+	const __m256 vstep = _mm256_set1_ps(stepSize);
+	const __m256 veps = _mm256_set1_ps(epsilon);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256 u = _mm256_mul_ps(_mm256_loadu_ps(nudges + i), vs);
+		const __m256 m = _mm256_fmadd_ps(vb1, _mm256_loadu_ps(mean + i), _mm256_mul_ps(vb11, u));
+		const __m256 ms = _mm256_fmadd_ps(vb2, _mm256_loadu_ps(meanSquare + i), _mm256_mul_ps(_mm256_mul_ps(vb21, u), u));
+		const __m256 step = _mm256_div_ps(_mm256_mul_ps(vstep, m), _mm256_add_ps(_mm256_sqrt_ps(ms), veps));
+
+		_mm256_storeu_ps(mean + i, m);
+		_mm256_storeu_ps(meanSquare + i, ms);
+		_mm256_storeu_ps(w + i, _mm256_add_ps(_mm256_loadu_ps(w + i), step));
+		_mm256_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		nnet::kernels::adamStep(w[i], mean[i], meanSquare[i], nudges[i], scale, beta1, beta2, stepSize, epsilon);
+	}
+}
+
+
+NNET_TARGET static int32_t dotInt8AVX2 (const int8_t* a, const int8_t* b, size_t n)
+{
+	// widen to int16, then madd sums adjacent pairs of products into int32
+	__m256i acc = _mm256_setzero_si256();
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (a + i)));
+		const __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (b + i)));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+	}
+
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	int32_t result = _mm_cvtsi128_si32(sum);
+
+	for (; i < n; ++i)
+	{
+		result += (int32_t) a[i] * b[i];
+	}
+
+	return result;
+}
+
+
+NNET_TARGET static inline __m256 loadF16 (const uint16_t* p)
+{
+	return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) p));
+}
+
+NNET_TARGET static inline __m256 loadBF16 (const uint16_t* p)
+{
+	return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) p)), 16));
+}
+
+NNET_TARGET static float dotF16AVX2 (const uint16_t* a, const float* b, size_t n)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		acc0 = _mm256_fmadd_ps(loadF16(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(loadF16(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+	}
+
+	for (; i + 8 <= n; i += 8)
+	{
+		acc0 = _mm256_fmadd_ps(loadF16(a + i), _mm256_loadu_ps(b + i), acc0);
+	}
+
+	float sum = hsum(_mm256_add_ps(acc0, acc1));
+
+	for (; i < n; ++i)
+	{
+		sum += nnet::kernels::halfToFloat(a[i]) * b[i];
+	}
+
+	return sum;
+}
+
+NNET_TARGET static float dotBF16AVX2 (const uint16_t* a, const float* b, size_t n)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		acc0 = _mm256_fmadd_ps(loadBF16(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(loadBF16(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+	}
+
+	for (; i + 8 <= n; i += 8)
+	{
+		acc0 = _mm256_fmadd_ps(loadBF16(a + i), _mm256_loadu_ps(b + i), acc0);
+	}
+
+	float sum = hsum(_mm256_add_ps(acc0, acc1));
+
+	for (; i < n; ++i)
+	{
+		sum += nnet::kernels::bfloat16ToFloat(a[i]) * b[i];
+	}
+
+	return sum;
+}
+
+NNET_TARGET static void f16ToFloatAVX2 (const uint16_t* src, float* dst, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_ps(dst + i, loadF16(src + i));
+	}
+
+	for (; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::halfToFloat(src[i]);
+	}
+}
+
+NNET_TARGET static void floatToF16AVX2 (const float* src, uint16_t* dst, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm_storeu_si128((__m128i*) (dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+	}
+
+	for (; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::floatToHalf(src[i]);
+	}
+}
+
+NNET_TARGET static void bf16ToFloatAVX2 (const uint16_t* src, float* dst, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm256_storeu_ps(dst + i, loadBF16(src + i));
+	}
+
+	for (; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::bfloat16ToFloat(src[i]);
+	}
+}
+
+NNET_TARGET static void floatToBF16AVX2 (const float* src, uint16_t* dst, size_t n)
+{
+	const __m256i bias = _mm256_set1_epi32(0x7FFF);
+	const __m256i one = _mm256_set1_epi32(1);
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		// round to nearest even, the same way as floatToBfloat16()
+		__m256i lo = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+		__m256i hi = _mm256_castps_si256(_mm256_loadu_ps(src + i + 8));
+
+		lo = _mm256_srli_epi32(_mm256_add_epi32(lo, _mm256_add_epi32(bias, _mm256_and_si256(_mm256_srli_epi32(lo, 16), one))), 16);
+		hi = _mm256_srli_epi32(_mm256_add_epi32(hi, _mm256_add_epi32(bias, _mm256_and_si256(_mm256_srli_epi32(hi, 16), one))), 16);
+
+		// packus works within 128-bit lanes, so put the lanes back in order afterwards
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*) (dst + i), packed);
+	}
+
+	for (; i < n; ++i)
+	{
+		dst[i] = nnet::kernels::floatToBfloat16(src[i]);
+	}
+}
+
+
+bool nnet::kernels::fillAVX2 (table &t)
+{
+	t.dot = dotAVX2;
+	t.dot4 = dot4AVX2;
+	t.axpy = axpyAVX2;
+	t.axpy4 = axpy4AVX2;
+	t.dotGather = dotGatherAVX2;
+	t.axpyGather = axpyGatherAVX2;
+	t.activate = activateAVX2;
+	t.mulActivationDerivative = mulActivationDerivativeAVX2;
+	t.applyNudges = applyNudgesAVX2;
+	t.applyMomentum = applyMomentumAVX2;
+	t.applyRMSProp = applyRMSPropAVX2;
+	t.applyAdam = applyAdamAVX2;
+	t.dotInt8 = dotInt8AVX2;
+	t.dotF16 = dotF16AVX2;
+	t.dotBF16 = dotBF16AVX2;
+	t.f16ToFloat = f16ToFloatAVX2;
+	t.floatToF16 = floatToF16AVX2;
+	t.bf16ToFloat = bf16ToFloatAVX2;
+	t.floatToBF16 = floatToBF16AVX2;
+
+	return true;
+}
+
+
+#else
+
+bool nnet::kernels::fillAVX2 (table &)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,498 @@
+#include "kernels.hpp"
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// avx512bw and avx512vl are needed for the 16-bit masked loads and stores
+#define NNET_TARGET __attribute__((target("avx512f,avx512bw,avx512vl")))
+
+
+// mask for the last n % 16 elements, so leftovers can use masked loads instead of a scalar loop
+NNET_TARGET static inline __mmask16 tailMask (size_t remaining)
+{
+	return (__mmask16) ((1u << remaining) - 1);
+}
+
+
+NNET_TARGET static float dotAVX512 (const float* a, const float* b, size_t n)
+{
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 acc3 = _mm512_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 64 <= n; i += 64)
+	{
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+		acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+		acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+		acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+	}
+
+	for (; i + 16 <= n; i += 16)
+	{
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+	}
+
+	if (i < n)
+	{
+		const __mmask16 m = tailMask(n - i);
+		acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+NNET_TARGET static float dotGatherAVX512 (const float* a, const int* indexes, const float* b, size_t n)
+{
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32)
+	{
+		const __m512 b0 = _mm512_i32gather_ps(_mm512_loadu_si512(indexes + i), b, 4);
+		const __m512 b1 = _mm512_i32gather_ps(_mm512_loadu_si512(indexes + i + 16), b, 4);
+
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), b0, acc0);
+		acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), b1, acc1);
+	}
+
+	for (; i + 16 <= n; i += 16)
+	{
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_i32gather_ps(_mm512_loadu_si512(indexes + i), b, 4), acc0);
+	}
+
+	if (i < n)
+	{
+		const __mmask16 m = tailMask(n - i);
+		const __m512i idx = _mm512_maskz_loadu_epi32(m, indexes + i);
+
+		acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, idx, b, 4), acc1);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+NNET_TARGET static void axpyGatherAVX512 (float* y, float a, const int* indexes, const float* x, size_t n)
+{
+	const __m512 va = _mm512_set1_ps(a);
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m512 xi = _mm512_i32gather_ps(_mm512_loadu_si512(indexes + i), x, 4);
+
+		_mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, xi, _mm512_loadu_ps(y + i)));
+	}
+
+	if (i < n)
+	{
+		const __mmask16 m = tailMask(n - i);
+		const __m512 xi = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, _mm512_maskz_loadu_epi32(m, indexes + i), x, 4);
+
+		_mm512_mask_storeu_ps(y + i, m, _mm512_fmadd_ps(va, xi, _mm512_maskz_loadu_ps(m, y + i)));
+	}
+}
+
+// gather, add, scatter back, which is only safe because no two indexes are the same
+NNET_TARGET static void axpyScatterAVX512 (float* y, const int* indexes, float a, const float* x, size_t n)
+{
+	const __m512 va = _mm512_set1_ps(a);
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m512i idx = _mm512_loadu_si512(indexes + i);
+		const __m512 yi = _mm512_i32gather_ps(idx, y, 4);
+
+		_mm512_i32scatter_ps(y, idx, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), yi), 4);
+	}
+
+	for (; i < n; ++i)
+	{
+		y[indexes[i]] += a * x[i];
+	}
+}
+
+NNET_TARGET static void dot4AVX512 (const float* a, const float* b0, const float* b1, const float* b2, const float* b3, size_t n, float* out)
+{
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 acc3 = _mm512_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m512 va = _mm512_loadu_ps(a + i);
+		acc0 = _mm512_fmadd_ps(va, _mm512_loadu_ps(b0 + i), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_loadu_ps(b1 + i), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_loadu_ps(b2 + i), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_loadu_ps(b3 + i), acc3);
+	}
+
+	if (i < n)
+	{
+		const __mmask16 m = tailMask(n - i);
+		const __m512 va = _mm512_maskz_loadu_ps(m, a + i);
+		acc0 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, b0 + i), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, b1 + i), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, b2 + i), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, b3 + i), acc3);
+	}
+
+	out[0] = _mm512_reduce_add_ps(acc0);
+	out[1] = _mm512_reduce_add_ps(acc1);
+	out[2] = _mm512_reduce_add_ps(acc2);
+	out[3] = _mm512_reduce_add_ps(acc3);
+}
+
+NNET_TARGET static void axpyAVX512 (float* y, float a, const float* x, size_t n)
+{
+	const __m512 va = _mm512_set1_ps(a);
+
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+	{
+		_mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+	}
+
+	if (i < n)
+	{
+		const __mmask16 m = tailMask(n - i);
+		_mm512_mask_storeu_ps(y + i, m, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i)));
+	}
+}
+
+NNET_TARGET static void axpy4AVX512 (float* y, const float* a, const float* x0, const float* x1, const float* x2, const float* x3, size_t n)
+{
+	const __m512 a0 = _mm512_set1_ps(a[0]);
+	const __m512 a1 = _mm512_set1_ps(a[1]);
+	const __m512 a2 = _mm512_set1_ps(a[2]);
+	const __m512 a3 = _mm512_set1_ps(a[3]);
+
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+
+		__m512 sum = _mm512_fmadd_ps(a0, _mm512_maskz_loadu_ps(m, x0 + i), _mm512_maskz_loadu_ps(m, y + i));
+		sum = _mm512_fmadd_ps(a1, _mm512_maskz_loadu_ps(m, x1 + i), sum);
+		sum = _mm512_fmadd_ps(a2, _mm512_maskz_loadu_ps(m, x2 + i), sum);
+		sum = _mm512_fmadd_ps(a3, _mm512_maskz_loadu_ps(m, x3 + i), sum);
+		_mm512_mask_storeu_ps(y + i, m, sum);
+	}
+}
+
+
+// see nnet::kernels::tanhApprox() for the scalar version of this
+NNET_TARGET static inline __m512 tanhAVX512 (__m512 x)
+{
+	using namespace nnet::kernels;
+
+	// min returns its second operand if either is NaN, so NaN carries on through and comes out as NaN
+	const __m512 a = _mm512_min_ps(_mm512_set1_ps(tanhClamp), _mm512_abs_ps(x));
+
+	const __m512 y = _mm512_add_ps(a, a);
+	const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(y, _mm512_set1_ps(expLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	const __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(expLn2Lo), _mm512_fnmadd_ps(n, _mm512_set1_ps(expLn2Hi), y));
+
+	__m512 p = _mm512_set1_ps(expP0);
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP1));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP2));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP3));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP4));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expP5));
+	p = _mm512_fmadd_ps(_mm512_mul_ps(p, r), r, _mm512_add_ps(r, _mm512_set1_ps(1)));
+
+	// scalef multiplies by 2^n directly, no exponent bit twiddling needed
+	const __m512 e = _mm512_scalef_ps(p, n);
+
+	const __m512 one = _mm512_set1_ps(1);
+	const __m512 t = _mm512_sub_ps(one, _mm512_div_ps(_mm512_set1_ps(2), _mm512_add_ps(e, one)));
+
+	// copy the sign of x back on
+	const __m512i signMask = _mm512_set1_epi32((int) 0x80000000);
+	return _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(t), _mm512_and_si512(_mm512_castps_si512(x), signMask)));
+}
+
+NNET_TARGET static void activateAVX512 (float* x, size_t n)
+{
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+		_mm512_mask_storeu_ps(x + i, m, tanhAVX512(_mm512_maskz_loadu_ps(m, x + i)));
+	}
+}
+
+NNET_TARGET static void mulActivationDerivativeAVX512 (float* d, const float* values, size_t n)
+{
+	const __m512 one = _mm512_set1_ps(1);
+
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+
+		const __m512 v = _mm512_maskz_loadu_ps(m, values + i);
+		_mm512_mask_storeu_ps(d + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, d + i), _mm512_fnmadd_ps(v, v, one)));
+	}
+}
+
+NNET_TARGET static void applyNudgesAVX512 (float* w, float* nudges, float scale, size_t n)
+{
+	const __m512 vs = _mm512_set1_ps(scale);
+	const __m512 zero = _mm512_setzero_ps();
+
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+
+		_mm512_mask_storeu_ps(w + i, m, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, nudges + i), vs, _mm512_maskz_loadu_ps(m, w + i)));
+		_mm512_mask_storeu_ps(nudges + i, m, zero);
+	}
+}
+
+NNET_TARGET static void applyMomentumAVX512 (float* w, float* velocity, float* nudges, float scale, float momentum, size_t n)
+{
+	const __m512 vs = _mm512_set1_ps(scale);
+	const __m512 vm = _mm512_set1_ps(momentum);
+	const __m512 zero = _mm512_setzero_ps();
+
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+
+		const __m512 v = _mm512_fmadd_ps(vm, _mm512_maskz_loadu_ps(m, velocity + i), _mm512_mul_ps(_mm512_maskz_loadu_ps(m, nudges + i), vs));
+
+		_mm512_mask_storeu_ps(velocity + i, m, v);
+		_mm512_mask_storeu_ps(w + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, w + i), v));
+		_mm512_mask_storeu_ps(nudges + i, m, zero);
+	}
+}
+
+NNET_TARGET static void applyRMSPropAVX512 (float* w, float* meanSquare, float* nudges, float scale, float decay, float stepSize, float epsilon, size_t n)
+{
+	const __m512 vs = _mm512_set1_ps(scale);
+	const __m512 vd = _mm512_set1_ps(decay);
+	const __m512 vd1 = _mm512_set1_ps(1 - decay);
+	const __m512 vstep = _mm512_set1_ps(stepSize);
+	const __m512 veps = _mm512_set1_ps(epsilon);
+	const __m512 zero = _mm512_setzero_ps();
+
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+
+		const __m512 u = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, nudges + i), vs);
+		const __m512 ms = _mm512_fmadd_ps(vd, _mm512_maskz_loadu_ps(m, meanSquare + i), _mm512_mul_ps(_mm512_mul_ps(vd1, u), u));
+		const __m512 step = _mm512_div_ps(_mm512_mul_ps(vstep, u), _mm512_add_ps(_mm512_sqrt_ps(ms), veps));
+
+		_mm512_mask_storeu_ps(meanSquare + i, m, ms);
+		_mm512_mask_storeu_ps(w + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, w + i), step));
+		_mm512_mask_storeu_ps(nudges + i, m, zero);
+	}
+}
+
+NNET_TARGET static void applyAdamAVX512 (float* w, float* mean, float* meanSquare, float* nudges, float scale, float beta1, float beta2, float stepSize, float epsilon, size_t n)
+{
+	const __m512 vs = _mm512_set1_ps(scale);
+	const __m512 vb1 = _mm512_set1_ps(beta1);
+	const __m512 vb11 = _mm512_set1_ps(1 - beta1);
+	const __m512 vb2 = _mm512_set1_ps(beta2);
+	const __m512 vb21 = _mm512_set1_ps(1 - beta2);
+	const __m512 vstep = _mm512_set1_ps(stepSize);
+	const __m512 veps = _mm512_set1_ps(epsilon);
+	const __m512 zero = _mm512_setzero_ps();
+
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 k = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+
+		const __m512 u = _mm512_mul_ps(_mm512_maskz_loadu_ps(k, nudges + i), vs);
+		const __m512 m = _mm512_fmadd_ps(vb1, _mm512_maskz_loadu_ps(k, mean + i), _mm512_mul_ps(vb11, u));
+		const __m512 ms = _mm512_fmadd_ps(vb2, _mm512_maskz_loadu_ps(k, meanSquare + i), _mm512_mul_ps(_mm512_mul_ps(vb21, u), u));
+		const __m512 step = _mm512_div_ps(_mm512_mul_ps(vstep, m), _mm512_add_ps(_mm512_sqrt_ps(ms), veps));
+
+		_mm512_mask_storeu_ps(mean + i, k, m);
+		_mm512_mask_storeu_ps(meanSquare + i, k, ms);
+		_mm512_mask_storeu_ps(w + i, k, _mm512_add_ps(_mm512_maskz_loadu_ps(k, w + i), step));
+		_mm512_mask_storeu_ps(nudges + i, k, zero);
+	}
+}
+
+
+NNET_TARGET static inline __m512 loadF16 (__mmask16 m, const uint16_t* p)
+{
+	return _mm512_cvtph_ps(_mm256_maskz_loadu_epi16(m, p));
+}
+
+NNET_TARGET static inline __m512 loadBF16 (__mmask16 m, const uint16_t* p)
+{
+	return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(m, p)), 16));
+}
+
+NNET_TARGET static float dotF16AVX512 (const uint16_t* a, const float* b, size_t n)
+{
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32)
+	{
+		acc0 = _mm512_fmadd_ps(loadF16(0xffff, a + i), _mm512_loadu_ps(b + i), acc0);
+		acc1 = _mm512_fmadd_ps(loadF16(0xffff, a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+	}
+
+	for (; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+		acc0 = _mm512_fmadd_ps(loadF16(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc0);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+NNET_TARGET static float dotBF16AVX512 (const uint16_t* a, const float* b, size_t n)
+{
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32)
+	{
+		acc0 = _mm512_fmadd_ps(loadBF16(0xffff, a + i), _mm512_loadu_ps(b + i), acc0);
+		acc1 = _mm512_fmadd_ps(loadBF16(0xffff, a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+	}
+
+	for (; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+		acc0 = _mm512_fmadd_ps(loadBF16(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc0);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+NNET_TARGET static void f16ToFloatAVX512 (const uint16_t* src, float* dst, size_t n)
+{
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+		_mm512_mask_storeu_ps(dst + i, m, loadF16(m, src + i));
+	}
+}
+
+NNET_TARGET static void floatToF16AVX512 (const float* src, uint16_t* dst, size_t n)
+{
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+		const __m256i h = _mm512_cvtps_ph(_mm512_maskz_loadu_ps(m, src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		_mm256_mask_storeu_epi16(dst + i, m, h);
+	}
+}
+
+NNET_TARGET static void bf16ToFloatAVX512 (const uint16_t* src, float* dst, size_t n)
+{
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+		_mm512_mask_storeu_ps(dst + i, m, loadBF16(m, src + i));
+	}
+}
+
+NNET_TARGET static void floatToBF16AVX512 (const float* src, uint16_t* dst, size_t n)
+{
+	const __m512i bias = _mm512_set1_epi32(0x7FFF);
+	const __m512i one = _mm512_set1_epi32(1);
+
+	for (size_t i = 0; i < n; i += 16)
+	{
+		const __mmask16 m = n - i >= 16 ? (__mmask16) 0xffff : tailMask(n - i);
+
+		// round to nearest even, the same way as floatToBfloat16()
+		__m512i bits = _mm512_castps_si512(_mm512_maskz_loadu_ps(m, src + i));
+		bits = _mm512_add_epi32(bits, _mm512_add_epi32(bias, _mm512_and_si512(_mm512_srli_epi32(bits, 16), one)));
+
+		_mm512_mask_cvtepi32_storeu_epi16(dst + i, m, _mm512_srli_epi32(bits, 16));
+	}
+}
+
+
+// VNNI multiplies unsigned bytes by signed bytes, so a is shifted into unsigned range with an xor (a + 128)
+// and the extra 128 * sum(b) is subtracted at the end, using a second dpbusd against a vector of ones
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int32_t dotInt8VNNI (const int8_t* a, const int8_t* b, size_t n)
+{
+	const __m512i flip = _mm512_set1_epi8((char) 0x80);
+	const __m512i ones = _mm512_set1_epi8(1);
+
+	__m512i acc = _mm512_setzero_si512();
+	__m512i accB = _mm512_setzero_si512();
+
+	for (size_t i = 0; i < n; i += 64)
+	{
+		const __mmask64 m = n - i >= 64 ? ~(__mmask64) 0 : (((__mmask64) 1 << (n - i)) - 1);
+
+		// masked-off lanes of b load as zero, so they contribute nothing to either sum
+		const __m512i va = _mm512_xor_si512(_mm512_maskz_loadu_epi8(m, a + i), flip);
+		const __m512i vb = _mm512_maskz_loadu_epi8(m, b + i);
+
+		acc = _mm512_dpbusd_epi32(acc, va, vb);
+		accB = _mm512_dpbusd_epi32(accB, ones, vb);
+	}
+
+	return _mm512_reduce_add_epi32(acc) - 128 * _mm512_reduce_add_epi32(accB);
+}
+
+
+bool nnet::kernels::fillAVX512 (table &t)
+{
+	t.dot = dotAVX512;
+	t.dot4 = dot4AVX512;
+	t.axpy = axpyAVX512;
+	t.axpy4 = axpy4AVX512;
+	t.dotGather = dotGatherAVX512;
+	t.axpyGather = axpyGatherAVX512;
+	t.axpyScatter = axpyScatterAVX512;
+	t.activate = activateAVX512;
+	t.mulActivationDerivative = mulActivationDerivativeAVX512;
+	t.applyNudges = applyNudgesAVX512;
+	t.applyMomentum = applyMomentumAVX512;
+	t.applyRMSProp = applyRMSPropAVX512;
+	t.applyAdam = applyAdamAVX512;
+	t.dotF16 = dotF16AVX512;
+	t.dotBF16 = dotBF16AVX512;
+	t.f16ToFloat = f16ToFloatAVX512;
+	t.floatToF16 = floatToF16AVX512;
+	t.bf16ToFloat = bf16ToFloatAVX512;
+	t.floatToBF16 = floatToBF16AVX512;
+
+	if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni"))
+	{
+		t.dotInt8 = dotInt8VNNI;
+	}
+
+	return true;
+}
+
+
+#else
+
+bool nnet::kernels::fillAVX512 (table &)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,311 @@
+#include "kernels.hpp"
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define NNET_TARGET __attribute__((target("sse2")))
+
+
+NNET_TARGET static inline float hsum (__m128 v)
+{
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+
+NNET_TARGET static float dotSSE2 (const float* a, const float* b, size_t n)
+{
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+	{
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+
+	float sum = hsum(_mm_add_ps(acc0, acc1));
+
+	for (; i < n; ++i)
+	{
+		sum += a[i] * b[i];
+	}
+
+	return sum;
+}
+
+NNET_TARGET static void dot4SSE2 (const float* a, const float* b0, const float* b1, const float* b2, const float* b3, size_t n, float* out)
+{
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	__m128 acc2 = _mm_setzero_ps();
+	__m128 acc3 = _mm_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 va = _mm_loadu_ps(a + i);
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(va, _mm_loadu_ps(b0 + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(va, _mm_loadu_ps(b1 + i)));
+		acc2 = _mm_add_ps(acc2, _mm_mul_ps(va, _mm_loadu_ps(b2 + i)));
+		acc3 = _mm_add_ps(acc3, _mm_mul_ps(va, _mm_loadu_ps(b3 + i)));
+	}
+
+	float sum0 = hsum(acc0), sum1 = hsum(acc1), sum2 = hsum(acc2), sum3 = hsum(acc3);
+
+	for (; i < n; ++i)
+	{
+		sum0 += a[i] * b0[i];
+		sum1 += a[i] * b1[i];
+		sum2 += a[i] * b2[i];
+		sum3 += a[i] * b3[i];
+	}
+
+	out[0] = sum0;
+	out[1] = sum1;
+	out[2] = sum2;
+	out[3] = sum3;
+}
+
+NNET_TARGET static void axpySSE2 (float* y, float a, const float* x, size_t n)
+{
+	const __m128 va = _mm_set1_ps(a);
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+	}
+
+	for (; i < n; ++i)
+	{
+		y[i] += a * x[i];
+	}
+}
+
+NNET_TARGET static void axpy4SSE2 (float* y, const float* a, const float* x0, const float* x1, const float* x2, const float* x3, size_t n)
+{
+	const __m128 a0 = _mm_set1_ps(a[0]);
+	const __m128 a1 = _mm_set1_ps(a[1]);
+	const __m128 a2 = _mm_set1_ps(a[2]);
+	const __m128 a3 = _mm_set1_ps(a[3]);
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 sum = _mm_add_ps(_mm_mul_ps(a0, _mm_loadu_ps(x0 + i)), _mm_mul_ps(a1, _mm_loadu_ps(x1 + i)));
+		sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(a2, _mm_loadu_ps(x2 + i)), _mm_mul_ps(a3, _mm_loadu_ps(x3 + i))));
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), sum));
+	}
+
+	for (; i < n; ++i)
+	{
+		y[i] += a[0] * x0[i] + a[1] * x1[i] + a[2] * x2[i] + a[3] * x3[i];
+	}
+}
+
+
+// see nnet::kernels::tanhApprox() for the scalar version of this
+NNET_TARGET static inline __m128 tanhSSE2 (__m128 x)
+{
+	using namespace nnet::kernels;
+
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+
+	const __m128 sign = _mm_and_ps(x, signMask);
+	// min returns its second operand if either is NaN, so NaN carries on through and comes out as NaN
+	const __m128 a = _mm_min_ps(_mm_set1_ps(tanhClamp), _mm_andnot_ps(signMask, x));
+
+	const __m128 y = _mm_add_ps(a, a);
+	const __m128i ni = _mm_cvtps_epi32(_mm_mul_ps(y, _mm_set1_ps(expLog2e)));
+	const __m128 n = _mm_cvtepi32_ps(ni);
+	const __m128 r = _mm_sub_ps(_mm_sub_ps(y, _mm_mul_ps(n, _mm_set1_ps(expLn2Hi))), _mm_mul_ps(n, _mm_set1_ps(expLn2Lo)));
+
+	__m128 p = _mm_set1_ps(expP0);
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(expP1));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(expP2));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(expP3));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(expP4));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(expP5));
+	p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r), _mm_set1_ps(1));
+
+	const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ni, _mm_set1_epi32(127)), 23));
+
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 t = _mm_sub_ps(one, _mm_div_ps(_mm_set1_ps(2), _mm_add_ps(_mm_mul_ps(p, scale), one)));
+
+	return _mm_or_ps(t, sign);
+}
+
+NNET_TARGET static void activateSSE2 (float* x, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_storeu_ps(x + i, tanhSSE2(_mm_loadu_ps(x + i)));
+	}
+
+	for (; i < n; ++i)
+	{
+		x[i] = nnet::kernels::tanhApprox(x[i]);
+	}
+}
+
+NNET_TARGET static void mulActivationDerivativeSSE2 (float* d, const float* values, size_t n)
+{
+	const __m128 one = _mm_set1_ps(1);
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 v = _mm_loadu_ps(values + i);
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_loadu_ps(d + i), _mm_sub_ps(one, _mm_mul_ps(v, v))));
+	}
+
+	for (; i < n; ++i)
+	{
+		d[i] *= nnet::kernels::activationDerivative(values[i]);
+	}
+}
+
+NNET_TARGET static void applyNudgesSSE2 (float* w, float* nudges, float scale, size_t n)
+{
+	const __m128 vs = _mm_set1_ps(scale);
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_storeu_ps(w + i, _mm_add_ps(_mm_loadu_ps(w + i), _mm_mul_ps(_mm_loadu_ps(nudges + i), vs)));
+		_mm_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		w[i] += nudges[i] * scale;
+		nudges[i] = 0;
+	}
+}
+
+NNET_TARGET static void applyMomentumSSE2 (float* w, float* velocity, float* nudges, float scale, float momentum, size_t n)
+{
+	const __m128 vs = _mm_set1_ps(scale);
+	const __m128 vm = _mm_set1_ps(momentum);
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 v = _mm_add_ps(_mm_mul_ps(vm, _mm_loadu_ps(velocity + i)), _mm_mul_ps(_mm_loadu_ps(nudges + i), vs));
+
+		_mm_storeu_ps(velocity + i, v);
+		_mm_storeu_ps(w + i, _mm_add_ps(_mm_loadu_ps(w + i), v));
+		_mm_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		nnet::kernels::momentumStep(w[i], velocity[i], nudges[i], scale, momentum);
+	}
+}
+
+NNET_TARGET static void applyRMSPropSSE2 (float* w, float* meanSquare, float* nudges, float scale, float decay, float stepSize, float epsilon, size_t n)
+{
+	const __m128 vs = _mm_set1_ps(scale);
+	const __m128 vd = _mm_set1_ps(decay);
+	const __m128 vd1 = _mm_set1_ps(1 - decay);
+	const __m128 vstep = _mm_set1_ps(stepSize);
+	const __m128 veps = _mm_set1_ps(epsilon);
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 u = _mm_mul_ps(_mm_loadu_ps(nudges + i), vs);
+		const __m128 ms = _mm_add_ps(_mm_mul_ps(vd, _mm_loadu_ps(meanSquare + i)), _mm_mul_ps(_mm_mul_ps(vd1, u), u));
+		const __m128 step = _mm_div_ps(_mm_mul_ps(vstep, u), _mm_add_ps(_mm_sqrt_ps(ms), veps));
+
+		_mm_storeu_ps(meanSquare + i, ms);
+		_mm_storeu_ps(w + i, _mm_add_ps(_mm_loadu_ps(w + i), step));
+		_mm_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		nnet::kernels::rmspropStep(w[i], meanSquare[i], nudges[i], scale, decay, stepSize, epsilon);
+	}
+}
+
+NNET_TARGET static void applyAdamSSE2 (float* w, float* mean, float* meanSquare, float* nudges, float scale, float beta1, float beta2, float stepSize, float epsilon, size_t n)
+{
+	const __m128 vs = _mm_set1_ps(scale);
+	const __m128 vb1 = _mm_set1_ps(beta1);
+	const __m128 vb11 = _mm_set1_ps(1 - beta1);
+	const __m128 vb2 = _mm_set1_ps(beta2);
+	const __m128 vb21 = _mm_set1_ps(1 - beta2);
+	const __m128 vstep = _mm_set1_ps(stepSize);
+	const __m128 veps = _mm_set1_ps(epsilon);
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 u = _mm_mul_ps(_mm_loadu_ps(nudges + i), vs);
+		const __m128 m = _mm_add_ps(_mm_mul_ps(vb1, _mm_loadu_ps(mean + i)), _mm_mul_ps(vb11, u));
+		const __m128 ms = _mm_add_ps(_mm_mul_ps(vb2, _mm_loadu_ps(meanSquare + i)), _mm_mul_ps(_mm_mul_ps(vb21, u), u));
+		const __m128 step = _mm_div_ps(_mm_mul_ps(vstep, m), _mm_add_ps(_mm_sqrt_ps(ms), veps));
+
+		_mm_storeu_ps(mean + i, m);
+		_mm_storeu_ps(meanSquare + i, ms);
+		_mm_storeu_ps(w + i, _mm_add_ps(_mm_loadu_ps(w + i), step));
+		_mm_storeu_ps(nudges + i, zero);
+	}
+
+	for (; i < n; ++i)
+	{
+		nnet::kernels::adamStep(w[i], mean[i], meanSquare[i], nudges[i], scale, beta1, beta2, stepSize, epsilon);
+	}
+}
+
+
+bool nnet::kernels::fillSSE2 (table &t)
+{
+	t.dot = dotSSE2;
+	t.dot4 = dot4SSE2;
+	t.axpy = axpySSE2;
+	t.axpy4 = axpy4SSE2;
+	t.activate = activateSSE2;
+	t.mulActivationDerivative = mulActivationDerivativeSSE2;
+	t.applyNudges = applyNudgesSSE2;
+	t.applyMomentum = applyMomentumSSE2;
+	t.applyRMSProp = applyRMSPropSSE2;
+	t.applyAdam = applyAdamSSE2;
+
+	return true;
+}
+
+
+#else
+
+bool nnet::kernels::fillSSE2 (table &)
+{
+	return false;
+}
+
+#endif
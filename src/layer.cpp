@@ -1,67 +1,761 @@
 #include "../include/nnet.hpp"
+#include "kernels.hpp"
 
-nnet::layer::layer (int nodeCount, std::weak_ptr<layer> prevLayer)
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+
+nnet::layer::layer (int nodeCount, int prevNodeCount, bool allocateParams)
+: nodeCount {nodeCount},
+	prevNodeCount {prevNodeCount},
+	values (nodeCount, 0),
+	dCost_dValues (nodeCount, 0),
+	// a network loaded for inference never needs the weight nudges, so they wait for the first backprop
+	weightNudgeSums (allocateParams ? (size_t) nodeCount * prevNodeCount : 0, 0),
+	biasNudgeSums (nodeCount, 0)
 {
 
-	nodes.reserve(nodeCount);
+	if (!allocateParams) return;
 
-	for (int i = 0; i < nodeCount; ++i)
+	// the input layer gets a bias buffer too, so that every node view has somewhere to point
+	biases = allocFloats(nodeCount);
+
+	if (prevNodeCount > 0)
+	{
+		weights = allocFloats((size_t) nodeCount * prevNodeCount);
+	}
+
+	if (!biases || (prevNodeCount > 0 && !weights))
+	{
+		throw nnet::internalError("error initializing parameter buffers, thrown from nnet::layer::layer()");
+	}
+
+}
+
+
+void nnet::layer::unshareParams ()
+{
+
+	std::shared_ptr<float> newBiases = allocFloats(nodeCount);
+	std::memcpy(newBiases.get(), biases.get(), nodeCount * sizeof(float));
+	biases = newBiases;
+
+	if (prevNodeCount == 0) return;
+
+	const size_t count = (size_t) nodeCount * prevNodeCount;
+
+	if (storage == storageType::float32)
+	{
+		std::shared_ptr<float> newWeights = allocFloats(count);
+		std::memcpy(newWeights.get(), weights.get(), count * sizeof(float));
+		weights = newWeights;
+	}
+	else if (storage == storageType::sparse)
+	{
+		// the pattern is never changed in place, so it can stay shared
+		const size_t nonzeroCount = pattern->columns.size();
+
+		std::shared_ptr<float> newWeights = allocFloats(std::max<size_t>(nonzeroCount, 1));
+		std::memcpy(newWeights.get(), sparseWeights.get(), nonzeroCount * sizeof(float));
+		sparseWeights = newWeights;
+	}
+	else
+	{
+		std::shared_ptr<uint16_t> newWeights = allocHalves(count);
+		std::memcpy(newWeights.get(), halfWeights.get(), count * sizeof(uint16_t));
+		halfWeights = newWeights;
+	}
+
+}
+
+
+
+////// weight storage
+
+// convert count weights starting at begin to float
+// they are held in either w or h, depending on type
+static void weightsToFloat (nnet::storageType type, const float* w, const uint16_t* h, size_t begin, float* dst, size_t count)
+{
+
+	const nnet::kernels::table &k = nnet::kernels::get();
+
+	switch (type)
 	{
-		nodes.emplace_back(prevLayer);
+		case nnet::storageType::float32:
+			std::memcpy(dst, w + begin, count * sizeof(float));
+			break;
+
+		case nnet::storageType::float16:
+			k.f16ToFloat(h + begin, dst, count);
+			break;
+
+		case nnet::storageType::bfloat16:
+			k.bf16ToFloat(h + begin, dst, count);
+			break;
+
+		// see sparseToFloat()
+		case nnet::storageType::sparse:
+			break;
+	}
+
+}
+
+// the reverse of weightsToFloat()
+static void weightsFromFloat (nnet::storageType type, const float* src, float* w, uint16_t* h, size_t begin, size_t count)
+{
+
+	const nnet::kernels::table &k = nnet::kernels::get();
+
+	switch (type)
+	{
+		case nnet::storageType::float32:
+			std::memcpy(w + begin, src, count * sizeof(float));
+			break;
+
+		case nnet::storageType::float16:
+			k.floatToF16(src, h + begin, count);
+			break;
+
+		case nnet::storageType::bfloat16:
+			k.floatToBF16(src, h + begin, count);
+			break;
+
+		// see sparseFromFloat()
+		case nnet::storageType::sparse:
+			break;
+	}
+
+}
+
+// the same for sparse storage, where the weights outside the pattern are 0
+static void sparseToFloat (const nnet::sparsePattern &pattern, const float* w, int prevNodeCount, size_t begin, float* dst, size_t count)
+{
+
+	std::fill(dst, dst + count, 0);
+
+	const size_t end = begin + count;
+
+	for (size_t row = begin / prevNodeCount; row * prevNodeCount < end; ++row)
+	{
+		for (size_t k = pattern.rowStarts[row]; k < pattern.rowStarts[row + 1]; ++k)
+		{
+			const size_t i = row * prevNodeCount + pattern.columns[k];
+
+			if (i >= begin && i < end) dst[i - begin] = w[k];
+		}
+	}
+
+}
+
+// values outside the pattern are dropped, there's nowhere to keep them
+static void sparseFromFloat (const nnet::sparsePattern &pattern, const float* src, float* w, int prevNodeCount, size_t begin, size_t count)
+{
+
+	const size_t end = begin + count;
+
+	for (size_t row = begin / prevNodeCount; row * prevNodeCount < end; ++row)
+	{
+		for (size_t k = pattern.rowStarts[row]; k < pattern.rowStarts[row + 1]; ++k)
+		{
+			const size_t i = row * prevNodeCount + pattern.columns[k];
+
+			if (i >= begin && i < end) w[k] = src[i - begin];
+		}
+	}
+
+}
+
+
+void nnet::layer::setStorageType (storageType type)
+{
+
+	// converting sparse to sparse is allowed through, it drops the weights that have become 0
+	if ((type == storage && type != storageType::sparse) || prevNodeCount == 0)
+	{
+		storage = type;
+		return;
+	}
+
+	const size_t count = (size_t) nodeCount * prevNodeCount;
+
+	std::shared_ptr<float> newWeights;
+	std::shared_ptr<uint16_t> newHalfWeights;
+	std::shared_ptr<float> newSparseWeights;
+	std::shared_ptr<sparsePattern> newPattern;
+
+	// go through float a row at a time, so that big layers don't need a full float copy
+	std::vector<float> row(prevNodeCount);
+
+	if (type == storageType::sparse)
+	{
+		newPattern = std::make_shared<sparsePattern>();
+		newPattern->rowStarts.push_back(0);
+
+		std::vector<float> values;
+
+		for (size_t begin = 0; begin < count; begin += prevNodeCount)
+		{
+			loadWeights(begin, prevNodeCount, row.data());
+
+			for (int j = 0; j < prevNodeCount; ++j)
+			{
+				if (row[j] == 0) continue;
+
+				newPattern->columns.push_back(j);
+				values.push_back(row[j]);
+			}
+
+			newPattern->rowStarts.push_back(values.size());
+		}
+
+		newSparseWeights = allocFloats(std::max<size_t>(values.size(), 1));
+		std::copy(values.begin(), values.end(), newSparseWeights.get());
+	}
+	else
+	{
+		if (type == storageType::float32)
+		{
+			newWeights = allocFloats(count);
+		}
+		else
+		{
+			newHalfWeights = allocHalves(count);
+		}
+
+		for (size_t begin = 0; begin < count; begin += prevNodeCount)
+		{
+			loadWeights(begin, prevNodeCount, row.data());
+			weightsFromFloat(type, row.data(), newWeights.get(), newHalfWeights.get(), begin, prevNodeCount);
+		}
+	}
+
+	// the nudges and optimizer state follow the layout of the stored weights
+	const bool relayout = storage == storageType::sparse || type == storageType::sparse;
+
+	storage = type;
+	weights = newWeights;
+	halfWeights = newHalfWeights;
+	sparseWeights = newSparseWeights;
+	pattern = newPattern;
+
+	if (relayout)
+	{
+		if (!weightNudgeSums.empty()) weightNudgeSums.assign(storedWeightCount(), 0);
+		setOptimizer(optimizer);
+	}
+
+}
+
+
+size_t nnet::layer::storedWeightCount () const
+{
+	return storage == storageType::sparse ? pattern->columns.size() : (size_t) nodeCount * prevNodeCount;
+}
+
+
+void nnet::layer::prune (float fraction)
+{
+
+	const size_t count = (size_t) nodeCount * prevNodeCount;
+	const size_t pruneCount = std::min(count, (size_t) (std::max(fraction, 0.0f) * count));
+
+	if (pruneCount == 0) return;
+
+	std::vector<float> w(count);
+	loadWeights(0, count, w.data());
+
+	// the magnitude of the last weight to go
+	std::vector<float> magnitudes(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		magnitudes[i] = std::fabs(w[i]);
+	}
+
+	std::nth_element(magnitudes.begin(), magnitudes.begin() + (pruneCount - 1), magnitudes.end());
+	const float threshold = magnitudes[pruneCount - 1];
+
+	magnitudes = std::vector<float>();
+
+	// everything below the threshold goes, then as many weights equal to it as it takes to make up the count
+	size_t ties = pruneCount;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (std::fabs(w[i]) < threshold) --ties;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float m = std::fabs(w[i]);
+
+		if (m < threshold)
+		{
+			w[i] = 0;
+		}
+		else if (m == threshold && ties > 0)
+		{
+			w[i] = 0;
+			--ties;
+		}
+	}
+
+	storeWeights(0, count, w.data());
+
+	// sparse to sparse drops the zeros from the pattern
+	if (storage == storageType::sparse) setStorageType(storageType::sparse);
+
+}
+
+
+void nnet::layer::loadWeights (size_t begin, size_t count, float* dst) const
+{
+
+	if (storage == storageType::sparse)
+	{
+		sparseToFloat(*pattern, sparseWeights.get(), prevNodeCount, begin, dst, count);
+		return;
+	}
+
+	weightsToFloat(storage, weights.get(), halfWeights.get(), begin, dst, count);
+
+}
+
+void nnet::layer::storeWeights (size_t begin, size_t count, const float* src)
+{
+
+	if (storage == storageType::sparse)
+	{
+		sparseFromFloat(*pattern, src, sparseWeights.get(), prevNodeCount, begin, count);
+		return;
+	}
+
+	weightsFromFloat(storage, src, weights.get(), halfWeights.get(), begin, count);
+
+}
+
+
+float* nnet::layer::weightsAsFloat (size_t begin, size_t count, float* scratch) const
+{
+
+	if (storage == storageType::float32)
+	{
+		return weights.get() + begin;
+	}
+
+	loadWeights(begin, count, scratch);
+
+	return scratch;
+
+}
+
+void nnet::layer::commitWeights (size_t begin, size_t count, const float* values)
+{
+	if (storage != storageType::float32)
+	{
+		storeWeights(begin, count, values);
+	}
+}
+
+
+// per-thread scratch space for converting half-precision weights, and for gathering sparse values
+static float* scratchFloats (size_t count)
+{
+	static thread_local std::vector<float> scratch;
+
+	if (scratch.size() < count) scratch.resize(count);
+
+	return scratch.data();
+}
+
+// per-thread list of the previous layer's nonzero values, for sparse inputs
+static int* scratchIndexes (size_t count)
+{
+	static thread_local std::vector<int> scratch;
+
+	if (scratch.size() < count) scratch.resize(count);
+
+	return scratch.data();
+}
+
+// fill indexes with the positions of the nonzero values, and return how many there are
+// gives up and returns -1 as soon as there are more than limit, so a dense vector costs little to check
+static int findNonzero (const float* values, int count, int* indexes, int limit)
+{
+
+	int found = 0;
+
+	for (int j = 0; j < count; ++j)
+	{
+		if (values[j] != 0)
+		{
+			if (found == limit) return -1;
+			indexes[found++] = j;
+		}
+	}
+
+	return found;
+
+}
+
+// the previous layer's values count as sparse when at most 1 in this many are nonzero
+// below that, skipping the zeros beats the plain vector loops, which do every column but do it much faster per column
+static const int sparseForwardRatio = 8;
+static const int sparseBackwardRatio = 4;
+
+
+
+// one matrix-vector product over the previous layer's values
+void nnet::layer::calculate (const layer &prev)
+{
+
+	if (prev.nodeCount != prevNodeCount)
+	{
+		throw nnet::internalError("previous layer node count and this layer's weight count do not match");
+	}
+
+	calculate(prev.values.data(), values.data());
+
+}
+
+void nnet::layer::calculate (const float* in, float* out) const
+{
+
+	const kernels::table &k = kernels::get();
+
+	const float* b = biases.get();
+
+	// half-precision weights are converted inside the dot product, so they're only ever read at half the bandwidth
+	switch (storage)
+	{
+		case storageType::float32:
+		{
+			// with mostly zero inputs (one-hot and the like), only the weights of the nonzero ones are read
+			int* nonzero = scratchIndexes(prevNodeCount);
+			const int nonzeroCount = findNonzero(in, prevNodeCount, nonzero, prevNodeCount / sparseForwardRatio);
+
+			if (nonzeroCount >= 0)
+			{
+				float* x = scratchFloats(nonzeroCount);
+
+				for (int n = 0; n < nonzeroCount; ++n)
+				{
+					x[n] = in[nonzero[n]];
+				}
+
+				for (int i = 0; i < nodeCount; ++i)
+				{
+					out[i] = b[i] + k.dotGather(x, nonzero, weights.get() + (size_t) i * prevNodeCount, nonzeroCount);
+				}
+			}
+			else
+			{
+				for (int i = 0; i < nodeCount; ++i)
+				{
+					out[i] = b[i] + k.dot(weights.get() + (size_t) i * prevNodeCount, in, prevNodeCount);
+				}
+			}
+			break;
+		}
+
+		case storageType::sparse:
+		{
+			const size_t* starts = pattern->rowStarts.data();
+
+			for (int i = 0; i < nodeCount; ++i)
+			{
+				out[i] = b[i] + k.dotGather(sparseWeights.get() + starts[i], pattern->columns.data() + starts[i], in, starts[i + 1] - starts[i]);
+			}
+			break;
+		}
+
+		case storageType::float16:
+			for (int i = 0; i < nodeCount; ++i)
+			{
+				out[i] = b[i] + k.dotF16(halfWeights.get() + (size_t) i * prevNodeCount, in, prevNodeCount);
+			}
+			break;
+
+		case storageType::bfloat16:
+			for (int i = 0; i < nodeCount; ++i)
+			{
+				out[i] = b[i] + k.dotBF16(halfWeights.get() + (size_t) i * prevNodeCount, in, prevNodeCount);
+			}
+			break;
 	}
 
+	k.activate(out, nodeCount);
+
 }
 
 
-void nnet::layer::calculate ()
+// cache blocking for calculateBatch()
+// the samples are split into tiles whose inputs fit in L2, and the columns into blocks whose row segments fit in L1
+// within a tile, each row segment is loaded (and converted, for half-precision storage) once and reused for every sample
+static const size_t batchSampleBlock = 4; // must match kernels::table::dot4()
+static const size_t batchSampleTile = 64;
+static const int batchColumnBlock = 512;
+
+void nnet::layer::calculateBatch (const float* in, size_t count, float* out) const
 {
 
-	for (node &n: nodes)
+	const kernels::table &k = kernels::get();
+
+	const float* b = biases.get();
+
+	// each sparse row is short, so there's nothing to gain from blocking
+	if (storage == storageType::sparse)
 	{
-		n.calculate();
+		for (size_t s = 0; s < count; ++s)
+		{
+			calculate(in + s * prevNodeCount, out + s * nodeCount);
+		}
+
+		return;
 	}
 
+	float* scratch = scratchFloats(batchColumnBlock);
+
+	for (size_t s = 0; s < count; ++s)
+	{
+		std::copy(b, b + nodeCount, out + s * nodeCount);
+	}
+
+	for (size_t t0 = 0; t0 < count; t0 += batchSampleTile)
+	{
+		const size_t t1 = std::min(t0 + batchSampleTile, count);
+
+		for (int k0 = 0; k0 < prevNodeCount; k0 += batchColumnBlock)
+		{
+			const int k1 = std::min(k0 + batchColumnBlock, prevNodeCount);
+			const size_t width = k1 - k0;
+
+			for (int i = 0; i < nodeCount; ++i)
+			{
+				const float* row = weightsAsFloat((size_t) i * prevNodeCount + k0, width, scratch);
+
+				size_t s = t0;
+
+				for (; s + batchSampleBlock <= t1; s += batchSampleBlock)
+				{
+					float sums[batchSampleBlock];
+
+					k.dot4(row, in + (s + 0) * prevNodeCount + k0, in + (s + 1) * prevNodeCount + k0, in + (s + 2) * prevNodeCount + k0, in + (s + 3) * prevNodeCount + k0, width, sums);
+
+					out[(s + 0) * nodeCount + i] += sums[0];
+					out[(s + 1) * nodeCount + i] += sums[1];
+					out[(s + 2) * nodeCount + i] += sums[2];
+					out[(s + 3) * nodeCount + i] += sums[3];
+				}
+
+				// leftover samples that don't fill a whole block
+				for (; s < t1; ++s)
+				{
+					out[s * nodeCount + i] += k.dot(row, in + s * prevNodeCount + k0, width);
+				}
+			}
+		}
+	}
+
+	k.activate(out, count * nodeCount);
+
 }
 
-void nnet::layer::randomize ()
+
+void nnet::layer::randomize (rng &generator)
 {
 
-	for (node &n: nodes)
+	generator.fillUniform(biases.get(), nodeCount, -1, 1);
+
+	// only the weights in the pattern exist, so there's no need to go row by row
+	if (storage == storageType::sparse)
 	{
-		n.randomize();
+		generator.fillUniform(sparseWeights.get(), storedWeightCount(), -1, 1);
+		return;
+	}
+
+	float* scratch = scratchFloats(prevNodeCount);
+
+	for (size_t begin = 0; begin < (size_t) nodeCount * prevNodeCount; begin += prevNodeCount)
+	{
+		float* row = weightsAsFloat(begin, prevNodeCount, scratch);
+
+		generator.fillUniform(row, prevNodeCount, -1, 1);
+
+		commitWeights(begin, prevNodeCount, row);
 	}
 
 }
 
-void nnet::layer::tweak (float magnitude)
+void nnet::layer::tweak (float magnitude, rng &generator)
 {
 
-	for (node &n: nodes)
+	generator.addUniform(biases.get(), nodeCount, magnitude);
+
+	// only the weights in the pattern exist, so there's no need to go row by row
+	if (storage == storageType::sparse)
 	{
-		n.tweak(magnitude);
+		generator.addUniform(sparseWeights.get(), storedWeightCount(), magnitude);
+		return;
+	}
+
+	float* scratch = scratchFloats(prevNodeCount);
+
+	for (size_t begin = 0; begin < (size_t) nodeCount * prevNodeCount; begin += prevNodeCount)
+	{
+		float* row = weightsAsFloat(begin, prevNodeCount, scratch);
+
+		generator.addUniform(row, prevNodeCount, magnitude);
+
+		commitWeights(begin, prevNodeCount, row);
 	}
 
 }
 
 
 
-void nnet::layer::backprop (bool accumulate, float learningRate, std::vector<float> ideal)
+
+////// backprop functions
+
+// make sure to call calculate() before this!
+void nnet::layer::backprop (bool accumulate, float learningRate, layer &prev, const std::vector<float> &ideal)
+{
+	backprop(accumulate, learningRate, prev, ideal.data(), ideal.size());
+}
+
+void nnet::layer::backprop (bool accumulate, float learningRate, layer &prev, const float* ideal, size_t count)
 {
 
-	for (int i = 0; i < nodes.size(); ++i)
+	if (count < (size_t) nodeCount)
+	{
+		throw nnet::usageError("ideal output vector is smaller than the output layer");
+	}
+
+	// derivative of the cost function
+	for (int i = 0; i < nodeCount; ++i)
 	{
-		node &n = nodes.at(i);
-		n.backprop(accumulate, learningRate, true, ideal.at(i));
+		dCost_dValues[i] = 2 * (values[i] - ideal[i]);
 	}
 
+	backprop_m(accumulate, learningRate, prev);
+
 }
 
-void nnet::layer::backprop (bool accumulate, float learningRate)
+void nnet::layer::backprop (bool accumulate, float learningRate, layer &prev)
 {
+	// the dCost_dValues for this layer should already be set by the L+1 layer
+	backprop_m(accumulate, learningRate, prev);
+}
+
+
+void nnet::layer::backprop_m (bool accumulate, float learningRate, layer &prev)
+{
+
+	allocateNudgeSums();
+
+	const kernels::table &k = kernels::get();
+
+	// the input layer's dCost_dValues are never used, so don't bother filling them in
+	const bool propagate = prev.prevNodeCount > 0;
 
-	for (node &n: nodes)
+	const float* in = prev.values.data();
+	float* prevDCost = prev.dCost_dValues.data();
+
+	float* b = biases.get();
+	float* scratch = scratchFloats(prevNodeCount);
+
+	// turn dCost_dValues into dCost_dUnactivated in place
+	// this is also dCost_dBias, since dUnactivated_dBias is 1
+	float* deltas = dCost_dValues.data();
+	k.mulActivationDerivative(deltas, values.data(), nodeCount);
+
+	// when most of the previous layer's values are zero (sparse inputs), the weight nudges only need to touch
+	// the columns of the nonzero ones
+	// this saves most of the write traffic, and when several threads share the weights (see hogwildTrainer),
+	// leaves the other columns free for their updates instead of rewriting them unchanged
+	int* nonzero = nullptr;
+	int nonzeroCount = -1;
+
+	if (storage == storageType::float32)
 	{
-		n.backprop(accumulate, learningRate, false);
+		nonzero = scratchIndexes(prevNodeCount);
+		nonzeroCount = findNonzero(in, prevNodeCount, nonzero, prevNodeCount / sparseBackwardRatio);
+	}
+
+	// the nonzero inputs, packed to line up with nonzero
+	float* packed = nonzeroCount >= 0 ? scratchFloats(nonzeroCount) : nullptr;
+
+	for (int n = 0; n < nonzeroCount; ++n)
+	{
+		packed[n] = in[nonzero[n]];
+	}
+
+	for (int i = 0; i < nodeCount; ++i)
+	{
+
+		const float delta = deltas[i];
+		const float step = learningRate * delta;
+
+		// nothing to nudge or propagate: no error reached this node, or it is saturated so that 1 - value^2 rounds to 0
+		if (delta == 0) continue;
+
+		// nudge the bias
+		if (accumulate)
+		{
+			biasNudgeSums[i] -= step;
+		}
+		else
+		{
+			b[i] -= step;
+		}
+
+
+		// only the stored weights, and their nudges, which are laid out the same way
+		if (storage == storageType::sparse)
+		{
+			const size_t begin = pattern->rowStarts[i];
+			const size_t count = pattern->rowStarts[i + 1] - begin;
+			const int* columns = pattern->columns.data() + begin;
+
+			float* w = sparseWeights.get() + begin;
+
+			// propagate before the weights change, as below
+			if (propagate)
+			{
+				k.axpyScatter(prevDCost, columns, delta, w, count);
+			}
+
+			k.axpyGather(accumulate ? weightNudgeSums.data() + begin : w, -step, columns, in, count);
+
+			continue;
+		}
+
+
+		float* row = weightsAsFloat((size_t) i * prevNodeCount, prevNodeCount, scratch);
+
+		// nudge the dCost_dValue of the L-1 layer nodes, using the weights from before this update
+		// this has to be +=, not -= // also, this one is not scaled by learningRate
+		if (propagate)
+		{
+			k.axpy(prevDCost, delta, row, prevNodeCount);
+		}
+
+		// nudge the weights, dUnactivated_dWeight is just the previous layer's value
+		if (packed)
+		{
+			k.axpyScatter(accumulate ? weightNudgeSums.data() + (size_t) i * prevNodeCount : row, nonzero, -step, packed, nonzeroCount);
+		}
+		else if (accumulate)
+		{
+			k.axpy(weightNudgeSums.data() + (size_t) i * prevNodeCount, -step, in, prevNodeCount);
+		}
+		else
+		{
+			k.axpy(row, -step, in, prevNodeCount);
+			commitWeights((size_t) i * prevNodeCount, prevNodeCount, row);
+		}
+
 	}
 
 }
@@ -69,30 +763,273 @@ void nnet::layer::backprop (bool accumulate, float learningRate)
 
 void nnet::layer::backpropApply (int trainDataCount)
 {
-	for (node &n: nodes)
+	allocateNudgeSums();
+
+	++optimizerStep;
+
+	backpropApplyBiases(trainDataCount);
+	backpropApplyWeights(trainDataCount, 0, weightNudgeSums.size());
+}
+
+
+// the state entry for parameter i, or nullptr if the optimizer doesn't use this state
+static float* stateAt (std::vector<float> &state, size_t i)
+{
+	return state.empty() ? nullptr : state.data() + i;
+}
+
+// one fused pass of the optimizer over count parameters, which also clears their nudges
+static void applyOptimizer (const nnet::optimizerSettings &settings, int step, float* params, float* state0, float* state1, float* nudges, float scale, size_t count)
+{
+
+	const nnet::kernels::table &k = nnet::kernels::get();
+
+	switch (settings.type)
 	{
-		n.backpropApply(trainDataCount);
+		case nnet::optimizerType::sgd:
+			k.applyNudges(params, nudges, scale, count);
+			break;
+
+		case nnet::optimizerType::momentum:
+			k.applyMomentum(params, state0, nudges, scale, settings.momentum, count);
+			break;
+
+		case nnet::optimizerType::rmsprop:
+			k.applyRMSProp(params, state1, nudges, scale, settings.rmsDecay, settings.stepSize, settings.epsilon, count);
+			break;
+
+		case nnet::optimizerType::adam:
+		{
+			// fold the bias correction of both running means into the step size
+			const float correction = std::sqrt(1 - std::pow(settings.beta2, step)) / (1 - std::pow(settings.beta1, step));
+
+			k.applyAdam(params, state0, state1, nudges, scale, settings.beta1, settings.beta2, settings.stepSize * correction, settings.epsilon, count);
+			break;
+		}
 	}
+
 }
 
 
-void nnet::layer::backpropClear ()
+// half-precision weights are converted and applied this many at a time
+static const size_t applyChunk = 4096;
+
+void nnet::layer::backpropApplyWeights (int trainDataCount, size_t begin, size_t end)
 {
-	for (node &n: nodes)
+
+	const float scale = 1.0f / trainDataCount;
+
+	// sparse weights line up with their nudges just as float32 ones do
+	float* w = storage == storageType::float32 ? weights.get() : storage == storageType::sparse ? sparseWeights.get() : nullptr;
+
+	if (w)
 	{
-		n.backpropClear();
+		applyOptimizer(optimizer, optimizerStep, w + begin, stateAt(weightState[0], begin), stateAt(weightState[1], begin), weightNudgeSums.data() + begin, scale, end - begin);
+		return;
 	}
+
+	float* scratch = scratchFloats(applyChunk);
+
+	for (size_t c0 = begin; c0 < end; c0 += applyChunk)
+	{
+		const size_t count = std::min(applyChunk, end - c0);
+
+		float* w = weightsAsFloat(c0, count, scratch);
+		applyOptimizer(optimizer, optimizerStep, w, stateAt(weightState[0], c0), stateAt(weightState[1], c0), weightNudgeSums.data() + c0, scale, count);
+		commitWeights(c0, count, w);
+	}
+
 }
 
+void nnet::layer::backpropApplyBiases (int trainDataCount)
+{
+	applyOptimizer(optimizer, optimizerStep, biases.get(), stateAt(biasState[0], 0), stateAt(biasState[1], 0), biasNudgeSums.data(), 1.0f / trainDataCount, nodeCount);
+}
 
-void nnet::layer::resetVitalCache ()
+
+void nnet::layer::setOptimizer (const optimizerSettings &settings)
+{
+
+	optimizer = settings;
+	optimizerStep = 0;
+
+	const bool firstState = settings.type == optimizerType::momentum || settings.type == optimizerType::adam;
+	const bool secondState = settings.type == optimizerType::rmsprop || settings.type == optimizerType::adam;
+
+	const bool uses[2] = {firstState, secondState};
+
+	for (int i = 0; i < 2; ++i)
+	{
+		weightState[i].assign(uses[i] ? storedWeightCount() : 0, 0);
+		biasState[i].assign(uses[i] ? biasNudgeSums.size() : 0, 0);
+	}
+
+}
+
+
+
+// samples per pass of the batched backprop kernels
+// a weight row or nudge row is read and written once per block instead of once per sample
+static const size_t backpropSampleBlock = 4; // must match kernels::table::axpy4()
+static const size_t backpropSampleTile = 16;
+
+void nnet::layer::backpropBatchOutput (const float* ideals, size_t count)
+{
+
+	batchDeltas.resize(count * nodeCount);
+
+	for (size_t i = 0; i < count * nodeCount; ++i)
+	{
+		batchDeltas[i] = 2 * (batchValues[i] - ideals[i]);
+	}
+
+	kernels::get().mulActivationDerivative(batchDeltas.data(), batchValues.data(), count * nodeCount);
+
+}
+
+
+void nnet::layer::backpropBatch (const float* in, size_t count, float learningRate, float* prevDeltas)
+{
+
+	allocateNudgeSums();
+
+	const kernels::table &k = kernels::get();
+
+	const float* d = batchDeltas.data();
+
+	const size_t blockEnd = count - count % backpropSampleBlock;
+
+
+	if (storage == storageType::sparse)
+	{
+		backpropBatchSparse(in, count, learningRate, prevDeltas);
+		return;
+	}
+
+
+	// dCost_dPrevValue = deltas * W, one row per sample
+	// the samples are tiled so each weight row is loaded (and converted, for half-precision storage) once per tile
+	if (prevDeltas)
+	{
+		std::fill(prevDeltas, prevDeltas + count * prevNodeCount, 0);
+
+		float* scratch = scratchFloats(prevNodeCount);
+
+		for (size_t s0 = 0; s0 < count; s0 += backpropSampleTile)
+		{
+			const size_t s1 = std::min(s0 + backpropSampleTile, count);
+
+			for (int i = 0; i < nodeCount; ++i)
+			{
+				const float* row = weightsAsFloat((size_t) i * prevNodeCount, prevNodeCount, scratch);
+
+				for (size_t s = s0; s < s1; ++s)
+				{
+					k.axpy(prevDeltas + s * prevNodeCount, d[s * nodeCount + i], row, prevNodeCount);
+				}
+			}
+		}
+
+		// turn dCost_dPrevValue into the previous layer's dCost_dUnactivated
+		k.mulActivationDerivative(prevDeltas, in, count * prevNodeCount);
+	}
+
+
+	// weight nudges are the outer products of the deltas and the inputs, summed over the batch
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		float* nudgeRow = weightNudgeSums.data() + (size_t) i * prevNodeCount;
+
+		float biasNudge = 0;
+
+		for (size_t s = 0; s < blockEnd; s += backpropSampleBlock)
+		{
+			float steps[backpropSampleBlock];
+
+			for (size_t j = 0; j < backpropSampleBlock; ++j)
+			{
+				steps[j] = -learningRate * d[(s + j) * nodeCount + i];
+				biasNudge += steps[j];
+			}
+
+			k.axpy4(nudgeRow, steps, in + (s + 0) * prevNodeCount, in + (s + 1) * prevNodeCount, in + (s + 2) * prevNodeCount, in + (s + 3) * prevNodeCount, prevNodeCount);
+		}
+
+		for (size_t s = blockEnd; s < count; ++s)
+		{
+			const float step = -learningRate * d[s * nodeCount + i];
+
+			biasNudge += step;
+
+			k.axpy(nudgeRow, step, in + s * prevNodeCount, prevNodeCount);
+		}
+
+		biasNudgeSums[i] += biasNudge;
+	}
+
+}
+
+
+// the same for sparse storage, one sample at a time, since each row is too short to be worth tiling
+void nnet::layer::backpropBatchSparse (const float* in, size_t count, float learningRate, float* prevDeltas)
 {
 
-	for (node &n: nodes)
+	const kernels::table &k = kernels::get();
+
+	const float* d = batchDeltas.data();
+
+	const size_t* starts = pattern->rowStarts.data();
+	const int* columns = pattern->columns.data();
+	const float* w = sparseWeights.get();
+
+	if (prevDeltas)
+	{
+		std::fill(prevDeltas, prevDeltas + count * prevNodeCount, 0);
+
+		for (size_t s = 0; s < count; ++s)
+		{
+			for (int i = 0; i < nodeCount; ++i)
+			{
+				k.axpyScatter(prevDeltas + s * prevNodeCount, columns + starts[i], d[s * nodeCount + i], w + starts[i], starts[i + 1] - starts[i]);
+			}
+		}
+
+		k.mulActivationDerivative(prevDeltas, in, count * prevNodeCount);
+	}
+
+	for (int i = 0; i < nodeCount; ++i)
 	{
-		n.resetVitalCache();
+		float biasNudge = 0;
+
+		for (size_t s = 0; s < count; ++s)
+		{
+			const float step = -learningRate * d[s * nodeCount + i];
+
+			biasNudge += step;
+
+			k.axpyGather(weightNudgeSums.data() + starts[i], step, columns + starts[i], in + s * prevNodeCount, starts[i + 1] - starts[i]);
+		}
+
+		biasNudgeSums[i] += biasNudge;
 	}
 
 }
 
 
+void nnet::layer::backpropClear ()
+{
+	std::fill(biasNudgeSums.begin(), biasNudgeSums.end(), 0);
+	std::fill(weightNudgeSums.begin(), weightNudgeSums.end(), 0);
+}
+
+
+void nnet::layer::allocateNudgeSums ()
+{
+	if (weightNudgeSums.size() != storedWeightCount()) weightNudgeSums.assign(storedWeightCount(), 0);
+}
+
+
+void nnet::layer::resetVitalCache ()
+{
+	std::fill(dCost_dValues.begin(), dCost_dValues.end(), 0);
+}
@@ -1,46 +1,79 @@
 #include "../include/nnet.hpp"
 
+#include "kernels.hpp"
+#include "profile.hpp"
+#include "replica.hpp"
 
-nnet::neural::neural (int middleLayerCount, int inputNodeCount, int middleNodeCount, int outputNodeCount)
-: m_middleLayerCount {middleLayerCount},
-	m_inputNodeCount {inputNodeCount},
-	m_middleNodeCount {middleNodeCount},
-	m_outputNodeCount {outputNodeCount}
+#include <algorithm>
+
+
+// the node counts of a network with equally sized middle layers
+static std::vector<int> uniformNodeCounts (int middleLayerCount, int inputNodeCount, int middleNodeCount, int outputNodeCount)
 {
 
 	if (middleLayerCount < 0)
 	{
 		throw nnet::usageError("Middle layer count must be >= 0");
 	}
-	if (inputNodeCount < 1)
-	{
-		throw nnet::usageError("Input node count must be >= 1");
-	}
 	if (middleNodeCount < 1)
 	{
 		throw nnet::usageError("Middle node count must be >= 1");
 	}
-	if (outputNodeCount < 1)
+
+	std::vector<int> nodeCounts {inputNodeCount};
+	nodeCounts.insert(nodeCounts.end(), middleLayerCount, middleNodeCount);
+	nodeCounts.push_back(outputNodeCount);
+
+	return nodeCounts;
+
+}
+
+
+nnet::neural::neural (int middleLayerCount, int inputNodeCount, int middleNodeCount, int outputNodeCount)
+: neural(uniformNodeCounts(middleLayerCount, inputNodeCount, middleNodeCount, outputNodeCount), true)
+{
+}
+
+nnet::neural::neural (std::vector<int> nodeCounts)
+: neural(nodeCounts, true)
+{
+}
+
+nnet::neural::neural (std::vector<int> nodeCounts, bool allocateParams)
+: m_nodeCounts {nodeCounts}
+{
+
+	if (nodeCounts.size() < 2)
+	{
+		throw nnet::usageError("A network needs at least an input and an output layer");
+	}
+	if (nodeCounts.front() < 1)
+	{
+		throw nnet::usageError("Input node count must be >= 1");
+	}
+	if (nodeCounts.back() < 1)
 	{
 		throw nnet::usageError("Output node count must be >= 1");
 	}
+	if (std::any_of(nodeCounts.begin(), nodeCounts.end(), [] (int count) { return count < 1; }))
+	{
+		throw nnet::usageError("Middle node count must be >= 1");
+	}
 
 	regenUID();
 
-	std::shared_ptr<layer> inpLayer = std::make_shared<layer>(inputNodeCount);
+	std::shared_ptr<layer> inpLayer = std::make_shared<layer>(nodeCounts.front());
 	layers.emplace_back(inpLayer);
 
 	inputLayer = inpLayer;
 
-	for (int i = 0; i < middleLayerCount; ++i)
+	for (size_t i = 1; i + 1 < nodeCounts.size(); ++i)
 	{
-		std::weak_ptr<layer> prevLayer = layers.back();
-		std::shared_ptr<layer> middleLayer = std::make_shared<layer>(middleNodeCount, prevLayer);
+		std::shared_ptr<layer> middleLayer = std::make_shared<layer>(nodeCounts[i], layers.back()->nodeCount, allocateParams);
 		layers.emplace_back(middleLayer);
 	}
 
-	std::weak_ptr<layer> prevLayer = layers.back();
-	std::shared_ptr<layer> outLayer = std::make_shared<layer>(outputNodeCount, prevLayer);
+	std::shared_ptr<layer> outLayer = std::make_shared<layer>(nodeCounts.back(), layers.back()->nodeCount, allocateParams);
 	layers.emplace_back(outLayer);
 
 	outputLayer = outLayer;
@@ -48,6 +81,29 @@ nnet::neural::neural (int middleLayerCount, int inputNodeCount, int middleNodeCo
 }
 
 
+std::vector<int> nnet::neural::getNodeCounts () const
+{
+	return m_nodeCounts;
+}
+
+
+nnet::inferenceContext::inferenceContext (const neural &network, size_t maxBatch)
+{
+
+	size_t widest = 0;
+
+	for (int i = 1; i < (int) network.layers.size() - 1; ++i)
+	{
+		widest = std::max<size_t>(widest, network.layers.at(i)->nodeCount);
+	}
+
+	buffers[0].resize(widest * maxBatch);
+	buffers[1].resize(widest * maxBatch);
+
+}
+
+
+
 std::string nnet::neural::getUID ()
 {
 	return m_UID;
@@ -63,6 +119,34 @@ nnet::neural* nnet::neural::split ()
 	return makeCopy_m(false);
 }
 
+static bool sameOptimizer (const nnet::optimizerSettings &a, const nnet::optimizerSettings &b)
+{
+	return a.type == b.type && a.momentum == b.momentum && a.rmsDecay == b.rmsDecay && a.beta1 == b.beta1 && a.beta2 == b.beta2
+		&& a.stepSize == b.stepSize && a.epsilon == b.epsilon;
+}
+
+bool nnet::replicaMatches (const neural &network, const neural &replica)
+{
+
+	if (replica.layers.size() != network.layers.size()) return false;
+
+	for (int i = 1; i < network.layers.size(); ++i)
+	{
+		const layer &l = *network.layers.at(i);
+		const layer &r = *replica.layers.at(i);
+
+		if (r.storage != l.storage || r.pattern != l.pattern) return false;
+
+		if (r.weights != l.weights || r.halfWeights != l.halfWeights || r.sparseWeights != l.sparseWeights || r.biases != l.biases) return false;
+
+		if (!sameOptimizer(r.optimizer, l.optimizer)) return false;
+	}
+
+	return true;
+
+}
+
+
 nnet::neural* nnet::neural::makeCopy_m (bool copyWeights)
 {
 
@@ -77,17 +161,8 @@ nnet::neural* nnet::neural::makeCopy_m (bool copyWeights)
 
 		copiedNeural->layers.at(i) = copiedLayer;
 
-
-		if (i == 0) continue;
-
-		for (node &n: copiedLayer->nodes)
-		{
-			// fix the prevLayer pointers for all layers (except first layer)
-			n.prevLayer = copiedNeural->layers.at(i - 1);
-
-			// also copy the weights
-			if (copyWeights) n.weights = std::make_shared<std::vector<float>>(*n.weights);
-		}
+		// the copied layer still points to the original parameters, so give it its own, unless this is a split()
+		if (copyWeights) copiedLayer->unshareParams();
 
 	}
 
@@ -110,38 +185,178 @@ void nnet::neural::calculate ()
 	// start at index 1 because the input layer does not need to be calculated
 	for (int i = 1; i < layers.size(); ++i)
 	{
-		layers.at(i)->calculate();
+		layer &l = *layers.at(i);
+
+		NNET_PROFILE_SCOPE(l.profile, profilePhase::forward, 1, 1, profile::forwardFlops(l, 1), profile::forwardBytes(l, 1));
+
+		l.calculate(*layers.at(i - 1));
+	}
+
+}
+
+
+void nnet::neural::calculateBatch (const float* inputs, size_t count, float* outputs)
+{
+	calculateBatch(m_batchContext, inputs, count, outputs);
+}
+
+
+void nnet::neural::calculate (inferenceContext &ctx, const float* input, float* output) const
+{
+
+	// ping-pong between the two context buffers, and write the output layer straight into output
+	const float* in = input;
+
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		const layer &l = *layers.at(i);
+
+		float* out = output;
+
+		if (i != layers.size() - 1)
+		{
+			std::vector<float> &buf = ctx.buffers[i % 2];
+			if (buf.size() < (size_t) l.nodeCount) buf.resize(l.nodeCount);
+			out = buf.data();
+		}
+
+		{
+			NNET_PROFILE_SCOPE(l.profile, profilePhase::forward, 1, 1, profile::forwardFlops(l, 1), profile::forwardBytes(l, 1));
+
+			l.calculate(in, out);
+		}
+
+		in = out;
+	}
+
+}
+
+
+void nnet::neural::calculateBatch (inferenceContext &ctx, const float* inputs, size_t count, float* outputs) const
+{
+
+	if (count == 0) return;
+
+	// same as calculate(), but with count rows per layer
+	const float* in = inputs;
+
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		const layer &l = *layers.at(i);
+
+		float* out = outputs;
+
+		if (i != layers.size() - 1)
+		{
+			std::vector<float> &buf = ctx.buffers[i % 2];
+			if (buf.size() < count * l.nodeCount) buf.resize(count * l.nodeCount);
+			out = buf.data();
+		}
+
+		{
+			NNET_PROFILE_SCOPE(l.profile, profilePhase::forward, 1, count, profile::forwardFlops(l, count), profile::forwardBytes(l, count));
+
+			l.calculateBatch(in, count, out);
+		}
+
+		in = out;
 	}
 
 }
 
 
 void nnet::neural::randomize ()
+{
+	randomize(threadRng());
+}
+
+void nnet::neural::randomize (rng &generator)
 {
 
 	// start at index 1 because the input layer does not need to be randomized
 	for (int i = 1; i < layers.size(); ++i)
 	{
-		layers.at(i)->randomize();
+		layers.at(i)->randomize(generator);
 	}
 
 }
 
 void nnet::neural::tweak (float magnitude)
+{
+	tweak(magnitude, threadRng());
+}
+
+void nnet::neural::tweak (float magnitude, rng &generator)
 {
 
 	// start at index 1 because the input layer does not need to be tweaked
 	for (int i = 1; i < layers.size(); ++i)
 	{
-		layers.at(i)->tweak(magnitude);
+		layers.at(i)->tweak(magnitude, generator);
+	}
+
+}
+
+
+void nnet::neural::setStorageType (storageType type)
+{
+
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		layers.at(i)->setStorageType(type);
+	}
+
+}
+
+nnet::storageType nnet::neural::getStorageType () const
+{
+	return outputLayer->storage;
+}
+
+
+void nnet::neural::prune (float fraction)
+{
+
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		layers.at(i)->prune(fraction);
 	}
 
 }
 
 
-void nnet::neural::backprop (bool accumulate, float learningRate, std::vector<float> ideal)
+void nnet::neural::setOptimizer (const optimizerSettings &settings)
+{
+
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		layers.at(i)->setOptimizer(settings);
+	}
+
+}
+
+nnet::optimizerSettings nnet::neural::getOptimizer () const
+{
+	return outputLayer->optimizer;
+}
+
+
+void nnet::neural::backprop (bool accumulate, float learningRate, const std::vector<float> &ideal)
+{
+	backprop(accumulate, learningRate, ideal.data(), ideal.size());
+}
+
+void nnet::neural::backprop (bool accumulate, float learningRate, const float* ideal, size_t count)
 {
 
+	// the optimizers only run in backpropApply(), so a single sample goes through it as a batch of one
+	if (!accumulate && getOptimizer().type != optimizerType::sgd)
+	{
+		backprop(true, learningRate, ideal, count);
+		backpropApply();
+		return;
+	}
+
 	// backprop cache doesn't need to be reset every time if processing a minibatch
 	// also, update trainDataCount variable
 	if (accumulate)
@@ -160,12 +375,22 @@ void nnet::neural::backprop (bool accumulate, float learningRate, std::vector<fl
 	}
 
 
-	outputLayer->backprop(accumulate, learningRate, ideal);
+	{
+		layer &l = *outputLayer;
+
+		NNET_PROFILE_SCOPE(l.profile, profilePhase::backward, 1, 1, profile::backwardFlops(l, 1), profile::backwardBytes(l, 1));
+
+		l.backprop(accumulate, learningRate, *layers.at(layers.size() - 2), ideal, count);
+	}
 
 	// iterate backwards through all middle layers
 	for (int i = layers.size() - 2; i >= 1; --i)
 	{
-		layers.at(i)->backprop(accumulate, learningRate);
+		layer &l = *layers.at(i);
+
+		NNET_PROFILE_SCOPE(l.profile, profilePhase::backward, 1, 1, profile::backwardFlops(l, 1), profile::backwardBytes(l, 1));
+
+		l.backprop(accumulate, learningRate, *layers.at(i - 1));
 	}
 
 }
@@ -176,10 +401,14 @@ void nnet::neural::backpropApply ()
 
 	for (int i = 1; i < layers.size(); ++i)
 	{
-		layers.at(i)->backpropApply(trainDataCount);
+		layer &l = *layers.at(i);
+
+		NNET_PROFILE_SCOPE(l.profile, profilePhase::apply, 1, 0, profile::applyFlops(l, 0, l.storedWeightCount(), true), profile::applyBytes(l, 0, l.storedWeightCount(), true));
+
+		l.backpropApply(trainDataCount);
 
 		// technically, this operation isn't needed, but it's good for formality
-		layers.at(i)->resetVitalCache();
+		l.resetVitalCache();
 	}
 
 	trainDataCount = 0;
@@ -187,6 +416,111 @@ void nnet::neural::backpropApply ()
 }
 
 
+void nnet::neural::backpropBatch (const float* inputs, const float* ideals, size_t count, float learningRate)
+{
+
+	if (count == 0) return;
+
+
+	// forward pass, keeping every layer's values for the backward pass
+	const float* in = inputs;
+
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		layer &l = *layers.at(i);
+
+		l.batchValues.resize(count * l.nodeCount);
+
+		{
+			NNET_PROFILE_SCOPE(l.profile, profilePhase::forward, 1, count, profile::forwardFlops(l, count), profile::forwardBytes(l, count));
+
+			l.calculateBatch(in, count, l.batchValues.data());
+		}
+
+		in = l.batchValues.data();
+	}
+
+
+	{
+		NNET_PROFILE_SCOPE(outputLayer->profile, profilePhase::backward, 0, 0, 0, 0);
+
+		outputLayer->backpropBatchOutput(ideals, count);
+	}
+
+	// iterate backwards through all layers, the input layer's deltas are never needed
+	for (int i = layers.size() - 1; i >= 1; --i)
+	{
+		layer &l = *layers.at(i);
+
+		const float* prevValues = inputs;
+		float* prevDeltas = nullptr;
+
+		if (i > 1)
+		{
+			layer &prev = *layers.at(i - 1);
+
+			prev.batchDeltas.resize(count * prev.nodeCount);
+
+			prevValues = prev.batchValues.data();
+			prevDeltas = prev.batchDeltas.data();
+		}
+
+		NNET_PROFILE_SCOPE(l.profile, profilePhase::backward, 1, count, profile::backwardFlops(l, count), profile::backwardBytes(l, count));
+
+		l.backpropBatch(prevValues, count, learningRate, prevDeltas);
+	}
+
+
+	trainDataCount += count;
+
+}
+
+
+void nnet::neural::trainBatch (const float* inputs, const float* ideals, size_t count, float learningRate)
+{
+	backpropBatch(inputs, ideals, count, learningRate);
+	backpropApply();
+}
+
+
+void nnet::neural::backpropMergeFrom (neural& other)
+{
+
+	if (other.layers.size() != layers.size())
+	{
+		throw nnet::usageError("cannot merge backprop data from a network with a different topology");
+	}
+
+	const kernels::table &k = kernels::get();
+
+	for (int i = 1; i < layers.size(); ++i)
+	{
+		layer &l = *layers.at(i);
+		layer &o = *other.layers.at(i);
+
+		if (o.nodeCount != l.nodeCount || o.prevNodeCount != l.prevNodeCount)
+		{
+			throw nnet::usageError("cannot merge backprop data from a network with a different topology");
+		}
+
+		// sparse nudges only line up if both layers have the same pattern
+		if (o.storedWeightCount() != l.storedWeightCount() || (l.storage == storageType::sparse && o.pattern != l.pattern))
+		{
+			throw nnet::usageError("cannot merge backprop data from a network with a different sparsity pattern");
+		}
+
+		l.allocateNudgeSums();
+
+		// a network that was never trained has no weight nudges to add
+		if (!o.weightNudgeSums.empty()) k.axpy(l.weightNudgeSums.data(), 1, o.weightNudgeSums.data(), l.weightNudgeSums.size());
+		k.axpy(l.biasNudgeSums.data(), 1, o.biasNudgeSums.data(), l.nodeCount);
+	}
+
+	trainDataCount += other.trainDataCount;
+
+}
+
+
 void nnet::neural::backpropClear ()
 {
 	for (int i = 1; i < layers.size(); ++i)
@@ -199,32 +533,83 @@ void nnet::neural::backpropClear ()
 
 
 
-float nnet::neural::cost (std::vector<float> ideal)
+float nnet::neural::cost (const std::vector<float> &ideal)
 {
-	float costSum = 0;
+	return cost(ideal.data(), ideal.size());
+}
 
-	for (int i = 0; i < outputLayer->nodes.size(); ++i)
+float nnet::neural::cost (const float* ideal, size_t count)
+{
+
+	if (count < (size_t) outputLayer->nodeCount)
 	{
-		node &n = outputLayer->nodes.at(i);
+		throw nnet::usageError("ideal output vector is smaller than the output layer");
+	}
+
+	float costSum = 0;
 
-		costSum += n.cost(ideal.at(i));
+	for (int i = 0; i < outputLayer->nodeCount; ++i)
+	{
+		costSum += outputLayer->getNode(i).cost(ideal[i]);
 	}
 
 	return costSum;
+
 }
 
 
 
 void nnet::neural::clearInput (float value)
 {
-	for (node &n: inputLayer->nodes)
-		n.value = value;
+	std::fill(inputLayer->values.begin(), inputLayer->values.end(), value);
 }
 
 void nnet::neural::setInput (const std::vector<float> &input)
 {
-	for (size_t i = 0; i < inputLayer->nodes.size(); ++i)
-		inputLayer->nodes[i].value = input.at(i);
+	setInput(input.data(), input.size());
+}
+
+void nnet::neural::setInput (const float* input, size_t count)
+{
+
+	if (count < inputLayer->values.size())
+	{
+		throw nnet::usageError("input vector is smaller than the input layer");
+	}
+
+	std::copy(input, input + inputLayer->values.size(), inputLayer->values.begin());
+
+}
+
+void nnet::neural::setInputSparse (const int* indexes, const float* values, size_t count)
+{
+
+	std::vector<float> &in = inputLayer->values;
+
+	std::fill(in.begin(), in.end(), 0);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (indexes[i] < 0 || indexes[i] >= (int) in.size())
+		{
+			throw nnet::usageError("input index " + std::to_string(indexes[i]) + " is out of range, the network has " + std::to_string(in.size()) + " inputs");
+		}
+
+		in[indexes[i]] = values[i];
+	}
+
+}
+
+void nnet::neural::getOutput (float* output, size_t count) const
+{
+
+	if (count < outputLayer->values.size())
+	{
+		throw nnet::usageError("output buffer is smaller than the output layer");
+	}
+
+	std::copy(outputLayer->values.begin(), outputLayer->values.end(), output);
+
 }
 
 
@@ -237,13 +622,13 @@ int nnet::neural::selectOutputFixed ()
 	float max = -100;
 	int maxInd = -1;
 
-	for (int i = 0; i < outputLayer->nodes.size(); ++i)
+	for (int i = 0; i < outputLayer->nodeCount; ++i)
 	{
-		node &n = outputLayer->nodes.at(i);
+		float value = outputLayer->values[i];
 
-		if (n.value > max)
+		if (value > max)
 		{
-			max = n.value;
+			max = value;
 			maxInd = i;
 		}
 	}
@@ -259,33 +644,41 @@ int nnet::neural::selectOutputFixed ()
 // use the neural network's output as probability weights for each possible selection
 int nnet::neural::selectOutput ()
 {
+	return selectOutput(threadRng());
+}
 
-	std::vector<float> weights;
-	float weightSum = 0;
+int nnet::neural::selectOutput (rng &generator)
+{
+
+	const std::vector<float> &values = outputLayer->values;
 
 	// need to add 1.1 to the values because they could be negative
 	// this converts the range into [0.1, 2.1]
-	for (node &n: outputLayer->nodes)
+	// the weights are recomputed on the second pass, rather than stored, so that this doesn't allocate
+	float weightSum = 0;
+
+	for (float value: values)
 	{
-		weights.push_back(n.value + 1.1);
-		weightSum += n.value + 1.1;
+		weightSum += value + 1.1f;
 	}
 
-	float randNum = randFloat() * weightSum;
+	float randNum = generator.nextFloat() * weightSum;
 
-	for (int i = 0; i < weights.size(); ++i)
+	for (int i = 0; i < values.size(); ++i)
 	{
-		if (weights.at(i) > randNum)
+		const float weight = values[i] + 1.1f;
+
+		if (weight > randNum)
 		{
 			return i;
 		}
 
-		randNum -= weights.at(i);
+		randNum -= weight;
 	}
 
 	// if control reaches here, randNum is likely almost equal to weightSum
 
-	return weights.size() - 1;
+	return values.size() - 1;
 
 }
 
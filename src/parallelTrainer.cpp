@@ -0,0 +1,164 @@
+#include "../include/nnet.hpp"
+#include "kernels.hpp"
+#include "threadPool.hpp"
+#include "profile.hpp"
+#include "replica.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+nnet::parallelTrainer::parallelTrainer (neural &network, int threadCount)
+: m_network {network},
+	m_pool {new threadPool(threadCount)}
+{
+	splitReplicas();
+}
+
+
+void nnet::parallelTrainer::splitReplicas ()
+{
+
+	m_ownedReplicas.clear();
+	m_replicas.assign(1, &m_network);
+
+	for (int i = 1; i < m_pool->getThreadCount(); ++i)
+	{
+		m_ownedReplicas.emplace_back(m_network.split());
+		m_replicas.push_back(m_ownedReplicas.back().get());
+	}
+
+}
+
+// defined here, where threadPool is a complete type
+nnet::parallelTrainer::~parallelTrainer () = default;
+
+
+int nnet::parallelTrainer::getThreadCount ()
+{
+	return m_pool->getThreadCount();
+}
+
+
+void nnet::parallelTrainer::trainBatch (const float* inputs, const float* ideals, size_t count, float learningRate)
+{
+
+	if (count == 0) return;
+
+	// the network may have been given new parameter buffers, or a new nudge layout, since the replicas were split off
+	for (size_t r = 1; r < m_replicas.size(); ++r)
+	{
+		if (!replicaMatches(m_network, *m_replicas[r]))
+		{
+			splitReplicas();
+			break;
+		}
+	}
+
+	const size_t inputCount = m_network.inputLayer->nodeCount;
+	const size_t outputCount = m_network.outputLayer->nodeCount;
+
+	// don't use more shards than there are samples
+	const int shardCount = (int) std::min<size_t>(m_replicas.size(), count);
+
+	m_pool->parallelFor(shardCount, [&] (int shard)
+	{
+		neural &replica = *m_replicas.at(shard);
+
+		const size_t begin = count * shard / shardCount;
+		const size_t end = count * (shard + 1) / shardCount;
+
+		replica.backpropBatch(inputs + begin * inputCount, ideals + begin * outputCount, end - begin, learningRate);
+	});
+
+	reduceAndApply();
+
+}
+
+
+void nnet::parallelTrainer::reduceAndApply ()
+{
+
+	int totalCount = 0;
+
+	for (neural* replica: m_replicas)
+	{
+		totalCount += replica->trainDataCount;
+	}
+
+	const int sliceCount = m_replicas.size();
+
+	// the slices below apply the nudges piece by piece, so count the optimizer step here, once per layer
+	// replicas that got no samples may not have allocated their nudges yet
+	for (int i = 1; i < m_network.layers.size(); ++i)
+	{
+		++m_network.layers.at(i)->optimizerStep;
+
+		for (neural* replica: m_replicas)
+		{
+			replica->layers.at(i)->allocateNudgeSums();
+		}
+	}
+
+	m_pool->parallelFor(sliceCount, [&] (int slice)
+	{
+		const kernels::table &k = kernels::get();
+
+		for (int i = 1; i < m_network.layers.size(); ++i)
+		{
+			layer &l = *m_network.layers.at(i);
+
+			const size_t size = l.weightNudgeSums.size();
+			const size_t begin = size * slice / sliceCount;
+			const size_t end = size * (slice + 1) / sliceCount;
+
+			const bool withBiases = slice == (i - 1) % sliceCount;
+
+			// summing the replicas' nudges is counted as part of applying them, every slice adds to the same counters
+			NNET_PROFILE_SCOPE(l.profile, profilePhase::apply, slice == 0, 0, profile::applyFlops(l, begin, end, withBiases),
+				profile::applyBytes(l, begin, end, withBiases) + (m_replicas.size() - 1) * 2 * (end - begin) * sizeof(float));
+
+			// each slice of the nudges is summed over the replicas by exactly one thread
+			for (size_t r = 1; r < m_replicas.size(); ++r)
+			{
+				float* nudges = m_replicas.at(r)->layers.at(i)->weightNudgeSums.data();
+
+				k.axpy(l.weightNudgeSums.data() + begin, 1, nudges + begin, end - begin);
+				std::fill(nudges + begin, nudges + end, 0);
+			}
+
+			l.backpropApplyWeights(totalCount, begin, end);
+
+			// the biases are tiny, so one thread handles them per layer
+			if (withBiases)
+			{
+				for (size_t r = 1; r < m_replicas.size(); ++r)
+				{
+					std::vector<float> &nudges = m_replicas.at(r)->layers.at(i)->biasNudgeSums;
+
+					k.axpy(l.biasNudgeSums.data(), 1, nudges.data(), l.nodeCount);
+					std::fill(nudges.begin(), nudges.end(), 0);
+				}
+
+				l.backpropApplyBiases(totalCount);
+			}
+		}
+	});
+
+	for (neural* replica: m_replicas)
+	{
+		replica->trainDataCount = 0;
+	}
+
+#ifdef NNET_PROFILE
+	// the forward and backward passes ran on the replicas, so their counts go back into the network
+	for (size_t r = 1; r < m_replicas.size(); ++r)
+	{
+		for (int i = 1; i < m_network.layers.size(); ++i)
+		{
+			m_network.layers.at(i)->profile.takeFrom(m_replicas.at(r)->layers.at(i)->profile);
+		}
+	}
+#endif
+
+}
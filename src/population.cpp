@@ -0,0 +1,535 @@
+#include "../include/nnet.hpp"
+#include "kernels.hpp"
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+
+nnet::population::population (const neural &network, size_t size, int threadCount)
+: m_nodeCounts {network.getNodeCounts()},
+	m_pool {new threadPool(threadCount)},
+	m_rng {threadRng().next()}
+{
+
+	if (size == 0)
+	{
+		throw nnet::usageError("a population needs at least one genome");
+	}
+
+
+	// genome layout: each layer's weights (row-major, like layer::weights), then its biases
+	m_weightOffsets.assign(m_nodeCounts.size(), 0);
+	m_biasOffsets.assign(m_nodeCounts.size(), 0);
+
+	size_t offset = 0;
+
+	for (size_t i = 1; i < m_nodeCounts.size(); ++i)
+	{
+		m_weightOffsets[i] = offset;
+		offset += (size_t) m_nodeCounts[i] * m_nodeCounts[i - 1];
+
+		m_biasOffsets[i] = offset;
+		offset += m_nodeCounts[i];
+	}
+
+	m_paramCount = offset;
+
+	// 16 floats to a 64-byte cache line
+	m_stride = (offset + 15) / 16 * 16;
+
+
+	// the next generation is built while the current one is still alive, so there's room for both
+	const size_t slotCount = 2 * size;
+
+	m_arena = allocFloats(slotCount * m_stride);
+	m_refCounts.assign(slotCount, 0);
+
+	for (size_t slot = slotCount; slot-- > 0;)
+	{
+		m_freeSlots.push_back(slot);
+	}
+
+
+	// every genome starts out sharing one copy of the network
+	const size_t first = acquireSlot();
+
+	m_genomes.assign(1, first);
+	setGenome(0, network);
+
+	m_genomes.assign(size, first);
+	m_refCounts[first] = size;
+
+	m_fitness.assign(size, 0);
+
+
+	for (int i = 0; i < m_pool->getThreadCount(); ++i)
+	{
+		m_contexts.emplace_back(network);
+	}
+
+}
+
+// defined here, where threadPool is a complete type
+nnet::population::~population () = default;
+
+
+
+size_t nnet::population::size () const
+{
+	return m_genomes.size();
+}
+
+std::vector<int> nnet::population::getNodeCounts () const
+{
+	return m_nodeCounts;
+}
+
+size_t nnet::population::getUniqueCount () const
+{
+	return m_refCounts.size() - m_freeSlots.size();
+}
+
+
+void nnet::population::seed (uint64_t seed)
+{
+	m_rng.seed(seed);
+}
+
+
+
+////// slots
+
+float* nnet::population::slotData (size_t slot)
+{
+	return m_arena.get() + slot * m_stride;
+}
+
+const float* nnet::population::slotData (size_t slot) const
+{
+	return m_arena.get() + slot * m_stride;
+}
+
+
+size_t nnet::population::acquireSlot ()
+{
+
+	if (m_freeSlots.empty())
+	{
+		throw nnet::internalError("population arena is full, thrown from nnet::population::acquireSlot()");
+	}
+
+	const size_t slot = m_freeSlots.back();
+	m_freeSlots.pop_back();
+
+	m_refCounts[slot] = 1;
+
+	return slot;
+
+}
+
+void nnet::population::releaseSlot (size_t slot)
+{
+	if (--m_refCounts[slot] == 0)
+	{
+		m_freeSlots.push_back(slot);
+	}
+}
+
+
+float* nnet::population::unshare (size_t genome)
+{
+
+	const size_t slot = m_genomes[genome];
+
+	if (m_refCounts[slot] > 1)
+	{
+		const size_t copy = acquireSlot();
+		std::memcpy(slotData(copy), slotData(slot), m_stride * sizeof(float));
+
+		releaseSlot(slot);
+		m_genomes[genome] = copy;
+	}
+
+	return slotData(m_genomes[genome]);
+
+}
+
+
+void nnet::population::checkIndex (size_t genome) const
+{
+	if (genome >= m_genomes.size())
+	{
+		throw nnet::usageError("genome index out of range");
+	}
+}
+
+
+
+////// genetic operators
+
+void nnet::population::randomize ()
+{
+
+	std::vector<size_t> genomes(m_genomes.size());
+	std::iota(genomes.begin(), genomes.end(), 0);
+
+	forEachUnshared(genomes, [this] (float* params, rng &generator)
+	{
+		generator.fillUniform(params, m_paramCount, -1, 1);
+	});
+
+}
+
+
+void nnet::population::copyGenome (size_t dst, size_t src)
+{
+
+	checkIndex(dst);
+	checkIndex(src);
+
+	const size_t slot = m_genomes[src];
+
+	// take the reference before dropping the old one, in case they're the same slot
+	++m_refCounts[slot];
+	releaseSlot(m_genomes[dst]);
+
+	m_genomes[dst] = slot;
+
+}
+
+
+void nnet::population::mutate (size_t genome, float magnitude)
+{
+
+	checkIndex(genome);
+
+	m_rng.addUniform(unshare(genome), m_paramCount, magnitude);
+
+}
+
+
+void nnet::population::crossover (size_t dst, size_t a, size_t b)
+{
+
+	checkIndex(dst);
+	checkIndex(a);
+	checkIndex(b);
+
+	// always into a fresh slot, so that dst can be one of the parents
+	const size_t slot = acquireSlot();
+
+	float* child = slotData(slot);
+	const float* parents[2] = {slotData(m_genomes[a]), slotData(m_genomes[b])};
+
+	for (size_t i = 1; i < m_nodeCounts.size(); ++i)
+	{
+		const size_t rowSize = m_nodeCounts[i - 1];
+
+		for (int j = 0; j < m_nodeCounts[i]; ++j)
+		{
+			const float* parent = parents[m_rng.next() >> 63];
+
+			const size_t row = m_weightOffsets[i] + j * rowSize;
+			std::memcpy(child + row, parent + row, rowSize * sizeof(float));
+
+			child[m_biasOffsets[i] + j] = parent[m_biasOffsets[i] + j];
+		}
+	}
+
+	releaseSlot(m_genomes[dst]);
+	m_genomes[dst] = slot;
+
+}
+
+
+
+////// evaluation
+
+void nnet::population::calculate (size_t genome, inferenceContext &ctx, const float* input, float* output) const
+{
+
+	checkIndex(genome);
+
+	const kernels::table &k = kernels::get();
+
+	const float* params = slotData(m_genomes[genome]);
+
+	const int widest = *std::max_element(m_nodeCounts.begin(), m_nodeCounts.end());
+
+	for (std::vector<float> &buffer: ctx.buffers)
+	{
+		if (buffer.size() < (size_t) widest) buffer.resize(widest);
+	}
+
+
+	const float* in = input;
+
+	for (size_t i = 1; i < m_nodeCounts.size(); ++i)
+	{
+		const int n = m_nodeCounts[i];
+		const int p = m_nodeCounts[i - 1];
+
+		float* out = i + 1 == m_nodeCounts.size() ? output : ctx.buffers[i % 2].data();
+
+		const float* w = params + m_weightOffsets[i];
+		const float* b = params + m_biasOffsets[i];
+
+		for (int j = 0; j < n; ++j)
+		{
+			out[j] = b[j] + k.dot(w + (size_t) j * p, in, p);
+		}
+
+		k.activate(out, n);
+
+		in = out;
+	}
+
+}
+
+
+void nnet::population::calculateAll (const float* inputs, float* outputs)
+{
+
+	const size_t inputCount = m_nodeCounts.front();
+	const size_t outputCount = m_nodeCounts.back();
+
+	forEachGenome([&] (size_t genome, inferenceContext &ctx)
+	{
+		calculate(genome, ctx, inputs + genome * inputCount, outputs + genome * outputCount);
+	});
+
+}
+
+
+void nnet::population::evaluate (const std::function<float (size_t genome, inferenceContext &ctx)> &fitness)
+{
+	forEachGenome([&] (size_t genome, inferenceContext &ctx)
+	{
+		m_fitness[genome] = fitness(genome, ctx);
+	});
+}
+
+
+void nnet::population::forEachGenome (const std::function<void (size_t genome, inferenceContext &ctx)> &job)
+{
+
+	const int threadCount = m_contexts.size();
+	const size_t count = m_genomes.size();
+
+	// one contiguous range of genomes per thread, each thread with its own context
+	m_pool->parallelFor(threadCount, [&] (int thread)
+	{
+		const size_t begin = count * thread / threadCount;
+		const size_t end = count * (thread + 1) / threadCount;
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			job(i, m_contexts[thread]);
+		}
+	});
+
+}
+
+
+void nnet::population::forEachUnshared (const std::vector<size_t> &genomes, const std::function<void (float* params, rng &generator)> &job)
+{
+
+	// copying shared genomes changes the slot bookkeeping, so that part stays on this thread
+	for (size_t genome: genomes)
+	{
+		unshare(genome);
+	}
+
+
+	const size_t blockSize = 64;
+	const size_t blockCount = (genomes.size() + blockSize - 1) / blockSize;
+
+	m_blockRngs.clear();
+
+	for (size_t b = 0; b < blockCount; ++b)
+	{
+		m_blockRngs.push_back(m_rng.split());
+	}
+
+	const int threadCount = m_contexts.size();
+
+	m_pool->parallelFor(threadCount, [&] (int thread)
+	{
+		for (size_t b = thread; b < blockCount; b += threadCount)
+		{
+			const size_t end = std::min(genomes.size(), (b + 1) * blockSize);
+
+			for (size_t i = b * blockSize; i < end; ++i)
+			{
+				job(slotData(m_genomes[genomes[i]]), m_blockRngs[b]);
+			}
+		}
+	});
+
+}
+
+
+float nnet::population::getFitness (size_t genome) const
+{
+	checkIndex(genome);
+	return m_fitness[genome];
+}
+
+void nnet::population::setFitness (size_t genome, float fitness)
+{
+	checkIndex(genome);
+	m_fitness[genome] = fitness;
+}
+
+
+
+////// selection
+
+std::vector<size_t> nnet::population::rank () const
+{
+
+	std::vector<size_t> order(m_genomes.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	std::stable_sort(order.begin(), order.end(), [this] (size_t a, size_t b)
+	{
+		return m_fitness[a] > m_fitness[b];
+	});
+
+	return order;
+
+}
+
+
+size_t nnet::population::tournament (int tournamentSize)
+{
+
+	const uint32_t count = m_genomes.size();
+
+	size_t best = m_rng.nextBelow(count);
+
+	for (int i = 1; i < tournamentSize; ++i)
+	{
+		const size_t contender = m_rng.nextBelow(count);
+
+		if (m_fitness[contender] > m_fitness[best]) best = contender;
+	}
+
+	return best;
+
+}
+
+
+void nnet::population::nextGeneration (size_t eliteCount, int tournamentSize, float crossoverRate, float mutationMagnitude)
+{
+
+	const size_t count = m_genomes.size();
+
+	eliteCount = std::min(eliteCount, count);
+	tournamentSize = std::max(tournamentSize, 1);
+
+	const std::vector<size_t> order = rank();
+
+
+	// the new generation is built from slots alone, holding a reference to each one it uses
+	// the current generation keeps its own references until the end, so parents stay valid throughout
+	std::vector<size_t> next(count);
+
+	for (size_t i = 0; i < eliteCount; ++i)
+	{
+		next[i] = m_genomes[order[i]];
+		++m_refCounts[next[i]];
+	}
+
+	for (size_t i = eliteCount; i < count; ++i)
+	{
+		const size_t a = tournament(tournamentSize);
+
+		if (m_rng.nextFloat() < crossoverRate)
+		{
+			// build the child in genome a's place for a moment, then move it over to the new generation
+			const size_t parentSlot = m_genomes[a];
+			++m_refCounts[parentSlot];
+
+			crossover(a, a, tournament(tournamentSize));
+
+			next[i] = m_genomes[a];
+			m_genomes[a] = parentSlot;
+		}
+		else
+		{
+			next[i] = m_genomes[a];
+			++m_refCounts[next[i]];
+		}
+	}
+
+
+	for (size_t slot: m_genomes)
+	{
+		releaseSlot(slot);
+	}
+
+	m_genomes = next;
+	std::fill(m_fitness.begin(), m_fitness.end(), 0);
+
+
+	// mutating the shared children copies them, which is why the arena holds two generations
+	std::vector<size_t> children(count - eliteCount);
+	std::iota(children.begin(), children.end(), eliteCount);
+
+	forEachUnshared(children, [mutationMagnitude, this] (float* params, rng &generator)
+	{
+		generator.addUniform(params, m_paramCount, mutationMagnitude);
+	});
+
+}
+
+
+
+////// conversion
+
+nnet::neural* nnet::population::toNeural (size_t genome) const
+{
+
+	checkIndex(genome);
+
+	const float* params = slotData(m_genomes[genome]);
+
+	neural* n1 = new neural(m_nodeCounts);
+
+	for (size_t i = 1; i < m_nodeCounts.size(); ++i)
+	{
+		layer &l = *n1->layers.at(i);
+
+		l.storeWeights(0, (size_t) l.nodeCount * l.prevNodeCount, params + m_weightOffsets[i]);
+		std::memcpy(l.biases.get(), params + m_biasOffsets[i], l.nodeCount * sizeof(float));
+	}
+
+	return n1;
+
+}
+
+
+void nnet::population::setGenome (size_t genome, const neural &network)
+{
+
+	checkIndex(genome);
+
+	if (network.getNodeCounts() != m_nodeCounts)
+	{
+		throw nnet::usageError("network topology does not match the population");
+	}
+
+	float* params = unshare(genome);
+
+	for (size_t i = 1; i < m_nodeCounts.size(); ++i)
+	{
+		const layer &l = *network.layers.at(i);
+
+		l.loadWeights(0, (size_t) l.nodeCount * l.prevNodeCount, params + m_weightOffsets[i]);
+		std::memcpy(params + m_biasOffsets[i], l.biases.get(), l.nodeCount * sizeof(float));
+	}
+
+}
@@ -0,0 +1,161 @@
+#include "../include/nnet.hpp"
+#include "profile.hpp"
+
+#include <cstdio>
+
+
+bool nnet::isProfilingEnabled ()
+{
+#ifdef NNET_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+
+nnet::profileCounters::profileCounters ()
+{
+	reset();
+}
+
+nnet::profileCounters::profileCounters (const profileCounters&)
+{
+	reset();
+}
+
+nnet::profileCounters& nnet::profileCounters::operator= (const profileCounters&)
+{
+	reset();
+	return *this;
+}
+
+
+void nnet::profileCounters::add (profilePhase phase, uint64_t calls, uint64_t samples, uint64_t nanoseconds, uint64_t flops, uint64_t bytes)
+{
+
+	std::atomic<uint64_t>* values = m_values[(int) phase];
+
+	// the counts are only read once the work is done, so nothing needs ordering
+	values[0].fetch_add(calls, std::memory_order_relaxed);
+	values[1].fetch_add(samples, std::memory_order_relaxed);
+	values[2].fetch_add(nanoseconds, std::memory_order_relaxed);
+	values[3].fetch_add(flops, std::memory_order_relaxed);
+	values[4].fetch_add(bytes, std::memory_order_relaxed);
+
+}
+
+
+void nnet::profileCounters::takeFrom (profileCounters &other)
+{
+	for (int p = 0; p < profilePhaseCount; ++p)
+	{
+		for (int f = 0; f < fieldCount; ++f)
+		{
+			m_values[p][f].fetch_add(other.m_values[p][f].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+}
+
+
+nnet::layerProfile nnet::profileCounters::get () const
+{
+
+	layerProfile profile;
+
+	for (int p = 0; p < profilePhaseCount; ++p)
+	{
+		phaseProfile &phase = profile.phases[p];
+
+		phase.calls = m_values[p][0].load(std::memory_order_relaxed);
+		phase.samples = m_values[p][1].load(std::memory_order_relaxed);
+		phase.nanoseconds = m_values[p][2].load(std::memory_order_relaxed);
+		phase.flops = m_values[p][3].load(std::memory_order_relaxed);
+		phase.bytes = m_values[p][4].load(std::memory_order_relaxed);
+	}
+
+	return profile;
+
+}
+
+
+void nnet::profileCounters::reset ()
+{
+	for (int p = 0; p < profilePhaseCount; ++p)
+	{
+		for (int f = 0; f < fieldCount; ++f)
+		{
+			m_values[p][f].store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+
+
+std::vector<nnet::layerProfile> nnet::neural::getProfile () const
+{
+
+	std::vector<layerProfile> profiles;
+
+	for (const std::shared_ptr<layer> &l: layers)
+	{
+		profiles.push_back(l->profile.get());
+	}
+
+	return profiles;
+
+}
+
+
+void nnet::neural::resetProfile ()
+{
+	for (const std::shared_ptr<layer> &l: layers)
+	{
+		l->profile.reset();
+	}
+}
+
+
+std::string nnet::neural::getProfileJson () const
+{
+
+	const char* phaseNames[profilePhaseCount] = {"forward", "backward", "apply"};
+
+	const std::vector<layerProfile> profiles = getProfile();
+
+	std::string json = "{\"enabled\": ";
+	json += isProfilingEnabled() ? "true" : "false";
+	json += ", \"layers\": [";
+
+	char buffer[256];
+
+	for (size_t i = 1; i < profiles.size(); ++i)
+	{
+		const layer &l = *layers.at(i);
+
+		std::snprintf(buffer, sizeof(buffer), "%s{\"layer\": %zu, \"nodes\": %d, \"inputs\": %d", i > 1 ? ", " : "", i, l.nodeCount, l.prevNodeCount);
+		json += buffer;
+
+		for (int p = 0; p < profilePhaseCount; ++p)
+		{
+			const phaseProfile &phase = profiles[i].phases[p];
+
+			std::snprintf(buffer, sizeof(buffer), ", \"%s\": {\"calls\": %llu, \"samples\": %llu, \"ns\": %llu, \"flops\": %llu, \"bytes\": %llu}",
+				phaseNames[p],
+				(unsigned long long) phase.calls,
+				(unsigned long long) phase.samples,
+				(unsigned long long) phase.nanoseconds,
+				(unsigned long long) phase.flops,
+				(unsigned long long) phase.bytes);
+			json += buffer;
+		}
+
+		json += "}";
+	}
+
+	json += "]}";
+
+	return json;
+
+}
@@ -0,0 +1,139 @@
+// internal header, not part of the public interface
+// NNET_PROFILE_SCOPE(...) records the time until the end of the enclosing block into a layer's counters
+// without NNET_PROFILE it expands to nothing, and its arguments are never evaluated
+
+
+#ifndef NNET_PROFILE_INTERNAL_HPP
+#define NNET_PROFILE_INTERNAL_HPP
+
+#include "../include/nnet.hpp"
+
+#include <cstdint>
+
+
+#ifdef NNET_PROFILE
+
+#include <chrono>
+
+namespace nnet
+{
+
+	class profileScope
+	{
+
+		public:
+			profileScope (profileCounters &counters, profilePhase phase, uint64_t calls, uint64_t samples, uint64_t flops, uint64_t bytes)
+			: m_counters {counters}, m_phase {phase}, m_calls {calls}, m_samples {samples}, m_flops {flops}, m_bytes {bytes},
+				m_start {std::chrono::steady_clock::now()}
+			{}
+
+			~profileScope ()
+			{
+				const uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+				m_counters.add(m_phase, m_calls, m_samples, nanoseconds, m_flops, m_bytes);
+			}
+
+
+		private:
+			profileCounters &m_counters;
+			profilePhase m_phase;
+			uint64_t m_calls;
+			uint64_t m_samples;
+			uint64_t m_flops;
+			uint64_t m_bytes;
+			std::chrono::steady_clock::time_point m_start;
+
+			profileScope (const profileScope&) = delete;
+			profileScope& operator= (const profileScope&) = delete;
+
+	};
+
+}
+
+#define NNET_PROFILE_SCOPE(counters, phase, calls, samples, flops, bytes) \
+	nnet::profileScope nnetProfileScope_ {counters, phase, calls, samples, flops, bytes}
+
+#else
+
+#define NNET_PROFILE_SCOPE(counters, phase, calls, samples, flops, bytes) do {} while (false)
+
+#endif
+
+
+namespace nnet
+{
+	namespace profile
+	{
+
+		// the estimates behind the flop and byte counts, for count samples through layer l
+
+		inline uint64_t weightCount (const layer &l)
+		{
+			return l.storedWeightCount();
+		}
+
+		// a sparse weight takes its column index along with its value
+		inline uint64_t bytesPerWeight (const layer &l)
+		{
+			switch (l.storage)
+			{
+				case storageType::float32: return 4;
+				case storageType::sparse: return 8;
+				default: return 2;
+			}
+		}
+
+		inline uint64_t paramBytes (const layer &l)
+		{
+			return weightCount(l) * bytesPerWeight(l) + (uint64_t) l.nodeCount * sizeof(float);
+		}
+
+		// one input row and one output row per sample
+		inline uint64_t rowBytes (const layer &l, uint64_t count)
+		{
+			return count * (l.prevNodeCount + l.nodeCount) * sizeof(float);
+		}
+
+		inline uint64_t forwardFlops (const layer &l, uint64_t count)
+		{
+			return 2 * weightCount(l) * count;
+		}
+
+		// every parameter read once, plus the rows
+		inline uint64_t forwardBytes (const layer &l, uint64_t count)
+		{
+			return paramBytes(l) + rowBytes(l, count);
+		}
+
+		// the deltas go back through the weights, and every weight gets a nudge
+		inline uint64_t backwardFlops (const layer &l, uint64_t count)
+		{
+			return 4 * weightCount(l) * count;
+		}
+
+		// the parameters read, the nudges read and written, and the values and deltas of both layers
+		inline uint64_t backwardBytes (const layer &l, uint64_t count)
+		{
+			return paramBytes(l) + 2 * (weightCount(l) + l.nodeCount) * sizeof(float) + 2 * rowBytes(l, count);
+		}
+
+		// for the weights from begin to end, and the biases if withBiases is set
+		inline uint64_t applyFlops (const layer &l, size_t begin, size_t end, bool withBiases)
+		{
+			return 2 * ((end - begin) + (withBiases ? l.nodeCount : 0));
+		}
+
+		// the parameters read and written, and the nudges read and cleared
+		inline uint64_t applyBytes (const layer &l, size_t begin, size_t end, bool withBiases)
+		{
+			const uint64_t weightBytes = (end - begin) * bytesPerWeight(l);
+			const uint64_t biasBytes = withBiases ? l.nodeCount * sizeof(float) : 0;
+
+			return 2 * (weightBytes + biasBytes) + 2 * ((end - begin) * sizeof(float) + biasBytes);
+		}
+
+	}
+}
+
+
+#endif
@@ -0,0 +1,194 @@
+#include "../include/nnet.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+// round x / scale to the nearest int8, clamped to [-127, 127] so the kernels never see -128
+static inline int8_t quantize (float x, float invScale)
+{
+	long q = std::lrint(x * invScale);
+	return (int8_t) std::max(-127L, std::min(127L, q));
+}
+
+
+nnet::quantizedNetwork::quantizedNetwork (const neural &network, const float* calibrationInputs, size_t count)
+{
+
+	if (count == 0)
+	{
+		throw nnet::usageError("quantizedNetwork needs at least one calibration sample");
+	}
+
+	m_inputCount = network.inputLayer->nodeCount;
+
+
+	// calibrate the input scale
+	float maxInput = 0;
+
+	for (size_t i = 0; i < count * m_inputCount; ++i)
+	{
+		maxInput = std::max(maxInput, std::fabs(calibrationInputs[i]));
+	}
+
+	m_inputScale = maxInput > 0 ? maxInput / 127 : 1.0f / 127;
+
+
+	for (int i = 1; i < network.layers.size(); ++i)
+	{
+		const layer &l = *network.layers.at(i);
+
+		quantizedLayer q;
+		q.nodeCount = l.nodeCount;
+		q.prevNodeCount = l.prevNodeCount;
+		q.weights.resize((size_t) l.nodeCount * l.prevNodeCount);
+		q.scales.resize(l.nodeCount);
+		q.biases.assign(l.biases.get(), l.biases.get() + l.nodeCount);
+
+		// every layer after the first gets tanh outputs, which are always quantized as value * 127
+		const float inputScale = i == 1 ? m_inputScale : 1.0f / 127;
+
+		std::vector<float> rowBuffer(l.prevNodeCount);
+
+		for (int j = 0; j < l.nodeCount; ++j)
+		{
+			// whatever the storage type, quantize from float
+			float* row = rowBuffer.data();
+			l.loadWeights((size_t) j * l.prevNodeCount, l.prevNodeCount, row);
+			int8_t* qRow = q.weights.data() + (size_t) j * l.prevNodeCount;
+
+			float maxWeight = 0;
+
+			for (int k = 0; k < l.prevNodeCount; ++k)
+			{
+				maxWeight = std::max(maxWeight, std::fabs(row[k]));
+			}
+
+			const float rowScale = maxWeight > 0 ? maxWeight / 127 : 1;
+
+			for (int k = 0; k < l.prevNodeCount; ++k)
+			{
+				qRow[k] = quantize(row[k], 1 / rowScale);
+			}
+
+			q.scales[j] = rowScale * inputScale;
+		}
+
+		m_layers.push_back(std::move(q));
+	}
+
+}
+
+
+int nnet::quantizedNetwork::getInputCount () const
+{
+	return m_inputCount;
+}
+
+int nnet::quantizedNetwork::getOutputCount () const
+{
+	return m_layers.back().nodeCount;
+}
+
+
+void nnet::quantizedNetwork::calculate (inferenceContext &ctx, const float* input, float* output) const
+{
+
+	const kernels::table &k = kernels::get();
+
+	size_t widest = m_inputCount;
+
+	for (const quantizedLayer &q: m_layers)
+	{
+		widest = std::max<size_t>(widest, q.nodeCount);
+	}
+
+	if (ctx.quantizedBuffer.size() < 2 * widest) ctx.quantizedBuffer.resize(2 * widest);
+	if (ctx.buffers[0].size() < widest) ctx.buffers[0].resize(widest);
+
+	// ping-pong between the two halves of the int8 buffer
+	int8_t* in = ctx.quantizedBuffer.data();
+	int8_t* next = in + widest;
+
+	const float invInputScale = 1 / m_inputScale;
+
+	for (int i = 0; i < m_inputCount; ++i)
+	{
+		in[i] = quantize(input[i], invInputScale);
+	}
+
+
+	for (size_t i = 0; i < m_layers.size(); ++i)
+	{
+		const quantizedLayer &q = m_layers[i];
+		const bool isOutput = i == m_layers.size() - 1;
+
+		float* out = isOutput ? output : ctx.buffers[0].data();
+
+		for (int j = 0; j < q.nodeCount; ++j)
+		{
+			const int32_t dot = k.dotInt8(q.weights.data() + (size_t) j * q.prevNodeCount, in, q.prevNodeCount);
+			out[j] = dot * q.scales[j] + q.biases[j];
+		}
+
+		k.activate(out, q.nodeCount);
+
+		if (!isOutput)
+		{
+			for (int j = 0; j < q.nodeCount; ++j)
+			{
+				next[j] = quantize(out[j], 127);
+			}
+
+			std::swap(in, next);
+		}
+	}
+
+}
+
+
+nnet::quantizationReport nnet::quantizedNetwork::compare (const neural &network, const float* inputs, size_t count) const
+{
+
+	quantizationReport report;
+	report.sampleCount = count;
+
+	if (count == 0) return report;
+
+	const int outputCount = getOutputCount();
+
+	inferenceContext ctx;
+	std::vector<float> expected(outputCount);
+	std::vector<float> actual(outputCount);
+
+	double errorSum = 0;
+	size_t agreements = 0;
+
+	for (size_t s = 0; s < count; ++s)
+	{
+		const float* input = inputs + s * m_inputCount;
+
+		network.calculate(ctx, input, expected.data());
+		calculate(ctx, input, actual.data());
+
+		for (int i = 0; i < outputCount; ++i)
+		{
+			const float error = std::fabs(expected[i] - actual[i]);
+
+			report.maxAbsError = std::max(report.maxAbsError, error);
+			errorSum += error;
+		}
+
+		const auto expectedMax = std::max_element(expected.begin(), expected.end()) - expected.begin();
+		const auto actualMax = std::max_element(actual.begin(), actual.end()) - actual.begin();
+
+		if (expectedMax == actualMax) ++agreements;
+	}
+
+	report.meanAbsError = errorSum / (count * outputCount);
+	report.argmaxAgreement = (float) agreements / count;
+
+	return report;
+
+}
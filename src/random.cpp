@@ -0,0 +1,265 @@
+#include "../include/nnet.hpp"
+
+#include <atomic>
+#include <cstring>
+
+
+namespace
+{
+
+	uint64_t rotl64 (uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+	// the splitmix64 output function, a bijection that scatters nearby inputs all over the 64 bits
+	uint64_t mix64 (uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	}
+
+	// splitmix64, which turns any seed (even 0) into well-mixed state words
+	uint64_t splitMix (uint64_t &x)
+	{
+		return mix64(x += 0x9e3779b97f4a7c15);
+	}
+
+	// 24 random bits make every float in [0, 1) a multiple of 2^-24, with none of them rounding up to 1
+	const float floatUnit = 1.0f / 16777216;
+
+
+	typedef uint32_t vec4u __attribute__((vector_size(16)));
+	using nnet::activation::vec4;
+	using nnet::activation::vec4i;
+
+	// one step of every bulk stream, each writing one value in [0, 1) to block
+	// xoshiro128+ only uses adds, xors and shifts, so four streams at a time go through one vector register
+	void stepLanes (uint32_t (&lanes)[4][8], float* block)
+	{
+		for (int half = 0; half < 8; half += 4)
+		{
+			vec4u s[4];
+
+			for (int w = 0; w < 4; ++w)
+			{
+				std::memcpy(&s[w], &lanes[w][half], sizeof(vec4u));
+			}
+
+			const vec4u result = s[0] + s[3];
+			const vec4u t = s[1] << 9;
+
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = (s[3] << 11) | (s[3] >> 21);
+
+			for (int w = 0; w < 4; ++w)
+			{
+				std::memcpy(&lanes[w][half], &s[w], sizeof(vec4u));
+			}
+
+			// the top bits are the strongest ones of xoshiro128+, and 24 of them fit a signed conversion
+			const vec4 values = __builtin_convertvector((vec4i) (result >> 8), vec4) * floatUnit;
+			std::memcpy(block + half, &values, sizeof(vec4));
+		}
+	}
+
+
+	std::atomic<uint64_t> globalSeed {1};
+	std::atomic<uint64_t> threadCount {0};
+
+	// the seed of the index'th thread to use threadRng()
+	// rng::seed() walks splitmix64 from its seed, so seeds one splitmix step apart would give threads the same state words,
+	// shifted by one; hashing the index in instead puts every thread's walk somewhere unrelated
+	uint64_t threadSeed (uint64_t seed, uint64_t index)
+	{
+		if (index == 0) return seed;
+
+		return mix64(seed ^ mix64(index));
+	}
+
+}
+
+
+
+nnet::rng::rng (uint64_t seed)
+{
+	this->seed(seed);
+}
+
+
+void nnet::rng::seed (uint64_t seed)
+{
+
+	uint64_t x = seed;
+
+	for (uint64_t &word: m_state)
+	{
+		word = splitMix(x);
+	}
+
+	for (int j = 0; j < laneCount; ++j)
+	{
+		const uint64_t a = splitMix(x);
+		const uint64_t b = splitMix(x);
+
+		m_lanes[0][j] = a;
+		m_lanes[1][j] = a >> 32;
+		m_lanes[2][j] = b;
+		m_lanes[3][j] = b >> 32;
+	}
+
+	m_blockUsed = laneCount;
+
+}
+
+
+uint64_t nnet::rng::next ()
+{
+
+	// xoshiro256**
+	const uint64_t result = rotl64(m_state[1] * 5, 7) * 9;
+	const uint64_t t = m_state[1] << 17;
+
+	m_state[2] ^= m_state[0];
+	m_state[3] ^= m_state[1];
+	m_state[1] ^= m_state[2];
+	m_state[0] ^= m_state[3];
+	m_state[2] ^= t;
+	m_state[3] = rotl64(m_state[3], 45);
+
+	return result;
+
+}
+
+
+float nnet::rng::nextFloat ()
+{
+	return (next() >> 40) * floatUnit;
+}
+
+
+uint32_t nnet::rng::nextBelow (uint32_t bound)
+{
+	// scale 32 random bits into [0, bound), the bias is at most bound / 2^32
+	return ((next() >> 32) * bound) >> 32;
+}
+
+
+void nnet::rng::refillBlock ()
+{
+	stepLanes(m_lanes, m_block);
+	m_blockUsed = 0;
+}
+
+
+void nnet::rng::fillUniform (float* out, size_t count, float low, float high)
+{
+
+	const float scale = high - low;
+
+	size_t i = 0;
+
+	// finish the last block first, so that no values are skipped
+	while (i < count && m_blockUsed < laneCount)
+	{
+		out[i++] = low + scale * m_block[m_blockUsed++];
+	}
+
+	// then whole blocks
+	float block[laneCount];
+
+	for (; i + laneCount <= count; i += laneCount)
+	{
+		stepLanes(m_lanes, block);
+
+		for (int j = 0; j < laneCount; ++j)
+		{
+			out[i + j] = low + scale * block[j];
+		}
+	}
+
+	// and keep whatever's left of the last one for the next call
+	if (i < count)
+	{
+		refillBlock();
+
+		while (i < count)
+		{
+			out[i++] = low + scale * m_block[m_blockUsed++];
+		}
+	}
+
+}
+
+
+void nnet::rng::addUniform (float* out, size_t count, float magnitude)
+{
+
+	const float scale = 2 * magnitude;
+
+	size_t i = 0;
+
+	while (i < count && m_blockUsed < laneCount)
+	{
+		out[i++] += scale * m_block[m_blockUsed++] - magnitude;
+	}
+
+	float block[laneCount];
+
+	for (; i + laneCount <= count; i += laneCount)
+	{
+		stepLanes(m_lanes, block);
+
+		for (int j = 0; j < laneCount; ++j)
+		{
+			out[i + j] += scale * block[j] - magnitude;
+		}
+	}
+
+	if (i < count)
+	{
+		refillBlock();
+
+		while (i < count)
+		{
+			out[i++] += scale * m_block[m_blockUsed++] - magnitude;
+		}
+	}
+
+}
+
+
+nnet::rng nnet::rng::split ()
+{
+	return rng(next());
+}
+
+
+
+nnet::rng& nnet::threadRng ()
+{
+
+	// the first thread gets the global seed itself, so seedRandom(s) on a single thread matches rng(s)
+	thread_local rng generator {threadSeed(globalSeed.load(), threadCount.fetch_add(1))};
+
+	return generator;
+
+}
+
+
+void nnet::seedRandom (uint64_t seed)
+{
+	globalSeed.store(seed);
+	threadRng().seed(seed);
+}
+
+
+float nnet::randFloat ()
+{
+	return threadRng().nextFloat();
+}
@@ -0,0 +1,21 @@
+// internal header, not part of the public interface
+
+
+#ifndef NNET_REPLICA_HPP
+#define NNET_REPLICA_HPP
+
+#include "../include/nnet.hpp"
+
+
+namespace nnet
+{
+
+	// true if replica, made with network.split(), still shares all of network's parameters in the same layout and with the same optimizer
+	// calling setStorageType(), prune() (on sparse storage) or setOptimizer() on the network after splitting it breaks this,
+	// so the trainers check it before each step and split the network again if needed
+	bool replicaMatches (const neural &network, const neural &replica);
+
+}
+
+
+#endif
@@ -0,0 +1,572 @@
+#include "../include/nnet.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+nnet::server::server (const neural &network, const serverSettings &settings)
+: m_network {network},
+	m_settings {settings},
+	m_inputCount {network.inputLayer->nodeCount},
+	m_outputCount {network.outputLayer->nodeCount}
+{
+
+	if (settings.maxBatchSize == 0)
+	{
+		throw nnet::usageError("server batches need room for at least one request");
+	}
+
+	if (settings.workerCount < 1)
+	{
+		throw nnet::usageError("a server needs at least one worker thread");
+	}
+
+	for (int i = 0; i < settings.workerCount; ++i)
+	{
+		m_workers.emplace_back(&server::workerLoop, this);
+	}
+
+}
+
+nnet::server::~server ()
+{
+
+	stopListening();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+
+	m_queueCondition.notify_all();
+
+	for (std::thread &t: m_workers)
+	{
+		t.join();
+	}
+
+}
+
+
+int nnet::server::getInputCount () const
+{
+	return m_inputCount;
+}
+
+int nnet::server::getOutputCount () const
+{
+	return m_outputCount;
+}
+
+
+uint64_t nnet::server::getRequestCount () const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_requestCount;
+}
+
+uint64_t nnet::server::getBatchCount () const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_batchCount;
+}
+
+
+
+////// in-process requests
+
+void nnet::server::reportError (std::exception_ptr error) noexcept
+{
+	if (m_settings.errorHandler) m_settings.errorHandler(error);
+}
+
+
+void nnet::server::submit (const float* input, float* output, std::function<void (std::exception_ptr error)> done)
+{
+
+	bool wake;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_queue.push_back({input, output, std::move(done), std::chrono::steady_clock::now()});
+
+		// an idle worker needs to know about the first request, and a waiting one about a full batch
+		wake = m_queue.size() == 1 || m_queue.size() >= m_settings.maxBatchSize;
+	}
+
+	if (wake) m_queueCondition.notify_one();
+
+}
+
+
+void nnet::server::calculate (const float* input, float* output)
+{
+
+	struct waiter
+	{
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool finished = false;
+		std::exception_ptr error;
+	};
+
+	waiter w;
+
+	// capturing one pointer keeps the std::function from allocating
+	waiter* p = &w;
+
+	submit(input, output, [p] (std::exception_ptr error)
+	{
+		std::lock_guard<std::mutex> lock(p->mutex);
+		p->error = error;
+		p->finished = true;
+		p->condition.notify_one();
+	});
+
+	std::unique_lock<std::mutex> lock(w.mutex);
+	w.condition.wait(lock, [&w] { return w.finished; });
+
+	if (w.error) std::rethrow_exception(w.error);
+
+}
+
+
+int nnet::server::selectOutputFixed (const float* input)
+{
+
+	std::vector<float> output(m_outputCount);
+	calculate(input, output.data());
+
+	return std::max_element(output.begin(), output.end()) - output.begin();
+
+}
+
+
+namespace
+{
+	// the state of an asynchronous request, kept alive by the callback that completes it
+	struct asyncRequest
+	{
+		std::vector<float> input;
+		std::vector<float> output;
+		std::promise<std::vector<float>> promise;
+		std::function<void (std::vector<float>, std::exception_ptr)> done;
+	};
+}
+
+
+std::future<std::vector<float>> nnet::server::calculateAsync (std::vector<float> input)
+{
+
+	if (input.size() < (size_t) m_inputCount)
+	{
+		throw nnet::usageError("input has " + std::to_string(input.size()) + " values, but the network has " + std::to_string(m_inputCount) + " inputs");
+	}
+
+	std::shared_ptr<asyncRequest> state = std::make_shared<asyncRequest>();
+	state->input = std::move(input);
+	state->output.resize(m_outputCount);
+
+	std::future<std::vector<float>> result = state->promise.get_future();
+
+	submit(state->input.data(), state->output.data(), [state] (std::exception_ptr error)
+	{
+		if (error)
+		{
+			state->promise.set_exception(error);
+		}
+		else
+		{
+			state->promise.set_value(std::move(state->output));
+		}
+	});
+
+	return result;
+
+}
+
+
+void nnet::server::calculateAsync (std::vector<float> input, std::function<void (std::vector<float> output, std::exception_ptr error)> done)
+{
+
+	if (input.size() < (size_t) m_inputCount)
+	{
+		throw nnet::usageError("input has " + std::to_string(input.size()) + " values, but the network has " + std::to_string(m_inputCount) + " inputs");
+	}
+
+	std::shared_ptr<asyncRequest> state = std::make_shared<asyncRequest>();
+	state->input = std::move(input);
+	state->output.resize(m_outputCount);
+	state->done = std::move(done);
+
+	submit(state->input.data(), state->output.data(), [state] (std::exception_ptr error)
+	{
+		if (error) state->output.clear();
+
+		state->done(std::move(state->output), error);
+	});
+
+}
+
+
+void nnet::server::workerLoop ()
+{
+
+	const size_t maxBatchSize = m_settings.maxBatchSize;
+
+	inferenceContext ctx(m_network);
+
+	std::vector<request> batch;
+	std::vector<float> inputs(maxBatchSize * m_inputCount);
+	std::vector<float> outputs(maxBatchSize * m_outputCount);
+
+	while (true)
+	{
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_queueCondition.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+
+			// finish off the queue before stopping
+			if (m_queue.empty()) return;
+
+			// give the batch until the oldest request's deadline to fill up, unless the server is stopping
+			const std::chrono::steady_clock::time_point deadline = m_queue.front().arrival + m_settings.maxDelay;
+
+			while (!m_stopping && !m_queue.empty() && m_queue.size() < maxBatchSize)
+			{
+				if (m_queueCondition.wait_until(lock, deadline) == std::cv_status::timeout) break;
+			}
+
+			// another worker may have taken the requests in the meantime
+			if (m_queue.empty()) continue;
+
+			const size_t count = std::min(m_queue.size(), maxBatchSize);
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				batch.push_back(std::move(m_queue.front()));
+				m_queue.pop_front();
+			}
+
+			m_requestCount += count;
+			++m_batchCount;
+
+			// more requests are waiting, so let another worker start on them
+			if (!m_queue.empty()) m_queueCondition.notify_one();
+		}
+
+
+		const size_t count = batch.size();
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			std::memcpy(inputs.data() + i * m_inputCount, batch[i].input, m_inputCount * sizeof(float));
+		}
+
+		// a failed batch fails each of its requests, but not the worker
+		std::exception_ptr error;
+
+		try
+		{
+			m_network.calculateBatch(ctx, inputs.data(), count, outputs.data());
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		// every output is in place before any callback runs, so a slow one only delays the callbacks after it
+		if (!error)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				std::memcpy(batch[i].output, outputs.data() + i * m_outputCount, m_outputCount * sizeof(float));
+			}
+		}
+
+		// a callback that throws mustn't keep the rest of the batch from completing
+		for (size_t i = 0; i < count; ++i)
+		{
+			try
+			{
+				batch[i].done(error);
+			}
+			catch (...)
+			{
+				reportError(std::current_exception());
+			}
+		}
+
+		batch.clear();
+
+	}
+
+}
+
+
+
+////// Unix socket requests
+
+#if defined(__unix__) || defined(__APPLE__)
+
+namespace
+{
+
+	// false if the connection closed (or failed) before size bytes arrived
+	bool readAll (int socket, void* data, size_t size)
+	{
+
+		char* p = (char*) data;
+
+		while (size > 0)
+		{
+			const ssize_t n = recv(socket, p, size, 0);
+
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+
+			p += n;
+			size -= n;
+		}
+
+		return true;
+
+	}
+
+	bool writeAll (int socket, const void* data, size_t size)
+	{
+
+#ifdef MSG_NOSIGNAL
+		// a client that hangs up early shouldn't kill the process with SIGPIPE
+		const int flags = MSG_NOSIGNAL;
+#else
+		const int flags = 0;
+#endif
+
+		const char* p = (const char*) data;
+
+		while (size > 0)
+		{
+			const ssize_t n = send(socket, p, size, flags);
+
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+
+			p += n;
+			size -= n;
+		}
+
+		return true;
+
+	}
+
+}
+
+
+void nnet::server::listen (const std::string &path)
+{
+
+	std::lock_guard<std::mutex> lock(m_socketMutex);
+
+	if (m_listening)
+	{
+		throw nnet::usageError("this server is already listening on " + m_socketPath);
+	}
+
+	sockaddr_un address {};
+	address.sun_family = AF_UNIX;
+
+	if (path.empty() || path.size() >= sizeof(address.sun_path))
+	{
+		throw nnet::usageError("invalid socket path \"" + path + "\"");
+	}
+
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	const int s = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (s < 0)
+	{
+		throw nnet::usageError(std::string("could not create a socket: ") + std::strerror(errno));
+	}
+
+	if (bind(s, (const sockaddr*) &address, sizeof(address)) != 0 || ::listen(s, SOMAXCONN) != 0)
+	{
+		const std::string reason = std::strerror(errno);
+		close(s);
+
+		throw nnet::usageError("could not listen on \"" + path + "\": " + reason);
+	}
+
+	m_listenSocket = s;
+	m_socketPath = path;
+	m_listening = true;
+
+	m_acceptThread = std::thread(&server::acceptLoop, this);
+
+}
+
+
+void nnet::server::stopListening ()
+{
+
+	std::unique_lock<std::mutex> lock(m_socketMutex);
+
+	if (!m_listening) return;
+
+	m_listening = false;
+
+	// the accept loop polls with a timeout, so it notices m_listening within a moment
+	lock.unlock();
+	m_acceptThread.join();
+	lock.lock();
+
+	close(m_listenSocket);
+	unlink(m_socketPath.c_str());
+
+	m_listenSocket = -1;
+	m_socketPath.clear();
+
+	// wake every connection out of its blocking recv(), then wait for them all
+	for (connection &c: m_connections)
+	{
+		if (!c.finished) shutdown(c.socket, SHUT_RDWR);
+	}
+
+	std::list<connection> connections = std::move(m_connections);
+	m_connections.clear();
+
+	lock.unlock();
+
+	for (connection &c: connections)
+	{
+		c.thread.join();
+		close(c.socket);
+	}
+
+}
+
+
+void nnet::server::acceptLoop ()
+{
+
+	pollfd listener {m_listenSocket, POLLIN, 0};
+
+	while (m_listening)
+	{
+		if (poll(&listener, 1, 100) <= 0) continue;
+
+		const int c = accept(m_listenSocket, nullptr, nullptr);
+
+		if (c < 0) continue;
+
+#ifdef SO_NOSIGPIPE
+		// where send() has no MSG_NOSIGNAL, this keeps a client that hangs up early from raising SIGPIPE
+		const int on = 1;
+		setsockopt(c, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+		std::lock_guard<std::mutex> lock(m_socketMutex);
+
+		reapConnections();
+
+		m_connections.emplace_back();
+
+		connection &entry = m_connections.back();
+		entry.socket = c;
+		entry.thread = std::thread(&server::connectionLoop, this, std::ref(entry));
+	}
+
+}
+
+
+void nnet::server::connectionLoop (connection &c)
+{
+
+	const uint32_t header[2] = {(uint32_t) m_inputCount, (uint32_t) m_outputCount};
+
+	std::vector<float> input(m_inputCount);
+	std::vector<float> output(m_outputCount);
+
+	if (writeAll(c.socket, header, sizeof(header)))
+	{
+		while (readAll(c.socket, input.data(), input.size() * sizeof(float)))
+		{
+			// the protocol has no way to report an error, so the client just sees the connection close
+			// the socket itself is only closed once the connection is reaped, so shut it down now
+			try
+			{
+				calculate(input.data(), output.data());
+			}
+			catch (...)
+			{
+				reportError(std::current_exception());
+				shutdown(c.socket, SHUT_RDWR);
+				break;
+			}
+
+			if (!writeAll(c.socket, output.data(), output.size() * sizeof(float))) break;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_socketMutex);
+	c.finished = true;
+
+}
+
+
+void nnet::server::reapConnections ()
+{
+
+	for (auto it = m_connections.begin(); it != m_connections.end();)
+	{
+		if (it->finished)
+		{
+			it->thread.join();
+			close(it->socket);
+
+			it = m_connections.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+}
+
+#else
+
+void nnet::server::listen (const std::string &path)
+{
+	throw nnet::usageError("Unix domain sockets are not supported on this platform");
+}
+
+void nnet::server::stopListening ()
+{
+}
+
+void nnet::server::acceptLoop ()
+{
+}
+
+void nnet::server::connectionLoop (connection &c)
+{
+}
+
+void nnet::server::reapConnections ()
+{
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include "threadPool.hpp"
+
+#include "../include/nnet.hpp"
+
+#include <exception>
+
+
+nnet::threadPool::threadPool (int threadCount)
+{
+
+	if (threadCount < 0)
+	{
+		throw nnet::usageError("Thread count must be >= 0");
+	}
+
+	if (threadCount == 0)
+	{
+		threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0) threadCount = 1;
+	}
+
+	m_threads.reserve(threadCount);
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		m_threads.emplace_back(&threadPool::workerLoop, this);
+	}
+
+}
+
+nnet::threadPool::~threadPool ()
+{
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+
+	m_condition.notify_all();
+
+	for (std::thread &t: m_threads)
+	{
+		t.join();
+	}
+
+}
+
+
+int nnet::threadPool::getThreadCount ()
+{
+	return m_threads.size();
+}
+
+
+void nnet::threadPool::submit (std::function<void ()> job)
+{
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+
+	m_condition.notify_one();
+
+}
+
+
+void nnet::threadPool::workerLoop ()
+{
+
+	while (true)
+	{
+		std::function<void ()> job;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_condition.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+
+			// finish off the queue before stopping
+			if (m_jobs.empty()) return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		job();
+	}
+
+}
+
+
+void nnet::threadPool::parallelFor (int count, const std::function<void (int)> &job)
+{
+
+	if (count <= 0) return;
+
+	std::mutex doneMutex;
+	std::condition_variable doneCondition;
+	int remaining = count;
+	std::exception_ptr firstError;
+
+	for (int i = 0; i < count; ++i)
+	{
+		submit([&, i]
+		{
+			std::exception_ptr error;
+
+			try
+			{
+				job(i);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+
+			std::lock_guard<std::mutex> lock(doneMutex);
+
+			if (error && !firstError) firstError = error;
+
+			if (--remaining == 0) doneCondition.notify_all();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(doneMutex);
+	doneCondition.wait(lock, [&] { return remaining == 0; });
+
+	if (firstError) std::rethrow_exception(firstError);
+
+}
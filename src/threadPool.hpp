@@ -0,0 +1,56 @@
+// internal header, not part of the public interface
+
+
+#ifndef NNET_THREADPOOL_HPP
+#define NNET_THREADPOOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+
+
+namespace nnet
+{
+
+	// fixed set of worker threads that run queued jobs
+	class threadPool
+	{
+
+		public:
+			// threadCount of 0 uses the number of hardware threads
+			threadPool (int threadCount = 0);
+			~threadPool ();
+
+			int getThreadCount ();
+
+			// queue a job to be run on one of the worker threads
+			void submit (std::function<void ()> job);
+
+			// run job(0) ... job(count - 1) across the workers, and return once they have all finished
+			// if a job throws, the first exception is rethrown here
+			void parallelFor (int count, const std::function<void (int)> &job);
+
+
+		private:
+			std::vector<std::thread> m_threads;
+
+			std::mutex m_mutex;
+			std::condition_variable m_condition;
+			std::deque<std::function<void ()>> m_jobs;
+			bool m_stopping = false;
+
+			void workerLoop ();
+
+
+			threadPool (const threadPool&) = delete;
+			threadPool& operator= (const threadPool&) = delete;
+
+	};
+
+}
+
+
+#endif
@@ -1,18 +1,48 @@
 #include "../include/nnet.hpp"
 
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 
-float nnet::randFloat ()
+bool nnet::isLittleEndian ()
 {
-	return ((float) rand()) / RAND_MAX;
+	uint16_t a = 1;
+	return *(uint8_t*) &a;
 }
 
 
-bool nnet::isLittleEndian ()
+std::shared_ptr<float> nnet::allocFloats (size_t count)
 {
-	uint16_t a = 1;
-	return *(uint8_t*) &a;
+
+	const size_t alignment = 64;
+
+	// aligned_alloc requires the size to be a multiple of the alignment
+	size_t bytes = count * sizeof(float);
+	bytes = (bytes + alignment - 1) / alignment * alignment;
+	if (bytes == 0) bytes = alignment;
+
+	float* ptr = (float*) std::aligned_alloc(alignment, bytes);
+
+	if (!ptr)
+	{
+		throw nnet::internalError("could not allocate float buffer, thrown from nnet::allocFloats()");
+	}
+
+	std::memset(ptr, 0, bytes);
+
+	return std::shared_ptr<float>(ptr, std::free);
+
+}
+
+std::shared_ptr<uint16_t> nnet::allocHalves (size_t count)
+{
+
+	// round up to whole floats, and share ownership of the float buffer
+	std::shared_ptr<float> buffer = allocFloats((count + 1) / 2);
+
+	return std::shared_ptr<uint16_t>(buffer, (uint16_t*) buffer.get());
+
 }
 
 
@@ -25,7 +55,7 @@ void nnet::neural::regenUID ()
 	for (int i = 0; i < 8; ++i)
 	{
 
-		int num = rand() % 36;
+		int num = threadRng().nextBelow(36);
 
 		if (num < 10)
 		{
@@ -0,0 +1,117 @@
+#include "../include/nnet.hpp"
+#include "test.hpp"
+
+#include <cmath>
+#include <vector>
+
+
+// a layer with one input, weights of 1 and biases spread over [-9, 9), so each node's value is tanh(input + bias)
+// the sum is exact whatever the instruction set, so only the activation itself can make the levels disagree
+static std::vector<float> activations (nnet::simdLevel level, float input)
+{
+
+	nnet::setSimdLevel(level);
+
+	// an odd node count, so the vector kernels' leftover elements get used too
+	nnet::neural network (std::vector<int> {1, 67});
+	nnet::layer &l = *network.layers.at(1);
+
+	const std::vector<float> ones (l.nodeCount, 1.0f);
+	l.storeWeights(0, ones.size(), ones.data());
+
+	for (int i = 0; i < l.nodeCount; ++i)
+	{
+		l.biases.get()[i] = -9 + 18.0f * i / l.nodeCount;
+	}
+
+	network.setInput(&input, 1);
+	network.calculate();
+
+	return l.values;
+
+}
+
+
+// every level has to compute the same approximation, the scalar fallback included
+// the levels with FMA round the polynomial differently, so they may disagree in the last bit or two
+static void testLevelsAgree ()
+{
+
+	const nnet::simdLevel levels[] = {nnet::simdLevel::scalar, nnet::simdLevel::sse2, nnet::simdLevel::avx2, nnet::simdLevel::avx512};
+
+	for (float input: {0.0f, 0.37f, -1.5f, 4.0f})
+	{
+		const std::vector<float> expected = activations(nnet::simdLevel::scalar, input);
+
+		for (size_t i = 0; i < expected.size(); ++i)
+		{
+			NNET_CHECK(expected[i] == nnet::activation::tanhApprox(input + (-9 + 18.0f * i / expected.size())));
+		}
+
+		for (nnet::simdLevel level: levels)
+		{
+			if (!nnet::isSimdLevelSupported(level)) continue;
+
+			const std::vector<float> values = activations(level, input);
+
+			for (size_t i = 0; i < values.size(); ++i)
+			{
+				NNET_CHECK(std::fabs(values[i] - expected[i]) <= 2.5e-7f);
+			}
+		}
+	}
+
+	nnet::setSimdLevel(nnet::detectSimdLevel());
+
+}
+
+
+// a NaN has to come out as NaN on every level, rather than being clamped to 1 and hiding a network that has diverged
+// infinities still saturate, to within an ulp of 1
+static bool saturated (float value, float sign)
+{
+	return value * sign >= 0.9999999f && value * sign <= 1;
+}
+
+static void testNaN ()
+{
+
+	const float nan = std::nanf("");
+	const float inf = INFINITY;
+
+	NNET_CHECK(std::isnan(nnet::activation::tanhApprox(nan)));
+	NNET_CHECK(saturated(nnet::activation::tanhApprox(inf), 1));
+	NNET_CHECK(saturated(nnet::activation::tanhApprox(-inf), -1));
+
+	const nnet::activation::vec4 v = nnet::activation::tanhApprox4(nnet::activation::vec4 {nan, inf, -inf, -nan});
+	NNET_CHECK(std::isnan(v[0]) && saturated(v[1], 1) && saturated(v[2], -1) && std::isnan(v[3]));
+
+	const nnet::simdLevel levels[] = {nnet::simdLevel::scalar, nnet::simdLevel::sse2, nnet::simdLevel::avx2, nnet::simdLevel::avx512};
+
+	for (nnet::simdLevel level: levels)
+	{
+		if (!nnet::isSimdLevelSupported(level)) continue;
+
+		for (float value: activations(level, nan))
+		{
+			NNET_CHECK(std::isnan(value));
+		}
+
+		for (float value: activations(level, inf))
+		{
+			NNET_CHECK(saturated(value, 1));
+		}
+	}
+
+	nnet::setSimdLevel(nnet::detectSimdLevel());
+
+}
+
+
+int main ()
+{
+	testLevelsAgree();
+	testNaN();
+
+	return testResult();
+}
@@ -0,0 +1,282 @@
+#include "../include/nnet.hpp"
+#include "test.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+
+static std::vector<float> outputsFor (nnet::neural &n, const std::vector<float> &input)
+{
+	n.setInput(input);
+	n.calculate();
+	return n.outputLayer->values;
+}
+
+
+static void writeBytes (const std::string &path, const std::vector<char> &bytes)
+{
+	std::ofstream f(path, std::ios::binary);
+	f.write(bytes.data(), bytes.size());
+}
+
+// v1 files are little-endian, these tests assume they run on a little-endian machine
+static void pushUint32 (std::vector<char> &bytes, uint32_t x)
+{
+	bytes.resize(bytes.size() + 4);
+	std::memcpy(bytes.data() + bytes.size() - 4, &x, 4);
+}
+
+static std::vector<char> readBytes (const std::string &path)
+{
+	std::ifstream f(path, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+// CRC-32C, bit by bit, for forging v2 headers that pass the checksum
+static uint32_t crc32c (const char* data, size_t size)
+{
+
+	uint32_t crc = 0xffffffff;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc ^= (uint8_t) data[i];
+		for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+	}
+
+	return crc ^ 0xffffffff;
+
+}
+
+// fix up the header checksum of a v2 file saved on this machine after changing its header
+static void resealV2 (std::vector<char> &bytes)
+{
+	uint32_t layerCount;
+	std::memcpy(&layerCount, bytes.data() + 12, 4);
+
+	const size_t checksumOffset = 16 + 4 * layerCount + 8 * (layerCount - 1);
+	const uint32_t crc = crc32c(bytes.data(), checksumOffset);
+
+	std::memcpy(bytes.data() + checksumOffset, &crc, 4);
+}
+
+// loadFromFile() has to return nullptr for a bad file, rather than throwing or trying to allocate whatever it claims
+static bool rejects (const std::string &path, const std::vector<char> &bytes)
+{
+
+	writeBytes(path, bytes);
+
+	try
+	{
+		std::unique_ptr<nnet::neural> n(nnet::neural::loadFromFile(path));
+		return n == nullptr;
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+}
+
+
+// saving over the file a network was loaded from has to work, and leave the network intact
+static void testSaveOverLoadedFile ()
+{
+
+	const std::string path = testPath("same_path.nnet");
+
+	nnet::neural original({6, 12, 4});
+	original.randomize();
+
+	NNET_CHECK(original.saveToFile(path));
+
+	std::unique_ptr<nnet::neural> loaded(nnet::neural::loadFromFile(path));
+	NNET_CHECK(loaded != nullptr);
+	if (!loaded) return;
+
+	const std::vector<float> input {0.1f, -0.2f, 0.3f, -0.4f, 0.5f, -0.6f};
+	const std::vector<float> expected = outputsFor(original, input);
+
+	NNET_CHECK(loaded->saveToFile(path));
+	NNET_CHECK(outputsFor(*loaded, input) == expected);
+
+	std::unique_ptr<nnet::neural> reloaded(nnet::neural::loadFromFile(path));
+	NNET_CHECK(reloaded != nullptr);
+	if (reloaded) NNET_CHECK(outputsFor(*reloaded, input) == expected);
+
+	// and training the loaded network mustn't touch the file
+	std::vector<float> ideal {0.5f, -0.5f, 0.25f, -0.25f};
+	loaded->trainBatch(input.data(), ideal.data(), 1, 0.1f);
+
+	std::unique_ptr<nnet::neural> again(nnet::neural::loadFromFile(path));
+	NNET_CHECK(again != nullptr);
+	if (again) NNET_CHECK(outputsFor(*again, input) == expected);
+
+	std::remove(path.c_str());
+
+}
+
+
+// a save that's rejected mustn't have destroyed the file that was already there
+static void testRejectedSaveKeepsFile ()
+{
+
+	const std::string path = testPath("rejected.nnet");
+
+	nnet::neural original(std::vector<int> {6, 12, 12, 4});
+	original.randomize();
+
+	NNET_CHECK(original.saveToFile(path));
+
+	const std::vector<float> input {0.6f, -0.5f, 0.4f, -0.3f, 0.2f, -0.1f};
+	const std::vector<float> expected = outputsFor(original, input);
+
+	// mixed storage types can't be saved
+	nnet::neural mixed(std::vector<int> {6, 12, 12, 4});
+	mixed.layers.at(1)->setStorageType(nnet::storageType::float16);
+
+	bool threw = false;
+
+	try
+	{
+		mixed.saveToFile(path);
+	}
+	catch (const nnet::usageError &)
+	{
+		threw = true;
+	}
+
+	NNET_CHECK(threw);
+
+	std::unique_ptr<nnet::neural> loaded(nnet::neural::loadFromFile(path));
+	NNET_CHECK(loaded != nullptr);
+	if (loaded) NNET_CHECK(outputsFor(*loaded, input) == expected);
+
+	std::remove(path.c_str());
+
+}
+
+
+static void testCorruptV1 ()
+{
+
+	const std::string path = testPath("v1.nnet");
+
+	// a well-formed v1 file, one middle layer: 2 inputs, 3 middle nodes, 1 output
+	std::vector<char> good;
+	for (uint32_t x: {1u, 2u, 3u, 1u}) pushUint32(good, x);
+	good.resize(good.size() + 4 * (2 * 3 + 3 * 1 + 3 + 1), 0);
+
+	writeBytes(path, good);
+
+	std::unique_ptr<nnet::neural> loaded(nnet::neural::loadFromFile(path));
+	NNET_CHECK(loaded != nullptr);
+	if (loaded) NNET_CHECK(loaded->getNodeCounts() == std::vector<int>({2, 3, 1}));
+
+	// the same, a byte short
+	std::vector<char> truncated = good;
+	truncated.pop_back();
+	NNET_CHECK(rejects(path, truncated));
+
+	// counts whose sections would need far more than the file holds, or that wrap when multiplied
+	const uint32_t headers[][4] = {
+		{1, 0x7fffffff, 0x7fffffff, 1},
+		{1, 0xffffffff, 3, 1},
+		{1, 2, 0, 1},
+		{0, 0, 3, 1},
+		{0x3fffffff, 2, 3, 1},
+		{0x40000000, 2, 3, 1},
+	};
+
+	for (const uint32_t* h: headers)
+	{
+		std::vector<char> bytes;
+		for (int i = 0; i < 4; ++i) pushUint32(bytes, h[i]);
+		bytes.resize(bytes.size() + 256, 0);
+
+		NNET_CHECK(rejects(path, bytes));
+	}
+
+	std::remove(path.c_str());
+
+}
+
+
+static void testCorruptV2 ()
+{
+
+	const std::string path = testPath("v2.nnet");
+
+	nnet::neural original({5, 7, 3});
+	original.randomize();
+	NNET_CHECK(original.saveToFile(path));
+
+	const std::vector<char> good = readBytes(path);
+
+	// a damaged header is corrupt, whichever field the damage lands in
+	for (size_t offset: {4, 5, 6, 8, 12, 16, 20})
+	{
+		std::vector<char> bytes = good;
+		bytes[offset] ^= 0x40;
+
+		NNET_CHECK(rejects(path, bytes));
+	}
+
+	// but a file that really does have an unknown data type is reported as one
+	{
+		std::vector<char> bytes = good;
+		bytes[5] = 7;
+		resealV2(bytes);
+		writeBytes(path, bytes);
+
+		bool incompatible = false;
+
+		try
+		{
+			std::unique_ptr<nnet::neural> n(nnet::neural::loadFromFile(path));
+		}
+		catch (const nnet::incompatibleError &)
+		{
+			incompatible = true;
+		}
+
+		NNET_CHECK(incompatible);
+	}
+
+	// a checksum doesn't make a node count trustworthy
+	for (uint32_t count: {0u, 0x40000000u, 0x7fffffffu, 0xffffffffu})
+	{
+		std::vector<char> bytes = good;
+		std::memcpy(bytes.data() + 16 + 4, &count, 4);
+		resealV2(bytes);
+
+		NNET_CHECK(rejects(path, bytes));
+	}
+
+	// damaged weights, the first section starts right after the 64-byte header
+	{
+		std::vector<char> bytes = good;
+		bytes[64] ^= 1;
+
+		NNET_CHECK(rejects(path, bytes));
+	}
+
+	std::remove(path.c_str());
+
+}
+
+
+int main ()
+{
+	testSaveOverLoadedFile();
+	testRejectedSaveKeepsFile();
+	testCorruptV1();
+	testCorruptV2();
+
+	return testResult();
+}
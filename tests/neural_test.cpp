@@ -0,0 +1,42 @@
+#include "../include/nnet.hpp"
+#include "test.hpp"
+
+#include <vector>
+
+
+// four ints in braces have always meant (middle layer count, input, middle and output node counts)
+static void testFourIntBraceInit ()
+{
+
+	nnet::neural n {1, 3, 5, 2};
+
+	NNET_CHECK(n.getNodeCounts() == std::vector<int>({3, 5, 2}));
+	NNET_CHECK(n.inputLayer->nodeCount == 3);
+	NNET_CHECK(n.outputLayer->nodeCount == 2);
+
+	nnet::neural deep {3, 4, 8, 1};
+	NNET_CHECK(deep.getNodeCounts() == std::vector<int>({4, 8, 8, 8, 1}));
+
+}
+
+// per-layer node counts go through an explicit std::vector
+static void testNodeCountVector ()
+{
+
+	nnet::neural n (std::vector<int> {1, 3, 5, 2});
+	NNET_CHECK(n.getNodeCounts() == std::vector<int>({1, 3, 5, 2}));
+
+	// any other length can't be mistaken for the four-int constructor, so it can be braced directly
+	nnet::neural m ({784, 256, 10});
+	NNET_CHECK(m.getNodeCounts() == std::vector<int>({784, 256, 10}));
+
+}
+
+
+int main ()
+{
+	testFourIntBraceInit();
+	testNodeCountVector();
+
+	return testResult();
+}
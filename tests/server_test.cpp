@@ -0,0 +1,124 @@
+#include "../include/nnet.hpp"
+#include "test.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+
+// batched and single forward passes may sum in a different order
+static bool near (const std::vector<float> &a, const std::vector<float> &b)
+{
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (std::fabs(a[i] - b[i]) > 1e-5f) return false;
+	}
+
+	return a.size() == b.size();
+}
+
+
+// a callback that throws goes to the error handler, and the rest of its batch still completes
+static void testThrowingCallback ()
+{
+
+	nnet::neural network ({4, 8, 2});
+	network.randomize();
+
+	std::atomic<int> handled {0};
+
+	nnet::serverSettings settings;
+	settings.maxDelay = std::chrono::milliseconds(20);
+	settings.errorHandler = [&handled] (std::exception_ptr error)
+	{
+		try
+		{
+			std::rethrow_exception(error);
+		}
+		catch (const std::runtime_error &)
+		{
+			++handled;
+		}
+	};
+
+	std::vector<float> input (4, 0.5f);
+	network.setInput(input);
+	network.calculate();
+
+	const std::vector<float> expected = network.outputLayer->values;
+
+	{
+		nnet::server s (network, settings);
+
+		std::atomic<int> completed {0};
+		std::vector<std::vector<float>> outputs (6, std::vector<float>(2));
+
+		for (int i = 0; i < 6; ++i)
+		{
+			s.submit(input.data(), outputs[i].data(), [&completed, i] (std::exception_ptr error)
+			{
+				if (!error) ++completed;
+				if (i % 2 == 0) throw std::runtime_error("callback failed");
+			});
+		}
+
+		// the server is still working afterwards
+		std::vector<float> output (2);
+		s.calculate(input.data(), output.data());
+
+		NNET_CHECK(near(output, expected));
+		NNET_CHECK(completed == 6);
+		NNET_CHECK(handled == 3);
+
+		for (const std::vector<float> &o: outputs) NNET_CHECK(near(o, expected));
+	}
+
+}
+
+
+// the callback form of calculateAsync() hands over the output and a null error, once per request
+static void testAsyncCallback ()
+{
+
+	nnet::neural network ({4, 8, 2});
+	network.randomize();
+
+	std::vector<float> input (4, -0.25f);
+
+	network.setInput(input);
+	network.calculate();
+
+	const std::vector<float> expected = network.outputLayer->values;
+
+	std::atomic<int> calls {0};
+	std::atomic<int> good {0};
+
+	{
+		nnet::server s (network);
+
+		for (int i = 0; i < 8; ++i)
+		{
+			s.calculateAsync(input, [&calls, &good, &expected] (std::vector<float> output, std::exception_ptr error)
+			{
+				++calls;
+				if (!error && near(output, expected)) ++good;
+			});
+		}
+
+		// destroying the server finishes every queued request
+	}
+
+	NNET_CHECK(calls == 8);
+	NNET_CHECK(good == 8);
+
+}
+
+
+int main ()
+{
+	testThrowingCallback();
+	testAsyncCallback();
+
+	return testResult();
+}
@@ -0,0 +1,40 @@
+// shared by the tests, each of which is its own executable, run by ctest
+// a failed check is reported and counted, and main() returns testResult() so any failure fails the test
+
+#ifndef NNET_TEST_HPP
+#define NNET_TEST_HPP
+
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+
+
+static int testFailures = 0;
+
+#define NNET_CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++testFailures; \
+		} \
+	} while (false)
+
+
+// a path in the system's temporary directory, unique to this run, so tests running in parallel don't collide
+inline std::string testPath (const std::string &name)
+{
+	static const std::string run = std::to_string(std::random_device()());
+	return (std::filesystem::temp_directory_path() / ("nnet_test_" + run + "_" + name)).string();
+}
+
+inline int testResult ()
+{
+	if (testFailures == 0) std::printf("all checks passed\n");
+	return testFailures == 0 ? 0 : 1;
+}
+
+
+#endif
@@ -0,0 +1,195 @@
+#include "../include/nnet.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+
+static std::vector<float> allWeights (const nnet::neural &n, bool withBiases = true)
+{
+
+	std::vector<float> all;
+
+	for (int i = 1; i < n.layers.size(); ++i)
+	{
+		const nnet::layer &l = *n.layers.at(i);
+
+		std::vector<float> w((size_t) l.nodeCount * l.prevNodeCount);
+		l.loadWeights(0, w.size(), w.data());
+
+		all.insert(all.end(), w.begin(), w.end());
+		if (withBiases) all.insert(all.end(), l.biases.get(), l.biases.get() + l.nodeCount);
+	}
+
+	return all;
+
+}
+
+static float maxDifference (const std::vector<float> &a, const std::vector<float> &b)
+{
+
+	float diff = a.size() == b.size() ? 0 : INFINITY;
+
+	for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+	{
+		diff = std::fmax(diff, std::fabs(a[i] - b[i]));
+	}
+
+	return diff;
+
+}
+
+
+struct batch
+{
+	std::vector<float> inputs;
+	std::vector<float> ideals;
+	size_t count;
+
+	batch (size_t inputCount, size_t outputCount, size_t count)
+	: inputs(inputCount * count), ideals(outputCount * count), count {count}
+	{
+		for (size_t i = 0; i < inputs.size(); ++i) inputs[i] = std::sin(0.7f * i);
+		for (size_t i = 0; i < ideals.size(); ++i) ideals[i] = 0.5f * std::cos(1.3f * i);
+	}
+};
+
+
+// the trainer splits the network once, and pruning it to sparse storage afterwards gives it new parameter buffers
+// the next step has to train those, matching a single-threaded step on an identical network
+static void testParallelTrainerAfterPrune ()
+{
+
+	nnet::neural network (std::vector<int> {8, 32, 16, 4});
+	network.randomize();
+
+	nnet::neural* reference = network.makeCopy();
+
+	batch b (8, 4, 24);
+
+	nnet::parallelTrainer trainer (network, 4);
+
+	trainer.trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+	reference->trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+
+	NNET_CHECK(maxDifference(allWeights(network), allWeights(*reference)) < 1e-5f);
+
+	for (nnet::neural* n: {&network, reference})
+	{
+		n->prune(0.75f);
+		n->setStorageType(nnet::storageType::sparse);
+	}
+
+	trainer.trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+	reference->trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+
+	NNET_CHECK(maxDifference(allWeights(network), allWeights(*reference)) < 1e-5f);
+
+	// and back to dense storage, with a different optimizer
+	for (nnet::neural* n: {&network, reference})
+	{
+		n->setStorageType(nnet::storageType::float32);
+
+		nnet::optimizerSettings adam;
+		adam.type = nnet::optimizerType::adam;
+		n->setOptimizer(adam);
+	}
+
+	trainer.trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+	reference->trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+
+	NNET_CHECK(maxDifference(allWeights(network), allWeights(*reference)) < 1e-5f);
+
+	delete reference;
+
+}
+
+
+// hogwild replicas write straight into the network's parameters, so after pruning to sparse storage they have to write into the new ones
+// thread 0 gets a sample the network already gets exactly right, so any change to the weights has to come from thread 1's replica
+// (the biases aren't replaced by setStorageType(), so only the weights show whether the replica writes to the right place)
+static void testHogwildTrainerAfterPrune ()
+{
+
+	nnet::neural network ({6, 12, 3});
+	network.randomize();
+
+	nnet::hogwildTrainer trainer (network, 2);
+
+	batch b (6, 3, 8);
+	trainer.train(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+
+	network.prune(0.5f);
+	network.setStorageType(nnet::storageType::sparse);
+
+	std::vector<float> inputs (b.inputs.begin(), b.inputs.begin() + 2 * 6);
+	std::vector<float> ideals (2 * 3, 0.9f);
+
+	network.setInput(inputs.data(), 6);
+	network.calculate();
+	std::copy(network.outputLayer->values.begin(), network.outputLayer->values.end(), ideals.begin());
+
+	const std::vector<float> before = allWeights(network, false);
+	const size_t stored = network.layers.at(1)->storedWeightCount();
+
+	trainer.train(inputs.data(), ideals.data(), 2, 0.05f);
+
+	NNET_CHECK(maxDifference(allWeights(network, false), before) > 0);
+	NNET_CHECK(network.layers.at(1)->storedWeightCount() == stored);
+
+}
+
+
+// the ranks sum their nudges in a buffer sized for the sparse weights when the trainer was made,
+// so going back to dense storage afterwards has to be refused rather than overflow it
+static void testDistributedTrainerAfterStorageChange ()
+{
+
+	const int failed = nnet::launchLocal(2, [] (int rank)
+	{
+		nnet::neural network ({6, 12, 3});
+		network.randomize();
+		network.prune(0.5f);
+		network.setStorageType(nnet::storageType::sparse);
+
+		nnet::distributedSettings settings;
+		settings.rank = rank;
+		settings.worldSize = 2;
+		settings.basePort = 29640;
+
+		nnet::distributedTrainer trainer (network, settings);
+
+		batch b (6, 3, 4);
+		trainer.trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+
+		network.setStorageType(nnet::storageType::float32);
+
+		try
+		{
+			trainer.trainBatch(b.inputs.data(), b.ideals.data(), b.count, 0.05f);
+		}
+		catch (const nnet::usageError&)
+		{
+			return;
+		}
+
+		throw std::runtime_error("trainBatch() accepted a network whose storage type changed");
+	});
+
+	NNET_CHECK(failed == 0);
+
+}
+
+
+int main ()
+{
+	// before the other tests start any threads, see launchLocal()
+	testDistributedTrainerAfterStorageChange();
+
+	testParallelTrainerAfterPrune();
+	testHogwildTrainerAfterPrune();
+
+	return testResult();
+}